@@ -28,6 +28,9 @@ PTHREAD_LIBS!=pthread-config --libs
 XOSD_LIBS!=xosd-config --libs
 XOSD_CFLAGS=-I/usr/local/include -I/usr/X11R6/include
 
+## The xlib backend draws with Xlib and the SHAPE extension directly:
+X11_LIBS=-L/usr/X11R6/lib -L/usr/local/lib -lXext -lX11
+
 ## Judy doesn't seem to play with any of the meta-config things:
 JUDY_LIBS=-lJudy
 
@@ -37,5 +40,5 @@ C_OPTIMIZED?=-O2 -pipe $(C_WARNINGS)
 #CFLAGS=$(C_DEBUGGING) $(XOSD_CFLAGS) $(PTHREAD_CFLAGS)
 CFLAGS+=$(C_DEBUGGING) $(XOSD_CFLAGS)
 LDFLAGS+=$(XOSD_LDFLAGS)
-LIBS+=$(XOSD_LIBS) $(JUDY_LIBS) $(PTHREAD_LIBS)
+LIBS+=$(X11_LIBS) $(XOSD_LIBS) $(JUDY_LIBS) $(PTHREAD_LIBS)
 #LIBS+=$(XOSD_LIBS)
@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2015 by attila <attila@stalphonsos.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Encode and decode binary control messages; see ctlmsg.h for the
+ * format.
+ */
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <string.h>
+#include "ctlmsg.h"
+
+#define KIND_NONE	0
+#define KIND_INT	1
+#define KIND_FLOAT	2
+#define KIND_STR	3
+
+/*
+ * What each field type holds and where it lives in struct ctl_cmd
+ */
+static const struct {
+	int	 kind;
+	size_t	 off;
+} fields[CTL_NTYPES] = {
+#define field(tt,kk,ff) [tt] = { kk, offsetof(struct ctl_cmd,ff) }
+	field(CTL_FLAGS,	KIND_INT,	flags),
+	field(CTL_DISPLAY,	KIND_INT,	display_msecs),
+	field(CTL_LONG_PAUSE,	KIND_INT,	long_pause_msecs),
+	field(CTL_NET_SPEED,	KIND_INT,	net_speed_mbits),
+	field(CTL_NET_TOP,	KIND_INT,	net_top_n),
+	field(CTL_HISTORY,	KIND_INT,	history_secs),
+	field(CTL_QUERY,	KIND_INT,	query_secs),
+	field(CTL_SNAPSHOT,	KIND_INT,	snapshot),
+	field(CTL_STREAM,	KIND_INT,	stream_every),
+	field(CTL_MAX_TEMP,	KIND_FLOAT,	max_temperature),
+	field(CTL_FONT,		KIND_STR,	font),
+	field(CTL_IFACE,	KIND_STR,	iface),
+	field(CTL_SENSOR,	KIND_STR,	sensor),
+	field(CTL_TIME_FMT,	KIND_STR,	time_fmt),
+	field(CTL_LAYOUT,	KIND_STR,	layout),
+#undef field
+};
+
+#define field_ptr(cc,tt) ((char *)(cc) + fields[tt].off)
+
+static void
+put32(unsigned char *p, u_int32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static u_int32_t
+get32(const unsigned char *p)
+{
+	return ((u_int32_t)p[0] << 24) | ((u_int32_t)p[1] << 16) |
+		((u_int32_t)p[2] << 8) | p[3];
+}
+
+/*
+ * Given the first len bytes of a message, return its full length, 0
+ * if we do not have the whole header yet or -1 if this is not a
+ * binary message we understand
+ */
+int
+ctl_msglen(const char *buf, int len)
+{
+	const unsigned char *p = (const unsigned char *)buf;
+	int n;
+
+	if ((len > 0) && (p[0] != CTL_MAGIC))
+		return -1;
+	if ((len > 1) && (p[1] != CTL_VERSION))
+		return -1;
+	if (len < CTL_HDR_LEN)
+		return 0;
+	n = (p[2] << 8) | p[3];
+	if ((n < CTL_HDR_LEN) || (n > CTL_MAX_LEN))
+		return -1;
+	return n;
+}
+
+/*
+ * Encode the fields of cmd that are present into buf, which holds len
+ * bytes.  Returns the length of the message or -1 if it did not fit.
+ */
+int
+ctl_encode(struct ctl_cmd *cmd, char *buf, int len)
+{
+	unsigned char *p = (unsigned char *)buf;
+	int off = CTL_HDR_LEN;
+	int t;
+
+	if (len > CTL_MAX_LEN)
+		len = CTL_MAX_LEN;
+	if (len < CTL_HDR_LEN)
+		return -1;
+	for (t = 0; t < CTL_NTYPES; t++) {
+		struct ctl_str *str;
+		u_int32_t v;
+
+		if (!fields[t].kind || !(cmd->present & CTL_BIT(t)))
+			continue;
+		switch (fields[t].kind) {
+		case KIND_INT:
+		case KIND_FLOAT:
+			if (off + 6 > len)
+				return -1;
+			memcpy(&v,field_ptr(cmd,t),sizeof(v));
+			p[off++] = t;
+			p[off++] = 4;
+			put32(&p[off],v);
+			off += 4;
+			break;
+		case KIND_STR:
+			str = (struct ctl_str *)field_ptr(cmd,t);
+			if ((str->len > 255) || (off + 2 + str->len > len))
+				return -1;
+			p[off++] = t;
+			p[off++] = str->len;
+			memcpy(&p[off],str->s,str->len);
+			off += str->len;
+			break;
+		}
+	}
+	p[0] = CTL_MAGIC;
+	p[1] = CTL_VERSION;
+	p[2] = off >> 8;
+	p[3] = off;
+	return off;
+}
+
+/*
+ * Decode the message in buf into cmd.  String fields point into buf.
+ * Returns 0 or -1 if the message is malformed.
+ */
+int
+ctl_decode(const char *buf, int len, struct ctl_cmd *cmd)
+{
+	const unsigned char *p = (const unsigned char *)buf;
+	int off = CTL_HDR_LEN;
+	int n = ctl_msglen(buf,len);
+
+	if ((n <= 0) || (n > len))
+		return -1;
+	memset(cmd,0,sizeof(*cmd));
+	while (off < n) {
+		int t, l;
+
+		if (off + 2 > n)
+			return -1;
+		t = p[off++];
+		l = p[off++];
+		if (off + l > n)
+			return -1;
+		if ((t < CTL_NTYPES) && fields[t].kind) {
+			if (fields[t].kind == KIND_STR) {
+				struct ctl_str *str =
+					(struct ctl_str *)field_ptr(cmd,t);
+
+				str->s = &buf[off];
+				str->len = l;
+			} else {
+				u_int32_t v;
+
+				if (l != 4)
+					return -1;
+				v = get32(&p[off]);
+				memcpy(field_ptr(cmd,t),&v,sizeof(v));
+			}
+			cmd->present |= CTL_BIT(t);
+		}
+		off += l;
+	}
+	return 0;
+}
+
+/*
+ * Local variables:
+ * mode: c
+ * c-file-style: "bsd"
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ */
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2015 by attila <attila@stalphonsos.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The binary form of a control message.  A message is a 4-byte
+ * header followed by type-length-value fields:
+ *
+ *	0x00 version len(hi) len(lo) { type len value... } ...
+ *
+ * where the 16-bit length covers the whole message, header included.
+ * No text message can begin with a NUL, so the daemon tells the two
+ * apart by the first byte.  Numbers are 4 bytes, big-endian; floats
+ * are sent as their bit pattern.  Strings are not NUL-terminated, and
+ * decoding leaves them pointing into the buffer they came in, so a
+ * message decodes without allocating anything.  Fields of a type we
+ * do not know are skipped, which leaves room to add new ones without
+ * bumping the version.
+ */
+
+#define CTL_MAGIC	0x00
+#define CTL_VERSION	1
+#define CTL_HDR_LEN	4
+#define CTL_MAX_LEN	2048
+
+/* Field types */
+#define CTL_FLAGS	1		/* CTL_F_xxx bits */
+#define CTL_DISPLAY	2		/* -d msecs */
+#define CTL_LONG_PAUSE	3		/* -P msecs */
+#define CTL_NET_SPEED	4		/* -X mbits */
+#define CTL_NET_TOP	5		/* -I n */
+#define CTL_HISTORY	6		/* -H secs */
+#define CTL_QUERY	7		/* -Q secs */
+#define CTL_SNAPSHOT	8		/* -q, one of CTL_SNAP_xxx */
+#define CTL_STREAM	9		/* -e ticks */
+#define CTL_MAX_TEMP	10		/* -M degC, a float */
+#define CTL_FONT	11		/* -f */
+#define CTL_IFACE	12		/* -i */
+#define CTL_SENSOR	13		/* -m */
+#define CTL_TIME_FMT	14		/* -T */
+#define CTL_LAYOUT	15		/* -L */
+#define CTL_NTYPES	16
+
+#define CTL_BIT(tt)	(1U << (tt))
+
+/* Bits in CTL_FLAGS */
+#define CTL_F_KILL	0x0001		/* -k */
+#define CTL_F_DOWN	0x0002		/* -D */
+#define CTL_F_UP	0x0004		/* -U */
+#define CTL_F_STICK	0x0008		/* -S */
+#define CTL_F_UNSTICK	0x0010		/* -N */
+#define CTL_F_TOGGLE	0x0020		/* -t */
+#define CTL_F_ALERTS	0x0040		/* -a */
+#define CTL_F_NOALERTS	0x0080		/* -A */
+#define CTL_F_COUNTDOWN	0x0100		/* -C */
+
+#define CTL_SNAP_LINE	1
+#define CTL_SNAP_JSON	2
+
+struct ctl_str {
+	const char	*s;		/* not NUL-terminated */
+	int		 len;
+};
+
+/*
+ * A decoded message.  present has CTL_BIT(type) set for each field
+ * that was sent; the others are zero and should not be looked at.
+ */
+struct ctl_cmd {
+	u_int32_t	 present;
+	u_int32_t	 flags;
+	int32_t		 display_msecs;
+	int32_t		 long_pause_msecs;
+	int32_t		 net_speed_mbits;
+	int32_t		 net_top_n;
+	int32_t		 history_secs;
+	int32_t		 query_secs;
+	int32_t		 snapshot;
+	int32_t		 stream_every;
+	float		 max_temperature;
+	struct ctl_str	 font;
+	struct ctl_str	 iface;
+	struct ctl_str	 sensor;
+	struct ctl_str	 time_fmt;
+	struct ctl_str	 layout;
+};
+
+int ctl_msglen(const char *, int);
+int ctl_encode(struct ctl_cmd *, char *, int);
+int ctl_decode(const char *, int, struct ctl_cmd *);
+
+/*
+ * Local variables:
+ * mode: c
+ * c-file-style: "bsd"
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ */
@@ -0,0 +1,253 @@
+/*
+ * Copyright (C) 2015 by attila <attila@stalphonsos.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Flight recorder: the last FLIGHTREC_NSNAPS ticks of raw probe
+ * results, dumped to a file when an alert goes off.
+ *
+ * The dump is written by a forked child, which sees the ring exactly
+ * as it was at the moment of the fork, so the HUD loop neither copies
+ * the ring nor waits for the disk.  The child writes a temporary file,
+ * fsyncs it and renames it into place, so a dump is either complete
+ * or absent.  Only one dump runs at a time; triggers that arrive while
+ * one is in progress are counted and dropped.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "flightrec.h"
+
+/*
+ * Allocate an empty recorder that dumps into dir
+ */
+struct flightrec *
+flightrec_new(const char *dir)
+{
+	struct flightrec *fr = calloc(1,sizeof(*fr));
+
+	assert(fr);
+	fr->dir = strdup(dir);
+	assert(fr->dir);
+	return fr;
+}
+
+/*
+ * Tear down a recorder; a dump in progress carries on without us
+ */
+void
+flightrec_free(struct flightrec *fr)
+{
+	if (!fr)
+		return;
+	free(fr->dir);
+	free(fr);
+}
+
+/*
+ * Collect the writer if it has finished
+ */
+static void
+reap(struct flightrec *fr)
+{
+	int status;
+
+	if (!fr->writer || (waitpid(fr->writer,&status,WNOHANG) == 0))
+		return;
+	if (!WIFEXITED(status) || WEXITSTATUS(status))
+		fr->nfailed++;
+	fr->writer = 0;
+}
+
+/*
+ * Record one tick
+ */
+void
+flightrec_add(struct flightrec *fr, struct flightrec_snap *snap)
+{
+	if (!fr)
+		return;
+	reap(fr);
+	fr->snaps[fr->next] = *snap;
+	fr->next = (fr->next + 1) % FLIGHTREC_NSNAPS;
+	if (fr->count < FLIGHTREC_NSNAPS)
+		fr->count++;
+}
+
+static int
+write_all(int fd, const void *buf, size_t len)
+{
+	const char *cp = buf;
+
+	while (len) {
+		ssize_t nw = write(fd,cp,len);
+
+		if (nw < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		cp += nw;
+		len -= nw;
+	}
+	return 0;
+}
+
+/*
+ * In the child: write the ring out and exit
+ */
+static void
+write_dump(struct flightrec *fr, u_int32_t alerts, char *path)
+{
+	struct flightrec_hdr hdr;
+	unsigned int first = (fr->next + FLIGHTREC_NSNAPS - fr->count) %
+		FLIGHTREC_NSNAPS;
+	unsigned int n1 = FLIGHTREC_NSNAPS - first;
+	char tmp[1024];
+	int fd;
+
+	if (n1 > fr->count)
+		n1 = fr->count;
+	if (snprintf(tmp,sizeof(tmp),"%s.tmp",path) >= sizeof(tmp))
+		_exit(1);
+	fd = open(tmp,O_WRONLY|O_CREAT|O_TRUNC,0600);
+	if (fd < 0)
+		_exit(1);
+	memset(&hdr,0,sizeof(hdr));
+	hdr.magic = FLIGHTREC_MAGIC;
+	hdr.version = FLIGHTREC_VERSION;
+	hdr.snap_size = sizeof(struct flightrec_snap);
+	hdr.nsnaps = fr->count;
+	hdr.alerts = alerts;
+	hdr.t = fr->count ?
+		fr->snaps[(fr->next + FLIGHTREC_NSNAPS - 1) %
+			  FLIGHTREC_NSNAPS].t : 0;
+	if (write_all(fd,&hdr,sizeof(hdr)) ||
+	    write_all(fd,&fr->snaps[first],n1 * sizeof(fr->snaps[0])) ||
+	    write_all(fd,&fr->snaps[0],
+		      (fr->count - n1) * sizeof(fr->snaps[0])) ||
+	    fsync(fd) || close(fd) || rename(tmp,path)) {
+		(void) unlink(tmp);
+		_exit(1);
+	}
+	_exit(0);
+}
+
+/*
+ * Start dumping the ring because the given alerts just went off.  On
+ * success path holds the name of the file being written and we return
+ * 0; otherwise path holds an error message and we return -1.
+ */
+int
+flightrec_dump(struct flightrec *fr, u_int32_t alerts, char *path,
+	       size_t pathlen)
+{
+	time_t now = time(NULL);
+	struct tm ltime;
+	char stamp[64];
+	pid_t pid;
+
+	reap(fr);
+	if (fr->writer) {
+		fr->nskipped++;
+		snprintf(path,pathlen,"dump already in progress");
+		return -1;
+	}
+	(void) localtime_r(&now,&ltime);
+	assert(strftime(stamp,sizeof(stamp),"%Y%m%d-%H%M%S",&ltime) > 0);
+	if (snprintf(path,pathlen,"%s/osdhud-%s-%u.fr",fr->dir,stamp,
+		     fr->ndumps) >= pathlen) {
+		snprintf(path,pathlen,"dump path too long");
+		return -1;
+	}
+	pid = fork();
+	if (pid < 0) {
+		snprintf(path,pathlen,"fork: %s",strerror(errno));
+		return -1;
+	}
+	if (!pid)
+		write_dump(fr,alerts,path);
+	fr->writer = pid;
+	fr->ndumps++;
+	return 0;
+}
+
+/*
+ * Print a dump as CSV; returns 0 or -1 with a message in errbuf
+ */
+int
+flightrec_decode(const char *path, FILE *out, char *errbuf, size_t errlen)
+{
+	struct flightrec_hdr hdr;
+	struct flightrec_snap snap;
+	FILE *in = fopen(path,"r");
+	unsigned int i;
+	int ret = -1;
+
+	if (!in) {
+		snprintf(errbuf,errlen,"%s: %s",path,strerror(errno));
+		return -1;
+	}
+	if (fread(&hdr,sizeof(hdr),1,in) != 1)
+		snprintf(errbuf,errlen,"%s: short header",path);
+	else if (hdr.magic != FLIGHTREC_MAGIC)
+		snprintf(errbuf,errlen,"%s: not a flight recording",path);
+	else if ((hdr.version != FLIGHTREC_VERSION) ||
+		 (hdr.snap_size != sizeof(snap)))
+		snprintf(errbuf,errlen,"%s: unsupported version %u",path,
+			 hdr.version);
+	else {
+		fprintf(out,"t_msecs,load,mem,swap,net_ikbps,net_okbps,"
+			"net_ipxps,net_opxps,temp,battery_life,"
+			"battery_time,alerts\n");
+		for (i = 0; i < hdr.nsnaps; i++) {
+			if (fread(&snap,sizeof(snap),1,in) != 1)
+				break;
+			fprintf(out,"%llu,%.2f,%.4f,%.4f,%.1f,%.1f,%.1f,%.1f,"
+				"%.1f,%d,%d,%u\n",(unsigned long long)snap.t,
+				snap.load_avg,snap.mem_used,snap.swap_used,
+				snap.net_ikbps,snap.net_okbps,snap.net_ipxps,
+				snap.net_opxps,snap.temperature,
+				snap.battery_life,snap.battery_time,
+				snap.alerts);
+		}
+		if (i < hdr.nsnaps)
+			snprintf(errbuf,errlen,"%s: truncated after %u of %u",
+				 path,i,hdr.nsnaps);
+		else
+			ret = 0;
+	}
+	fclose(in);
+	return ret;
+}
+
+/*
+ * Local variables:
+ * mode: c
+ * c-file-style: "bsd"
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ */
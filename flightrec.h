@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2015 by attila <attila@stalphonsos.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define FLIGHTREC_MAGIC	0x4f534446	/* "OSDF" */
+#define FLIGHTREC_VERSION 1
+#define FLIGHTREC_NSNAPS 1024		/* ~80 seconds of 80ms ticks */
+
+/*
+ * What the probes found on one tick
+ */
+struct flightrec_snap {
+	u_int64_t	 t;		/* msecs */
+	float		 load_avg;
+	float		 mem_used;	/* fraction */
+	float		 swap_used;	/* fraction */
+	float		 net_ikbps;
+	float		 net_okbps;
+	float		 net_ipxps;
+	float		 net_opxps;
+	float		 temperature;
+	int32_t		 battery_life;
+	int32_t		 battery_time;
+	u_int32_t	 alerts;	/* ALERT_xxx bits */
+};
+
+/*
+ * Dump file layout: this header followed by nsnaps snapshots, oldest
+ * first
+ */
+struct flightrec_hdr {
+	u_int32_t	 magic;
+	u_int16_t	 version;
+	u_int16_t	 snap_size;
+	u_int32_t	 nsnaps;
+	u_int32_t	 alerts;	/* the bits that triggered the dump */
+	u_int64_t	 t;		/* when */
+};
+
+/*
+ * The in-memory ring
+ */
+struct flightrec {
+	char		*dir;		/* where dumps go */
+	struct flightrec_snap snaps[FLIGHTREC_NSNAPS];
+	unsigned int	 next;		/* slot for the next snapshot */
+	unsigned int	 count;		/* #of slots filled */
+	pid_t		 writer;	/* dump in progress, or 0 */
+	u_int32_t	 ndumps;
+	u_int32_t	 nfailed;	/* dumps whose writer failed */
+	u_int32_t	 nskipped;	/* triggers while a dump was running */
+};
+
+/*
+ * API
+ */
+struct flightrec *flightrec_new(const char *);
+void flightrec_free(struct flightrec *);
+void flightrec_add(struct flightrec *, struct flightrec_snap *);
+int flightrec_dump(struct flightrec *, u_int32_t, char *, size_t);
+int flightrec_decode(const char *, FILE *, char *, size_t);
+
+/*
+ * Local variables:
+ * mode: c
+ * c-file-style: "bsd"
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ */
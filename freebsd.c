@@ -26,6 +26,8 @@
  * PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include "iftable.h"
+#include "hud.h"
 #include "osdhud.h"
 #include <sys/param.h>
 #include <sys/sysctl.h>
@@ -99,49 +101,34 @@ void probe_net(
     for (i = 1; i < ifcount; i++) {
         struct ifmibdata ifmd;
         struct if_data *d = NULL;
-        int delta_in = 0;
-        int delta_out = 0;
-        int delta_pin = 0;
-        int delta_pout = 0;
+        struct ifcounters c;
+        int watched = 0;
 
         mib[4] = i;
         len = sizeof(ifmd);
         DO_SYSCTL("ifmib",mib,6,&ifmd,&len,NULL,0);
-        /* If an interface name was specified and this isn't it, skip it */
-        if (state->net_iface && strcmp(ifmd.ifmd_name,state->net_iface))
-            continue;
-        /* If no interface name was specified and this one is down, skip it */
-        if (!state->net_iface && !(ifmd.ifmd_flags & IFF_UP))
-            continue;
         d = &ifmd.ifmd_data;
         if (state->verbose)
             syslog(LOG_DEBUG,"#%2d/%2d: %s flags=0x%x ipackets=%lu ierr=%lu opackets=%lu oerr=%lu recv=%lu sent=%lu\n",i,ifcount,ifmd.ifmd_name,ifmd.ifmd_flags,d->ifi_ipackets,d->ifi_ierrors,d->ifi_opackets,d->ifi_oerrors,d->ifi_ibytes,d->ifi_obytes);
-        if (!state->net_iface) {
+        /* If no interface name was specified pick the first one that is up */
+        if (!state->net_iface && (ifmd.ifmd_flags & IFF_UP)) {
             state->net_iface = strdup(ifmd.ifmd_name);
             if (state->verbose)
                 syslog(
                     LOG_WARNING,"chose network interface: %s",state->net_iface
                 );
         }
-        state->net_tot_ierr += d->ifi_ierrors;
-        state->net_tot_oerr += d->ifi_oerrors;
-
-        delta_in = d->ifi_ibytes - state->net_tot_ibytes;
-        state->net_tot_ibytes += delta_in;
-
-        delta_out = d->ifi_obytes - state->net_tot_obytes;
-        state->net_tot_obytes += delta_out;
-
-        delta_pin = d->ifi_ipackets - state->net_tot_ipackets;
-        state->net_tot_ipackets += delta_pin;
-
-        delta_pout = d->ifi_opackets - state->net_tot_opackets;
-        state->net_tot_opackets += delta_pout;
-
-        update_net_statistics(state,delta_in,delta_out,delta_pin,delta_pout);
-        break;
+        if (state->net_iface && !strcmp(ifmd.ifmd_name,state->net_iface))
+            watched = 1;
+        c.ibytes = d->ifi_ibytes;
+        c.obytes = d->ifi_obytes;
+        c.ipackets = d->ifi_ipackets;
+        c.opackets = d->ifi_opackets;
+        c.ierrs = d->ifi_ierrors;
+        c.oerrs = d->ifi_oerrors;
+        update_net_statistics(state,i,ifmd.ifmd_name,&c,watched);
     }
-    if (i == ifcount)
+    if (!state->net_iface)
         syslog(LOG_WARNING,"no useful network interfaces / %d seen",ifcount);
 }
 
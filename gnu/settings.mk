@@ -4,10 +4,27 @@ include generic/settings.mk
 
 VERSION=$(shell cat $(S)/VERSION)
 UNAME=$(shell uname | tr A-Z a-z)
-XLSD_LIBS=$(shell xosd-config --libs)
+XOSD_LIBS=$(shell xosd-config --libs)
 XOSD_CFLAGS=$(shell xosd-config --cflags)
+X11_LIBS=-lXext -lX11
 JUDY_LIBS=-lJudy
 C_DEBUGGING?=-g -ggdb -Wall -Werror
 CFLAGS+=$(C_DEBUGGING) -I/usr/local/include
 LDFLAGS+=-L/usr/local/lib
-LIBS+=$(XOSD_LIBS) $(JUDY_LIBS) $(PTHREAD_LIBS)
+LIBS+=$(X11_LIBS) $(XOSD_LIBS) $(JUDY_LIBS) $(PTHREAD_LIBS)
+
+## Linux has no strlcpy(3) et al. and its getopt(3) has no optreset;
+## libbsd's overlay mode gives us both without touching the sources.
+ifeq ($(UNAME),linux)
+BSD_CFLAGS=$(shell pkg-config --cflags libbsd-overlay)
+BSD_LIBS=$(shell pkg-config --libs libbsd-overlay)
+PTHREAD_LIBS=-lpthread
+CFLAGS+=-D_GNU_SOURCE $(BSD_CFLAGS)
+LIBS+=$(BSD_LIBS)
+endif
+
+## make COUNT_ALLOCS=1 builds a binary whose -B frame counts
+## allocations; it wraps malloc(3), so do not install it.
+ifdef COUNT_ALLOCS
+CFLAGS+=-DOSDHUD_COUNT_ALLOCS
+endif
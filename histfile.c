@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2015 by attila <attila@stalphonsos.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Metric history that survives a restart of the daemon.
+ *
+ * The file is mmap'd shared and written in place, so recording a
+ * sample costs no system calls; the kernel writes the pages back when
+ * it likes.  Crash recovery rests on three things:
+ *
+ *   - the header's layout fields carry a checksum, and a file that
+ *     does not match what we were built with is started afresh;
+ *   - every record carries its sequence number and a checksum, and is
+ *     written before the header's count is bumped, so the last good
+ *     record can always be found by looking either side of the count;
+ *   - the generation count is odd while the rollups are being
+ *     updated, so if we died in the middle the rollups are thrown away
+ *     and rebuilt from the records.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "rollup.h"
+#include "histfile.h"
+
+static u_int32_t
+checksum(const void *p, size_t len)
+{
+	const unsigned char *cp = p;
+	u_int32_t h = 2166136261u;	/* FNV-1a */
+
+	while (len--) {
+		h ^= *cp++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static u_int32_t
+hdr_sum(struct histfile_hdr *hdr)
+{
+	return checksum(hdr,offsetof(struct histfile_hdr,sum));
+}
+
+static u_int32_t
+rec_sum(struct histfile_rec *rec)
+{
+	return checksum(rec,offsetof(struct histfile_rec,sum));
+}
+
+/*
+ * Return the record written by append #seq, or NULL if it is gone or
+ * damaged
+ */
+struct histfile_rec *
+histfile_rec(struct histfile *hf, u_int64_t seq)
+{
+	struct histfile_rec *rec = &hf->recs[seq % HISTFILE_NRECS];
+
+	if ((rec->seq != seq) || (rec->sum != rec_sum(rec)))
+		return NULL;
+	return rec;
+}
+
+/*
+ * Start from scratch
+ */
+static void
+init_file(struct histfile *hf)
+{
+	struct histfile_hdr *hdr = hf->hdr;
+
+	memset(hf->map,0,hf->size);
+	hdr->magic = HISTFILE_MAGIC;
+	hdr->version = HISTFILE_VERSION;
+	hdr->nmetrics = hf->nmetrics;
+	hdr->nrecs = HISTFILE_NRECS;
+	hdr->rec_size = sizeof(struct histfile_rec);
+	hdr->rollup_size = sizeof(struct rollup);
+	hdr->sum = hdr_sum(hdr);
+	hf->created = 1;
+}
+
+/*
+ * Find the last good record and make the header agree with it; rebuild
+ * the rollups if we died while changing them
+ */
+static void
+recover(struct histfile *hf)
+{
+	struct histfile_hdr *hdr = hf->hdr;
+	u_int64_t seq = hdr->seq;
+	u_int64_t s, first;
+	int i, n;
+
+	for (n = 0; (n < HISTFILE_NRECS) && histfile_rec(hf,seq); n++)
+		seq++;
+	for (n = 0; (n < HISTFILE_NRECS) && seq && !histfile_rec(hf,seq - 1);
+	     n++)
+		seq--;
+	hdr->seq = seq;
+	if (!(hdr->gen & 1))
+		return;
+	first = (seq > HISTFILE_NRECS) ? seq - HISTFILE_NRECS : 0;
+	for (i = 0; i < hf->nmetrics; i++)
+		rollup_clear(&hf->rollups[i]);
+	for (s = first; s < seq; s++) {
+		struct histfile_rec *rec = histfile_rec(hf,s);
+
+		if (!rec)
+			continue;
+		for (i = 0; i < hf->nmetrics; i++)
+			rollup_add(&hf->rollups[i],rec->t,rec->vals[i]);
+	}
+	hdr->gen++;
+	hf->rebuilt = 1;
+}
+
+/*
+ * Map the history file at path, creating or resetting it as needed.
+ * Returns NULL with a message in errbuf if that cannot be done.
+ */
+struct histfile *
+histfile_open(const char *path, int nmetrics, char *errbuf, size_t errlen)
+{
+	struct histfile *hf;
+	struct stat st;
+	int fresh = 0;
+
+	assert(nmetrics <= HISTFILE_MAX_METRICS);
+	hf = calloc(1,sizeof(*hf));
+	assert(hf);
+	hf->nmetrics = nmetrics;
+	hf->size = sizeof(struct histfile_hdr) +
+		nmetrics * sizeof(struct rollup) +
+		HISTFILE_NRECS * sizeof(struct histfile_rec);
+	hf->fd = open(path,O_RDWR|O_CREAT,0600);
+	if (hf->fd < 0) {
+		snprintf(errbuf,errlen,"%s: %s",path,strerror(errno));
+		free(hf);
+		return NULL;
+	}
+	if (fstat(hf->fd,&st) || (st.st_size != (off_t)hf->size)) {
+		fresh = 1;
+		if (ftruncate(hf->fd,0) || ftruncate(hf->fd,hf->size)) {
+			snprintf(errbuf,errlen,"%s: %s",path,strerror(errno));
+			close(hf->fd);
+			free(hf);
+			return NULL;
+		}
+	}
+	hf->map = mmap(NULL,hf->size,PROT_READ|PROT_WRITE,MAP_SHARED,
+		       hf->fd,0);
+	if (hf->map == MAP_FAILED) {
+		snprintf(errbuf,errlen,"mmap %s: %s",path,strerror(errno));
+		close(hf->fd);
+		free(hf);
+		return NULL;
+	}
+	hf->hdr = hf->map;
+	hf->rollups = (struct rollup *)(hf->hdr + 1);
+	hf->recs = (struct histfile_rec *)(hf->rollups + nmetrics);
+	if (fresh || (hf->hdr->magic != HISTFILE_MAGIC) ||
+	    (hf->hdr->version != HISTFILE_VERSION) ||
+	    (hf->hdr->nmetrics != nmetrics) ||
+	    (hf->hdr->nrecs != HISTFILE_NRECS) ||
+	    (hf->hdr->rec_size != sizeof(struct histfile_rec)) ||
+	    (hf->hdr->rollup_size != sizeof(struct rollup)) ||
+	    (hf->hdr->sum != hdr_sum(hf->hdr)))
+		init_file(hf);
+	else
+		recover(hf);
+	return hf;
+}
+
+/*
+ * Unmap and close; the kernel finishes writing the pages
+ */
+void
+histfile_close(struct histfile *hf)
+{
+	if (!hf)
+		return;
+	(void) msync(hf->map,hf->size,MS_ASYNC);
+	(void) munmap(hf->map,hf->size);
+	close(hf->fd);
+	free(hf);
+}
+
+/*
+ * Bracket changes to the rollups in the file
+ */
+void
+histfile_begin(struct histfile *hf)
+{
+	if (hf)
+		hf->hdr->gen++;
+}
+
+void
+histfile_end(struct histfile *hf)
+{
+	if (hf)
+		hf->hdr->gen++;
+}
+
+/*
+ * Record one tick's worth of metric values taken at time t
+ */
+void
+histfile_append(struct histfile *hf, unsigned long t, float *vals)
+{
+	struct histfile_rec *rec;
+
+	if (!hf)
+		return;
+	rec = &hf->recs[hf->hdr->seq % HISTFILE_NRECS];
+	memset(rec,0,sizeof(*rec));
+	rec->seq = hf->hdr->seq;
+	rec->t = t;
+	memcpy(rec->vals,vals,hf->nmetrics * sizeof(float));
+	rec->sum = rec_sum(rec);
+	hf->hdr->seq++;
+}
+
+/*
+ * Local variables:
+ * mode: c
+ * c-file-style: "bsd"
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ */
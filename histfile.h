@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2015 by attila <attila@stalphonsos.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define HISTFILE_MAGIC	0x4f534448	/* "OSDH" */
+#define HISTFILE_VERSION 1
+#define HISTFILE_NRECS	16384		/* ~22 minutes of 80ms ticks */
+#define HISTFILE_MAX_METRICS 8
+
+/*
+ * On-disk layout: the header, one struct rollup per metric, then a
+ * ring of HISTFILE_NRECS records.  All of it is mmap'd and updated in
+ * place.
+ */
+struct histfile_hdr {
+	u_int32_t	 magic;
+	u_int32_t	 version;
+	u_int32_t	 nmetrics;
+	u_int32_t	 nrecs;
+	u_int32_t	 rec_size;
+	u_int32_t	 rollup_size;
+	u_int32_t	 sum;		/* checksum of the fields above */
+	u_int32_t	 pad;
+	u_int64_t	 seq;		/* #of records ever appended */
+	u_int64_t	 gen;		/* odd while the rollups are changing */
+};
+
+struct histfile_rec {
+	u_int64_t	 seq;		/* which append wrote this */
+	u_int64_t	 t;		/* msecs */
+	float		 vals[HISTFILE_MAX_METRICS];
+	u_int32_t	 sum;		/* checksum of seq, t and vals */
+	u_int32_t	 pad;
+};
+
+struct histfile {
+	int		 fd;
+	size_t		 size;
+	void		*map;
+	struct histfile_hdr *hdr;
+	struct rollup	*rollups;	/* nmetrics of them, in the map */
+	struct histfile_rec *recs;
+	int		 nmetrics;
+	unsigned int	 rebuilt:1;	/* rollups were recovered from recs */
+	unsigned int	 created:1;	/* file was (re)initialized */
+};
+
+/*
+ * API
+ */
+struct histfile *histfile_open(const char *, int, char *, size_t);
+void histfile_close(struct histfile *);
+void histfile_begin(struct histfile *);
+void histfile_append(struct histfile *, unsigned long, float *);
+void histfile_end(struct histfile *);
+struct histfile_rec *histfile_rec(struct histfile *, u_int64_t);
+
+/*
+ * Local variables:
+ * mode: c
+ * c-file-style: "bsd"
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ */
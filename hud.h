@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2015 by attila <attila@stalphonsos.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Ways of putting the HUD on the screen.
+ *
+ * display() formats each line and hands it to a backend: lines are
+ * numbered from the top, 0 to NLINES-1, and "meta" is the line in
+ * the bottom right corner.  A line keeps whatever it was last given
+ * until it is given something else, and display() only hands over
+ * lines that have changed since the last frame; a colour is only
+ * given when it changes, too.  Nothing has to reach the screen before
+ * flush(), which ends every frame.
+ */
+
+#define HUD_LINE_MAX	1024		/* longest line, with the NUL */
+
+/* Colours, by severity; see reading_to_color() */
+#define HUD_NOCOLOR	-1		/* leave the line the colour it was */
+#define HUD_GREEN	0
+#define HUD_YELLOW	1
+#define HUD_ORANGE	2
+#define HUD_RED		3
+#define HUD_VIOLET	4
+#define HUD_NCOLORS	5
+
+#define HUD_OUTLINE	1		/* pixels of black around text */
+#define HUD_SHADOW	4		/* ... and how far the shadow falls */
+
+struct osdhud_state;
+
+/*
+ * What display() last handed a backend for one line, so that it can
+ * skip lines that have not changed
+ */
+struct hud_line {
+	int		 valid;
+	int		 color;
+	int		 percent;	/* -1 for text */
+	char		 text[HUD_LINE_MAX];
+};
+
+/*
+ * What drawing the HUD has cost so far; requests is counted by the
+ * backend, in whatever unit it can: X requests for xlib, library
+ * calls for xosd, bytes written for tty, lines for null
+ */
+struct hud_stats {
+	u_int64_t	 frames;	/* display() calls */
+	u_int64_t	 lines;		/* lines handed to the backend */
+	u_int64_t	 skipped;	/* lines that had not changed */
+	u_int64_t	 requests;
+};
+
+/*
+ * One item of the -L layout, compiled: fn formats into buf with the
+ * op_xxx() integer formatters, no format strings, and hands it over
+ * as one or two lines
+ */
+struct hud_op {
+	void		(*fn)(struct osdhud_state *, struct hud_op *);
+	int		 len;		/* bytes in buf */
+	char		 buf[HUD_LINE_MAX];
+};
+
+struct hud_backend {
+	const char	*name;
+	int		(*open)(struct osdhud_state *, char *font);
+	void		(*close)(struct osdhud_state *);
+	int		(*show)(struct osdhud_state *);
+	void		(*hide)(struct osdhud_state *);
+	void		(*text)(struct osdhud_state *, int line, int color,
+				const char *text);
+	void		(*bar)(struct osdhud_state *, int line, int color,
+			       int percent);
+	void		(*meta)(struct osdhud_state *, const char *text);
+	void		(*flush)(struct osdhud_state *);
+};
+
+extern const char *hud_color_names[HUD_NCOLORS];
+
+extern struct hud_backend hud_xlib;	/* one shaped window, no threads */
+extern struct hud_backend hud_xosd;	/* an xosd per line */
+extern struct hud_backend hud_tty;	/* ANSI terminal, no X at all */
+extern struct hud_backend hud_null;	/* nothing, maybe recorded: -B frame */
+
+/*
+ * Local variables:
+ * mode: c
+ * c-file-style: "bsd"
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ */
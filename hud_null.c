@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2015 by attila <attila@stalphonsos.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A display backend that puts nothing on the screen, for measuring
+ * and testing display() where there is no X server (see -B frame).
+ * It keeps every line it is given, so the latest frame can be looked
+ * at from a debugger, and with -b null:path it also records each
+ * frame's lines, bars and colours in path, one HUD line per line:
+ *
+ *	<frame> <line> <colour> text <text>
+ *	<frame> <line> <colour> bar <percent>
+ *	<frame> meta <text>
+ *
+ * Only lines display() hands over are recorded, i.e. those that
+ * changed.  We count lines handed to us as requests.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include "movavg.h"
+#include "iftable.h"
+#include "hud.h"
+#include "osdhud.h"
+
+#define META NLINES
+
+struct null_hud {
+	FILE		*rec;		/* -b null:path, or NULL */
+	u_int64_t	 frame;
+	struct hud_line	 lines[META + 1];
+};
+
+#define HUD(ss) ((struct null_hud *)(ss)->hud_priv)
+
+static void
+null_close(struct osdhud_state *state)
+{
+	struct null_hud *hud = HUD(state);
+
+	if (!hud)
+		return;
+	if (hud->rec)
+		fclose(hud->rec);
+	free(hud);
+	state->hud_priv = NULL;
+}
+
+static int
+null_open(struct osdhud_state *state, char *font)
+{
+	struct null_hud *hud = calloc(1,sizeof(*hud));
+	int i;
+
+	assert(hud);
+	state->hud_priv = hud;
+	for (i = 0; i <= META; i++) {
+		hud->lines[i].color = HUD_GREEN;
+		hud->lines[i].percent = -1;
+	}
+	if (state->hud_arg) {
+		hud->rec = fopen(state->hud_arg,"w");
+		if (!hud->rec) {
+			syslog(LOG_ERR,"null: cannot record to %s: %s",
+			       state->hud_arg,strerror(errno));
+			null_close(state);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int
+null_show(struct osdhud_state *state)
+{
+	return 0;
+}
+
+static void
+null_hide(struct osdhud_state *state)
+{
+	if (HUD(state)->rec)
+		fflush(HUD(state)->rec);
+}
+
+static struct hud_line *
+set_line(struct osdhud_state *state, int line, int color, int percent)
+{
+	struct hud_line *hl = &HUD(state)->lines[line];
+
+	state->hud_stats.requests++;
+	hl->valid = 1;
+	if (color != HUD_NOCOLOR)
+		hl->color = color;
+	hl->percent = percent;
+	return hl;
+}
+
+static void
+null_text(struct osdhud_state *state, int line, int color, const char *text)
+{
+	struct null_hud *hud = HUD(state);
+	struct hud_line *hl = set_line(state,line,color,-1);
+
+	strlcpy(hl->text,text,sizeof(hl->text));
+	if (hud->rec)
+		fprintf(hud->rec,"%llu %d %s text %s\n",
+			(unsigned long long)hud->frame,line,
+			hud_color_names[hl->color],hl->text);
+}
+
+static void
+null_bar(struct osdhud_state *state, int line, int color, int percent)
+{
+	struct null_hud *hud = HUD(state);
+	struct hud_line *hl = set_line(state,line,color,percent);
+
+	hl->text[0] = '\0';
+	if (hud->rec)
+		fprintf(hud->rec,"%llu %d %s bar %d\n",
+			(unsigned long long)hud->frame,line,
+			hud_color_names[hl->color],percent);
+}
+
+static void
+null_meta(struct osdhud_state *state, const char *text)
+{
+	struct null_hud *hud = HUD(state);
+	struct hud_line *hl = set_line(state,META,HUD_NOCOLOR,-1);
+
+	strlcpy(hl->text,text,sizeof(hl->text));
+	if (hud->rec)
+		fprintf(hud->rec,"%llu meta %s\n",
+			(unsigned long long)hud->frame,hl->text);
+}
+
+static void
+null_flush(struct osdhud_state *state)
+{
+	HUD(state)->frame++;
+}
+
+struct hud_backend hud_null = {
+	.name = "null",
+	.open = null_open,
+	.close = null_close,
+	.show = null_show,
+	.hide = null_hide,
+	.text = null_text,
+	.bar = null_bar,
+	.meta = null_meta,
+	.flush = null_flush,
+};
+
+/*
+ * Local variables:
+ * mode: c
+ * c-file-style: "bsd"
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ */
@@ -0,0 +1,461 @@
+/*
+ * Copyright (C) 2015 by attila <attila@stalphonsos.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Draw the HUD on a terminal, for machines with no X server.
+ *
+ * The HUD takes over the terminal's alternate screen while it is up
+ * and gives the screen back when it comes down, so whatever was on
+ * the terminal before is left alone.  We keep two copies of the
+ * screen: what the terminal is showing and what this frame wants.
+ * flush() compares them and sends only the cells that differ, each
+ * run behind one cursor movement, all in one write(), so a frame in
+ * which a few digits change costs a few dozen bytes.  Bars are drawn
+ * with Unicode eighth blocks when the locale is UTF-8, and with ASCII
+ * otherwise.  We count bytes written as requests.
+ *
+ * The terminal is our standard output, so the server has to stay in
+ * the foreground (-F).  Its size is read each time the HUD comes up.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include "movavg.h"
+#include "iftable.h"
+#include "hud.h"
+#include "osdhud.h"
+
+#define TTY_MAX_COLS	512
+#define TTY_OUT_MAX	16384		/* write() when this fills up */
+#define META NLINES
+
+#define ESC "\033"
+#define ENTER_HUD ESC "[?1049h" ESC "[?25l" ESC "[0m" ESC "[2J"
+#define LEAVE_HUD ESC "[0m" ESC "[?25h" ESC "[?1049l"
+
+/* One character on the screen: the bytes of its UTF-8 encoding */
+struct tty_cell {
+	char		 ch[4];
+	signed char	 len;		/* 0 if not known */
+	signed char	 color;
+};
+
+struct tty_hud {
+	int		 fd;
+	int		 utf8;
+	int		 shown;
+	int		 rows;
+	int		 cols;
+	int		 color[META + 1];	/* of each line, and meta */
+	int		 sgr;		/* colour the terminal is set to */
+	int		 cur_row;	/* where the cursor is, -1 if unsure */
+	int		 cur_col;
+	struct tty_cell	 front[META + 1][TTY_MAX_COLS];	/* on screen */
+	struct tty_cell	 back[META + 1][TTY_MAX_COLS];	/* this frame */
+	int		 outlen;
+	char		 out[TTY_OUT_MAX];
+};
+
+#define HUD(ss) ((struct tty_hud *)(ss)->hud_priv)
+
+/* SGR sequences for the HUD_xxx colours, bold so they stand out */
+static const char *sgr_colors[HUD_NCOLORS] = {
+	ESC "[0;1;32m",			/* green */
+	ESC "[0;1;33m",			/* yellow */
+	ESC "[0;1;38;5;208m",		/* orange */
+	ESC "[0;1;31m",			/* red */
+	ESC "[0;1;35m",			/* violet */
+};
+
+static const struct tty_cell blank = { " ", 1, HUD_NOCOLOR };
+
+/*
+ * Forget what we think is on the screen, so that the next frame is
+ * drawn in full
+ */
+static void
+tty_forget(struct tty_hud *hud)
+{
+	int i, j;
+
+	for (i = 0; i <= META; i++)
+		for (j = 0; j < TTY_MAX_COLS; j++)
+			hud->front[i][j].len = 0;
+	hud->sgr = HUD_NOCOLOR;
+	hud->cur_row = -1;
+}
+
+static void
+tty_write(struct osdhud_state *state)
+{
+	struct tty_hud *hud = HUD(state);
+	int off = 0;
+
+	while (off < hud->outlen) {
+		ssize_t nw = write(hud->fd,&hud->out[off],hud->outlen - off);
+
+		if (nw < 0) {
+			if (errno == EINTR)
+				continue;
+			syslog(LOG_WARNING,"tty: write: %s",
+			       strerror(errno));
+			/* some of what front[] says is there never got there */
+			tty_forget(hud);
+			break;
+		}
+		off += nw;
+	}
+	state->hud_stats.requests += off;
+	hud->outlen = 0;
+}
+
+static void
+out_bytes(struct osdhud_state *state, const char *s, int len)
+{
+	struct tty_hud *hud = HUD(state);
+
+	if (hud->outlen + len > TTY_OUT_MAX)
+		tty_write(state);
+	memcpy(&hud->out[hud->outlen],s,len);
+	hud->outlen += len;
+}
+
+#define out_str(ss,s) out_bytes(ss,s,strlen(s))
+
+static void
+out_uint(struct osdhud_state *state, unsigned int v)
+{
+	char digits[12];
+	int n = sizeof(digits);
+
+	do {
+		digits[--n] = '0' + (v % 10);
+		v /= 10;
+	} while (v);
+	out_bytes(state,&digits[n],sizeof(digits) - n);
+}
+
+/*
+ * Which row of the terminal (from 0) a line of the HUD goes on: meta
+ * goes on the bottom row, and lines that would reach it are dropped
+ */
+static int
+screen_row(struct tty_hud *hud, int line)
+{
+	if (line == META)
+		return hud->rows - 1;
+	return (line < hud->rows - 1) ? line : -1;
+}
+
+static void
+tty_close(struct osdhud_state *state)
+{
+	struct tty_hud *hud = HUD(state);
+
+	if (!hud)
+		return;
+	if (hud->shown) {
+		out_str(state,LEAVE_HUD);
+		tty_write(state);
+	}
+	free(hud);
+	state->hud_priv = NULL;
+}
+
+/*
+ * Does the locale say the terminal takes UTF-8?
+ */
+static int
+locale_is_utf8(void)
+{
+	static const char *vars[] = { "LC_ALL", "LC_CTYPE", "LANG", NULL };
+	int i;
+
+	for (i = 0; vars[i]; i++) {
+		char *val = getenv(vars[i]);
+
+		if (val && *val)
+			return strcasestr(val,"utf-8") ||
+				strcasestr(val,"utf8");
+	}
+	return 0;
+}
+
+static int
+tty_open(struct osdhud_state *state, char *font)
+{
+	struct tty_hud *hud;
+
+	if (!isatty(STDOUT_FILENO)) {
+		syslog(LOG_ERR,"tty: standard output is not a terminal;"
+		       " run the server with -F");
+		return -1;
+	}
+	hud = calloc(1,sizeof(*hud));
+	assert(hud);
+	state->hud_priv = hud;
+	hud->fd = STDOUT_FILENO;
+	hud->utf8 = locale_is_utf8();
+	return 0;
+}
+
+static int
+tty_show(struct osdhud_state *state)
+{
+	struct tty_hud *hud = HUD(state);
+	struct winsize ws;
+	int i, j;
+
+	hud->rows = 24;
+	hud->cols = 80;
+	if (!ioctl(hud->fd,TIOCGWINSZ,&ws) && ws.ws_row && ws.ws_col) {
+		hud->rows = ws.ws_row;
+		hud->cols = (ws.ws_col > TTY_MAX_COLS) ?
+			TTY_MAX_COLS : ws.ws_col;
+	}
+	/* We clear the screen, so it is all blanks to begin with */
+	for (i = 0; i <= META; i++) {
+		hud->color[i] = HUD_GREEN;
+		for (j = 0; j < TTY_MAX_COLS; j++)
+			hud->front[i][j] = hud->back[i][j] = blank;
+	}
+	hud->sgr = HUD_NOCOLOR;
+	hud->cur_row = hud->cur_col = -1;
+	hud->shown = 1;
+	out_str(state,ENTER_HUD);
+	tty_write(state);
+	return 0;
+}
+
+static void
+tty_hide(struct osdhud_state *state)
+{
+	struct tty_hud *hud = HUD(state);
+
+	hud->shown = 0;
+	out_str(state,LEAVE_HUD);
+	tty_write(state);
+}
+
+/*
+ * Lay text out in back[line] from col, and return how many cells it
+ * took.  Control characters become '?' so they cannot upset the
+ * terminal; UTF-8 sequences are kept whole.
+ */
+static int
+put_text(struct tty_hud *hud, int line, int col, const char *text)
+{
+	const unsigned char *s = (const unsigned char *)text;
+	int start = col;
+
+	while (*s && (col < hud->cols)) {
+		struct tty_cell *cell = &hud->back[line][col++];
+		int n = (*s < 0x80) ? 1 : (*s >= 0xf0) ? 4 :
+			(*s >= 0xe0) ? 3 : (*s >= 0xc0) ? 2 : 1;
+		int i;
+
+		cell->color = hud->color[line];
+		if ((*s < ' ') || (*s == 0x7f) || ((n == 1) && (*s >= 0x80))) {
+			cell->ch[0] = '?';
+			cell->len = 1;
+			s++;
+			continue;
+		}
+		for (i = 0; (i < n) && s[i]; i++)
+			cell->ch[i] = s[i];
+		cell->len = i;
+		s += i;
+	}
+	return col - start;
+}
+
+static void
+clear_line(struct tty_hud *hud, int line)
+{
+	int j;
+
+	for (j = 0; j < hud->cols; j++)
+		hud->back[line][j] = blank;
+}
+
+static void
+tty_text(struct osdhud_state *state, int line, int color, const char *text)
+{
+	struct tty_hud *hud = HUD(state);
+
+	if (color != HUD_NOCOLOR)
+		hud->color[line] = color;
+	clear_line(hud,line);
+	(void) put_text(hud,line,0,text);
+}
+
+/*
+ * A bar state->width cells long, in eighths of a cell if we can
+ */
+static void
+tty_bar(struct osdhud_state *state, int line, int color, int percent)
+{
+	struct tty_hud *hud = HUD(state);
+	int width = (state->width < hud->cols) ? state->width : hud->cols;
+	int eighths, j;
+
+	if (color != HUD_NOCOLOR)
+		hud->color[line] = color;
+	clear_line(hud,line);
+	if (percent > 100)
+		percent = 100;
+	eighths = (percent * width * 8 + 50) / 100;
+	for (j = 0; j < width; j++, eighths -= 8) {
+		struct tty_cell *cell = &hud->back[line][j];
+		int k = (eighths > 8) ? 8 : (eighths < 0) ? 0 : eighths;
+
+		cell->color = hud->color[line];
+		if (!hud->utf8) {
+			cell->ch[0] = (k >= 4) ? '#' : '-';
+			cell->len = 1;
+			continue;
+		}
+		/* U+2588 full block down to U+258F one eighth */
+		cell->ch[0] = 0xe2;
+		cell->ch[1] = 0x96;
+		cell->ch[2] = k ? 0x90 - k : 0x91;	/* U+2591 light shade */
+		cell->len = 3;
+	}
+}
+
+static void
+tty_meta(struct osdhud_state *state, const char *text)
+{
+	struct tty_hud *hud = HUD(state);
+	int n, j;
+
+	/* Right-justify it: lay it out, then slide it over */
+	clear_line(hud,META);
+	n = put_text(hud,META,0,text);
+	for (j = n - 1; j >= 0; j--) {
+		hud->back[META][hud->cols - n + j] = hud->back[META][j];
+		if (j < hud->cols - n)
+			hud->back[META][j] = blank;
+	}
+}
+
+#define is_blank(c) (((c)->len == 1) && ((c)->ch[0] == ' '))
+
+/* Blanks look the same whatever colour they are */
+#define same_cell(a,b)							\
+	(((a)->len == (b)->len) && !memcmp((a)->ch,(b)->ch,(a)->len) && \
+	 (((a)->color == (b)->color) || is_blank(a)))
+
+/*
+ * Get the cursor from where it is to col on row without moving it
+ * explicitly, by sending the few unchanged cells in between again.
+ * Returns 0 if that would cost more than moving the cursor would.
+ */
+static int
+skip_gap(struct osdhud_state *state, int line, int row, int col)
+{
+	struct tty_hud *hud = HUD(state);
+	int j;
+
+	if ((hud->cur_row != row) || (hud->cur_col < 0) ||
+	    (hud->cur_col > col) || (col - hud->cur_col > 4))
+		return 0;
+	for (j = hud->cur_col; j < col; j++) {
+		struct tty_cell *cell = &hud->front[line][j];
+
+		if (!is_blank(cell) && (cell->color != hud->sgr))
+			return 0;
+	}
+	for (j = hud->cur_col; j < col; j++)
+		out_bytes(state,hud->front[line][j].ch,
+			  hud->front[line][j].len);
+	return 1;
+}
+
+static void
+tty_flush(struct osdhud_state *state)
+{
+	struct tty_hud *hud = HUD(state);
+	int line, col;
+
+	for (line = 0; line <= META; line++) {
+		int row = screen_row(hud,line);
+
+		if (row < 0)
+			continue;
+		for (col = 0; col < hud->cols; col++) {
+			struct tty_cell *want = &hud->back[line][col];
+			struct tty_cell *have = &hud->front[line][col];
+
+			if (same_cell(want,have))
+				continue;
+			if (!skip_gap(state,line,row,col)) {
+				out_str(state,ESC "[");
+				out_uint(state,row + 1);
+				out_str(state,";");
+				out_uint(state,col + 1);
+				out_str(state,"H");
+			}
+			if ((want->color != hud->sgr) &&
+			    (want->color != HUD_NOCOLOR) &&
+			    !is_blank(want)) {
+				out_str(state,sgr_colors[want->color]);
+				hud->sgr = want->color;
+			}
+			out_bytes(state,want->ch,want->len);
+			*have = *want;
+			hud->cur_row = row;
+			/* the cursor does not move on past the last column */
+			hud->cur_col = (col + 1 < hud->cols) ? col + 1 : -1;
+		}
+	}
+	if (hud->outlen)
+		tty_write(state);
+}
+
+struct hud_backend hud_tty = {
+	.name = "tty",
+	.open = tty_open,
+	.close = tty_close,
+	.show = tty_show,
+	.hide = tty_hide,
+	.text = tty_text,
+	.bar = tty_bar,
+	.meta = tty_meta,
+	.flush = tty_flush,
+};
+
+/*
+ * Local variables:
+ * mode: c
+ * c-file-style: "bsd"
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ */
@@ -0,0 +1,423 @@
+/*
+ * Copyright (C) 2015 by attila <attila@stalphonsos.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Draw the whole HUD into a single override-redirect window.
+ *
+ * The window covers the screen, but it is shaped so that only the
+ * pixels we draw are part of it: each frame we paint the lines into a
+ * one-bit mask, make that the window's shape, and then paint them
+ * again onto the window itself.  Everything goes out over one X
+ * connection in one batch per frame, with no round trips and no event
+ * thread; Expose events are picked up between frames.  The look, a
+ * black outline and shadow behind coloured text and bars, follows
+ * xosd's.
+ *
+ * Only the bands of the screen holding lines that changed are
+ * repainted, clipped to those bands.  A line's shadow can reach into
+ * the next one's band, so the neighbours of a changed line are
+ * redrawn too, within the clip.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/shape.h>
+#include "movavg.h"
+#include "iftable.h"
+#include "hud.h"
+#include "osdhud.h"
+
+#define FALLBACK_FONT "fixed"
+
+struct xlib_line {
+	char		 text[HUD_LINE_MAX];
+	int		 color;
+	int		 percent;	/* -1 for text */
+};
+
+struct xlib_hud {
+	Display		*dpy;
+	Window		 win;
+	Pixmap		 mask;		/* depth 1: the window's shape */
+	GC		 gc;
+	GC		 mask_gc;
+	XFontStruct	*font;
+	unsigned long	 black;
+	unsigned long	 pixels[HUD_NCOLORS];
+	int		 scr_w;
+	int		 scr_h;
+	u_int32_t	 dirty;		/* bit per line to repaint, and META */
+	unsigned long	 serial;	/* XNextRequest() at the last flush */
+	struct xlib_line lines[NLINES];
+	char		 meta[HUD_LINE_MAX];
+};
+
+#define HUD(ss) ((struct xlib_hud *)(ss)->hud_priv)
+#define META NLINES
+#define ALL_DIRTY ((1U << (META + 1)) - 1)
+
+static void
+xlib_close(struct osdhud_state *state)
+{
+	struct xlib_hud *hud = HUD(state);
+
+	if (!hud)
+		return;
+	if (hud->dpy) {
+		if (hud->mask_gc)
+			XFreeGC(hud->dpy,hud->mask_gc);
+		if (hud->gc)
+			XFreeGC(hud->dpy,hud->gc);
+		if (hud->mask)
+			XFreePixmap(hud->dpy,hud->mask);
+		if (hud->win)
+			XDestroyWindow(hud->dpy,hud->win);
+		if (hud->font)
+			XFreeFont(hud->dpy,hud->font);
+		XCloseDisplay(hud->dpy);
+	}
+	free(hud);
+	state->hud_priv = NULL;
+}
+
+static int
+xlib_open(struct osdhud_state *state, char *font)
+{
+	struct xlib_hud *hud = calloc(1,sizeof(*hud));
+	XSetWindowAttributes attrs;
+	XColor color, exact;
+	Colormap cmap;
+	Window root;
+	int scr, i, ev_base, err_base;
+
+	assert(hud);
+	state->hud_priv = hud;
+	hud->dpy = XOpenDisplay(NULL);
+	if (!hud->dpy) {
+		syslog(LOG_ERR,"cannot open display \"%s\"",XDisplayName(NULL));
+		goto FAIL;
+	}
+	if (!XShapeQueryExtension(hud->dpy,&ev_base,&err_base)) {
+		syslog(LOG_ERR,"X server has no SHAPE extension");
+		goto FAIL;
+	}
+	hud->font = XLoadQueryFont(hud->dpy,font);
+	if (!hud->font) {
+		syslog(LOG_WARNING,"no font %s, using %s",font,FALLBACK_FONT);
+		hud->font = XLoadQueryFont(hud->dpy,FALLBACK_FONT);
+		if (!hud->font) {
+			syslog(LOG_ERR,"no font %s either",FALLBACK_FONT);
+			goto FAIL;
+		}
+	}
+	scr = DefaultScreen(hud->dpy);
+	root = RootWindow(hud->dpy,scr);
+	cmap = DefaultColormap(hud->dpy,scr);
+	hud->scr_w = DisplayWidth(hud->dpy,scr);
+	hud->scr_h = DisplayHeight(hud->dpy,scr);
+	hud->black = BlackPixel(hud->dpy,scr);
+	for (i = 0; i < HUD_NCOLORS; i++) {
+		if (XAllocNamedColor(hud->dpy,cmap,hud_color_names[i],
+				     &color,&exact))
+			hud->pixels[i] = color.pixel;
+		else {
+			syslog(LOG_WARNING,"could not allocate color %s",
+			       hud_color_names[i]);
+			hud->pixels[i] = WhitePixel(hud->dpy,scr);
+		}
+	}
+	memset(&attrs,0,sizeof(attrs));
+	attrs.override_redirect = True;
+	attrs.background_pixmap = None;
+	attrs.event_mask = ExposureMask;
+	hud->win = XCreateWindow(hud->dpy,root,0,0,hud->scr_w,hud->scr_h,0,
+				 CopyFromParent,InputOutput,CopyFromParent,
+				 CWOverrideRedirect|CWBackPixmap|CWEventMask,
+				 &attrs);
+	/* nothing shows until the first frame */
+	XShapeCombineRectangles(hud->dpy,hud->win,ShapeBounding,0,0,NULL,0,
+				ShapeSet,Unsorted);
+	hud->mask = XCreatePixmap(hud->dpy,hud->win,hud->scr_w,hud->scr_h,1);
+	hud->gc = XCreateGC(hud->dpy,hud->win,0,NULL);
+	hud->mask_gc = XCreateGC(hud->dpy,hud->mask,0,NULL);
+	XSetFont(hud->dpy,hud->gc,hud->font->fid);
+	XSetFont(hud->dpy,hud->mask_gc,hud->font->fid);
+	/* a new pixmap holds garbage; flush() only clears changed bands */
+	XSetForeground(hud->dpy,hud->mask_gc,0);
+	XFillRectangle(hud->dpy,hud->mask,hud->mask_gc,0,0,
+		       hud->scr_w,hud->scr_h);
+	for (i = 0; i < NLINES; i++) {
+		hud->lines[i].color = HUD_GREEN;
+		hud->lines[i].percent = -1;
+	}
+	XFlush(hud->dpy);
+	hud->serial = NextRequest(hud->dpy);
+	return 0;
+FAIL:
+	xlib_close(state);
+	return -1;
+}
+
+static int
+xlib_show(struct osdhud_state *state)
+{
+	struct xlib_hud *hud = HUD(state);
+
+	XMapRaised(hud->dpy,hud->win);
+	XFlush(hud->dpy);
+	hud->dirty = ALL_DIRTY;
+	return 0;
+}
+
+static void
+xlib_hide(struct osdhud_state *state)
+{
+	struct xlib_hud *hud = HUD(state);
+
+	XUnmapWindow(hud->dpy,hud->win);
+	XFlush(hud->dpy);
+}
+
+static void
+xlib_text(struct osdhud_state *state, int line, int color, const char *text)
+{
+	struct xlib_hud *hud = HUD(state);
+	struct xlib_line *ln = &hud->lines[line];
+
+	if (color != HUD_NOCOLOR)
+		ln->color = color;
+	ln->percent = -1;
+	strlcpy(ln->text,text,sizeof(ln->text));
+	hud->dirty |= 1U << line;
+}
+
+static void
+xlib_bar(struct osdhud_state *state, int line, int color, int percent)
+{
+	struct xlib_hud *hud = HUD(state);
+	struct xlib_line *ln = &hud->lines[line];
+
+	if (color != HUD_NOCOLOR)
+		ln->color = color;
+	ln->percent = (percent < 0) ? 0 : (percent > 100) ? 100 : percent;
+	hud->dirty |= 1U << line;
+}
+
+static void
+xlib_meta(struct osdhud_state *state, const char *text)
+{
+	struct xlib_hud *hud = HUD(state);
+
+	strlcpy(hud->meta,text,sizeof(hud->meta));
+	hud->dirty |= 1U << META;
+}
+
+/*
+ * Draw a string with its shadow and outline; on the mask everything
+ * is drawn in 1s, so we never change its foreground
+ */
+static void
+draw_text(struct xlib_hud *hud, Drawable d, GC gc, int is_mask,
+	  int x, int y, unsigned long pixel, const char *s)
+{
+	int len = strlen(s);
+	int dx, dy;
+
+	if (!is_mask)
+		XSetForeground(hud->dpy,gc,hud->black);
+	XDrawString(hud->dpy,d,gc,x + HUD_SHADOW,y + HUD_SHADOW,s,len);
+	for (dx = -HUD_OUTLINE; dx <= HUD_OUTLINE; dx++)
+		for (dy = -HUD_OUTLINE; dy <= HUD_OUTLINE; dy++)
+			if (dx || dy)
+				XDrawString(hud->dpy,d,gc,x + dx,y + dy,s,len);
+	if (!is_mask)
+		XSetForeground(hud->dpy,gc,pixel);
+	XDrawString(hud->dpy,d,gc,x,y,s,len);
+}
+
+/*
+ * Draw a bar of state->width segments, the first percent of them
+ * full height and the rest short.  Each pass is a run of rectangles
+ * in one colour, which Xlib sends as a single request.
+ */
+static void
+draw_bar(struct xlib_hud *hud, struct osdhud_state *state, Drawable d,
+	 GC gc, int is_mask, int x, int y, unsigned long pixel, int percent)
+{
+	int h = hud->font->ascent;
+	int w = (h / 4 > 2) ? h / 4 : 2;
+	int pitch = w + ((w / 2 > 1) ? w / 2 : 1);
+	int on = (percent * state->width + 50) / 100;
+	int pass, i;
+
+	for (pass = 0; pass < 3; pass++) {
+		if (!is_mask)
+			XSetForeground(hud->dpy,gc,
+				       (pass < 2) ? hud->black : pixel);
+		for (i = 0; i < state->width; i++) {
+			int sx = x + i * pitch;
+			int sh = (i < on) ? h : h / 3;
+			int sy = y - (h + sh) / 2;
+
+			switch (pass) {
+			case 0:		/* shadow */
+				XFillRectangle(hud->dpy,d,gc,sx + HUD_SHADOW,
+					       sy + HUD_SHADOW,w,sh);
+				break;
+			case 1:		/* outline */
+				XFillRectangle(hud->dpy,d,gc,sx - HUD_OUTLINE,
+					       sy - HUD_OUTLINE,
+					       w + 2 * HUD_OUTLINE,
+					       sh + 2 * HUD_OUTLINE);
+				break;
+			default:
+				XFillRectangle(hud->dpy,d,gc,sx,sy,w,sh);
+				break;
+			}
+		}
+	}
+}
+
+/*
+ * Where line i (or META) has its baseline, and the band of the screen
+ * that its text, outline and shadow can touch
+ */
+static int
+baseline(struct xlib_hud *hud, struct osdhud_state *state, int i)
+{
+	if (i == META)
+		return hud->scr_h - hud->font->descent - HUD_SHADOW -
+			HUD_OUTLINE;
+	return state->pos_y + (state->line_height * i) + hud->font->ascent;
+}
+
+static void
+band(struct xlib_hud *hud, struct osdhud_state *state, int i,
+     XRectangle *r)
+{
+	r->x = 0;
+	r->y = baseline(hud,state,i) - hud->font->ascent - HUD_OUTLINE;
+	r->width = hud->scr_w;
+	r->height = hud->font->ascent + hud->font->descent + HUD_SHADOW +
+		2 * HUD_OUTLINE;
+}
+
+/*
+ * Paint the lines whose bands meet any of the n rectangles in clip
+ * onto d, which is either the mask or the window
+ */
+static void
+paint(struct xlib_hud *hud, struct osdhud_state *state, Drawable d, GC gc,
+      int is_mask, XRectangle *clip, int n)
+{
+	XRectangle r;
+	int i, j;
+
+	for (i = 0; i <= META; i++) {
+		band(hud,state,i,&r);
+		for (j = 0; j < n; j++)
+			if ((r.y < clip[j].y + clip[j].height) &&
+			    (clip[j].y < r.y + r.height))
+				break;
+		if (j == n)
+			continue;
+		if (i == META) {
+			int w = XTextWidth(hud->font,hud->meta,
+					   strlen(hud->meta));
+
+			if (hud->meta[0])
+				draw_text(hud,d,gc,is_mask,hud->scr_w - w -
+					  HUD_SHADOW - HUD_OUTLINE,
+					  baseline(hud,state,i),
+					  hud->pixels[HUD_GREEN],hud->meta);
+		} else if (hud->lines[i].percent >= 0)
+			draw_bar(hud,state,d,gc,is_mask,state->pos_x,
+				 baseline(hud,state,i),
+				 hud->pixels[hud->lines[i].color],
+				 hud->lines[i].percent);
+		else if (hud->lines[i].text[0])
+			draw_text(hud,d,gc,is_mask,state->pos_x,
+				  baseline(hud,state,i),
+				  hud->pixels[hud->lines[i].color],
+				  hud->lines[i].text);
+	}
+}
+
+static void
+xlib_flush(struct osdhud_state *state)
+{
+	struct xlib_hud *hud = HUD(state);
+	XRectangle clip[META + 1];
+	XEvent ev;
+	int i, n = 0;
+
+	while (XPending(hud->dpy)) {
+		XNextEvent(hud->dpy,&ev);
+		if (ev.type == Expose)
+			hud->dirty = ALL_DIRTY;
+	}
+	if (!hud->dirty)
+		return;
+	for (i = 0; i <= META; i++)
+		if (hud->dirty & (1U << i))
+			band(hud,state,i,&clip[n++]);
+	XSetClipRectangles(hud->dpy,hud->gc,0,0,clip,n,Unsorted);
+	XSetClipRectangles(hud->dpy,hud->mask_gc,0,0,clip,n,Unsorted);
+	/* the shape first, so that all of the frame lands in the window */
+	XSetForeground(hud->dpy,hud->mask_gc,0);
+	XFillRectangles(hud->dpy,hud->mask,hud->mask_gc,clip,n);
+	XSetForeground(hud->dpy,hud->mask_gc,1);
+	paint(hud,state,hud->mask,hud->mask_gc,1,clip,n);
+	XShapeCombineMask(hud->dpy,hud->win,ShapeBounding,0,0,hud->mask,
+			  ShapeSet);
+	paint(hud,state,hud->win,hud->gc,0,clip,n);
+	XFlush(hud->dpy);
+	state->hud_stats.requests += NextRequest(hud->dpy) - hud->serial;
+	hud->serial = NextRequest(hud->dpy);
+	hud->dirty = 0;
+}
+
+struct hud_backend hud_xlib = {
+	.name = "xlib",
+	.open = xlib_open,
+	.close = xlib_close,
+	.show = xlib_show,
+	.hide = xlib_hide,
+	.text = xlib_text,
+	.bar = xlib_bar,
+	.meta = xlib_meta,
+	.flush = xlib_flush,
+};
+
+/*
+ * Local variables:
+ * mode: c
+ * c-file-style: "bsd"
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ */
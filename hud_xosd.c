@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2015 by attila <attila@stalphonsos.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The original display backend: an xosd per line, plus one in the
+ * bottom right corner for the time and countdown.  Each xosd has its
+ * own X connection, window and event thread.  xosd looks a colour up
+ * by name every time it is set, so we only set one when a line's
+ * colour changes.  We count calls into xosd as requests: each costs
+ * at least one X request and usually several.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <xosd.h>
+#include "movavg.h"
+#include "iftable.h"
+#include "hud.h"
+#include "osdhud.h"
+
+struct xosd_hud {
+	xosd		*osds[NLINES];
+	xosd		*bot;
+};
+
+#define HUD(ss) ((struct xosd_hud *)(ss)->hud_priv)
+
+static xosd *
+create_big_osd(struct osdhud_state *state, char *font, int line)
+{
+	xosd *osd;
+
+	osd = xosd_create(1);
+	if (!osd) {
+		SPEWE("could not create osd display");
+		return NULL;
+	}
+	xosd_set_font(osd,font);
+	xosd_set_outline_offset(osd,HUD_OUTLINE);
+	xosd_set_shadow_offset(osd,HUD_SHADOW);
+	xosd_set_outline_colour(osd,"black");
+	xosd_set_align(osd,XOSD_left);
+	xosd_set_pos(osd,XOSD_top);
+	xosd_set_horizontal_offset(osd,state->pos_x);
+	xosd_set_vertical_offset(osd,state->pos_y +
+				 (state->line_height * line));
+	xosd_set_bar_length(osd,state->width);
+
+	return osd;
+}
+
+static xosd *
+create_small_osd(struct osdhud_state *state, char *font)
+{
+	xosd *osd = xosd_create(1);
+
+	if (!osd) {
+		SPEWE("could not create second osd display");
+		return NULL;
+	}
+	xosd_set_font(osd,font);
+	xosd_set_outline_offset(osd,HUD_OUTLINE);
+	xosd_set_shadow_offset(osd,HUD_SHADOW);
+	xosd_set_outline_colour(osd,"black");
+	xosd_set_align(osd,XOSD_right);
+	xosd_set_pos(osd,XOSD_bottom);
+
+	return osd;
+}
+
+static void
+osds_close(struct osdhud_state *state)
+{
+	struct xosd_hud *hud = HUD(state);
+	int i;
+
+	if (!hud)
+		return;
+	for (i = 0; i < NLINES; i++)
+		if (hud->osds[i])
+			xosd_destroy(hud->osds[i]);
+	if (hud->bot)
+		xosd_destroy(hud->bot);
+	free(hud);
+	state->hud_priv = NULL;
+}
+
+static int
+osds_open(struct osdhud_state *state, char *font)
+{
+	struct xosd_hud *hud = calloc(1,sizeof(*hud));
+	int i;
+
+	assert(hud);
+	state->hud_priv = hud;
+	for (i = 0; i < NLINES; i++) {
+		hud->osds[i] = create_big_osd(state,font,i);
+		if (!hud->osds[i])
+			goto FAIL;
+		xosd_hide(hud->osds[i]);
+	}
+	hud->bot = create_small_osd(state,font);
+	if (!hud->bot)
+		goto FAIL;
+	xosd_hide(hud->bot);
+	return 0;
+FAIL:
+	osds_close(state);
+	return -1;
+}
+
+static int
+osds_show(struct osdhud_state *state)
+{
+	struct xosd_hud *hud = HUD(state);
+	int i;
+
+	state->hud_stats.requests += NLINES + 1;
+	for (i = 0; i < NLINES; i++)
+		if (xosd_show(hud->osds[i])) {
+			syslog(LOG_ERR,"xosd_show failed #%d: %s",i,xosd_error);
+			return -1;
+		}
+	if (xosd_show(hud->bot)) {
+		syslog(LOG_ERR,"xosd_show failed (#2): %s",xosd_error);
+		return -1;
+	}
+	return 0;
+}
+
+static void
+osds_hide(struct osdhud_state *state)
+{
+	struct xosd_hud *hud = HUD(state);
+	int i;
+
+	state->hud_stats.requests += NLINES + 1;
+	for (i = 0; i < NLINES; i++)
+		xosd_hide(hud->osds[i]);
+	xosd_hide(hud->bot);
+}
+
+static void
+set_colour(struct osdhud_state *state, int line, int color)
+{
+	if (color == HUD_NOCOLOR)
+		return;
+	state->hud_stats.requests++;
+	if (xosd_set_colour(HUD(state)->osds[line],hud_color_names[color]))
+		syslog(LOG_WARNING,"could not set osd[%d] color to %s",
+		       line,hud_color_names[color]);
+}
+
+static void
+osds_text(struct osdhud_state *state, int line, int color, const char *text)
+{
+	set_colour(state,line,color);
+	state->hud_stats.requests++;
+	xosd_display(HUD(state)->osds[line],0,XOSD_string,text);
+}
+
+static void
+osds_bar(struct osdhud_state *state, int line, int color, int percent)
+{
+	set_colour(state,line,color);
+	state->hud_stats.requests++;
+	xosd_display(HUD(state)->osds[line],0,XOSD_percentage,percent);
+}
+
+static void
+osds_meta(struct osdhud_state *state, const char *text)
+{
+	state->hud_stats.requests++;
+	xosd_display(HUD(state)->bot,0,XOSD_string,text);
+}
+
+static void
+osds_flush(struct osdhud_state *state)
+{
+	/* every xosd_display() went out on its own */
+}
+
+struct hud_backend hud_xosd = {
+	.name = "xosd",
+	.open = osds_open,
+	.close = osds_close,
+	.show = osds_show,
+	.hide = osds_hide,
+	.text = osds_text,
+	.bar = osds_bar,
+	.meta = osds_meta,
+	.flush = osds_flush,
+};
+
+/*
+ * Local variables:
+ * mode: c
+ * c-file-style: "bsd"
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ */
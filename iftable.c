@@ -0,0 +1,349 @@
+/*
+ * Copyright (C) 2015 by attila <attila@stalphonsos.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Keep rates for every network interface at once.
+ *
+ * Each per-interface field lives in its own array indexed by
+ * interface index so that a pass over all interfaces (summing the
+ * watched ones, finding the busiest) only touches the columns it
+ * needs.  Because every interface the probes report is tracked,
+ * switching -i can pick up averages that are already warm.
+ *
+ * The probes hand us fresh counters for an interface whenever they
+ * have them, which under Linux is not every tick for all of them, so
+ * each slot's rates are taken over its own last few samples, weighted
+ * by the time each one covers.  The arithmetic is all in integers:
+ * a 25GbE link moves more than 2^24 bytes in one tick, which a float
+ * cannot count exactly.
+ */
+
+#include <sys/types.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "movavg.h"
+#include "iftable.h"
+
+#define IFT_MIN_SLOTS 16
+
+static unsigned int
+name_hash(const char *name)
+{
+	unsigned int h = 2166136261u;	/* FNV-1a */
+
+	while (*name) {
+		h ^= (unsigned char)*name++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static void
+hash_insert(struct iftable *tbl, int slot)
+{
+	unsigned int b = name_hash(tbl->name[slot]) & (tbl->nbuckets - 1);
+
+	tbl->next[slot] = tbl->bucket[b];
+	tbl->bucket[b] = slot;
+}
+
+static void
+hash_remove(struct iftable *tbl, int slot)
+{
+	unsigned int b = name_hash(tbl->name[slot]) & (tbl->nbuckets - 1);
+	int *pp;
+
+	for (pp = &tbl->bucket[b]; *pp >= 0; pp = &tbl->next[*pp]) {
+		if (*pp == slot) {
+			*pp = tbl->next[slot];
+			break;
+		}
+	}
+	tbl->next[slot] = -1;
+}
+
+static void
+rehash(struct iftable *tbl, unsigned int nbuckets)
+{
+	unsigned int b;
+	int i;
+
+	free(tbl->bucket);
+	tbl->nbuckets = nbuckets;
+	tbl->bucket = malloc(nbuckets * sizeof(int));
+	assert(tbl->bucket);
+	for (b = 0; b < nbuckets; b++)
+		tbl->bucket[b] = -1;
+	for (i = 0; i < tbl->nslots; i++)
+		if (tbl->live[i])
+			hash_insert(tbl,i);
+}
+
+#define grow_array(aa,nn) do {						\
+		void *_p = realloc(aa,(nn) * sizeof(*(aa)));		\
+		assert(_p);						\
+		aa = _p;						\
+	} while (0)
+
+/*
+ * Make sure there is a slot for the given interface index
+ */
+static void
+grow(struct iftable *tbl, int index)
+{
+	int n = tbl->nslots ? tbl->nslots : IFT_MIN_SLOTS;
+	int i;
+
+	while (n <= index)
+		n *= 2;
+	grow_array(tbl->next,n);
+	grow_array(tbl->name,n);
+	grow_array(tbl->live,n);
+	grow_array(tbl->watched,n);
+	grow_array(tbl->last_msecs,n);
+	grow_array(tbl->cur,n);
+	for (i = tbl->nslots; i < n; i++) {
+		tbl->next[i] = -1;
+		tbl->name[i][0] = 0;
+		tbl->live[i] = tbl->watched[i] = 0;
+		tbl->last_msecs[i] = 0;
+		memset(&tbl->cur[i],0,sizeof(tbl->cur[i]));
+	}
+	if (tbl->ra)
+		rateavg_set_resize(tbl->ra,n * IFT_NRATES);
+	else
+		tbl->ra = rateavg_set_new(n * IFT_NRATES,tbl->wsize);
+	tbl->nslots = n;
+	if ((unsigned int)n * 2 > tbl->nbuckets)
+		rehash(tbl,(unsigned int)n * 2);
+}
+
+#undef grow_array
+
+/*
+ * Allocate an empty table; wsize is the moving average window size
+ * used for every rate.
+ */
+struct iftable *
+iftable_new(int wsize)
+{
+	struct iftable *tbl = calloc(1,sizeof(*tbl));
+
+	assert(tbl);
+	tbl->wsize = wsize;
+	tbl->wslot = -1;
+	grow(tbl,0);
+	return tbl;
+}
+
+/*
+ * Tear down a table
+ */
+void
+iftable_free(struct iftable *tbl)
+{
+	if (!tbl)
+		return;
+	rateavg_set_free(tbl->ra);
+	free(tbl->cur);
+	free(tbl->last_msecs);
+	free(tbl->watched);
+	free(tbl->live);
+	free(tbl->name);
+	free(tbl->next);
+	free(tbl->bucket);
+	free(tbl);
+}
+
+/*
+ * Feed a new set of counters for an interface sampled at now_msecs.
+ * The first sample for a slot only establishes a baseline, as does a
+ * sample in which any counter was reset.  If the name at an index
+ * changes the old interface is forgotten, since the index has been
+ * recycled.  Returns the slot.
+ */
+int
+iftable_update(struct iftable *tbl, int index, const char *name,
+	       struct ifcounters *c, int watched, unsigned long now_msecs)
+{
+	u_int64_t now[IFT_NRATES], then[IFT_NRATES], delta[IFT_NRATES];
+	unsigned long msecs;
+	int r, wrapped = 0, reset = 0;
+
+	assert(index >= 0);
+	if (index >= tbl->nslots)
+		grow(tbl,index);
+	if (tbl->live[index] && strncmp(tbl->name[index],name,IFT_NAMSIZ))
+		iftable_remove(tbl,index);
+	tbl->watched[index] = watched ? 1 : 0;
+	if (!tbl->live[index]) {
+		strlcpy(tbl->name[index],name,IFT_NAMSIZ);
+		hash_insert(tbl,index);
+		tbl->live[index] = 1;
+		tbl->cur[index] = *c;
+		tbl->last_msecs[index] = now_msecs;
+		return index;
+	}
+	if (now_msecs <= tbl->last_msecs[index])
+		return index;
+	msecs = now_msecs - tbl->last_msecs[index];
+#define counter(ss,rr,ff) do {						\
+		now[rr] = c->ff;					\
+		then[rr] = tbl->cur[ss].ff;				\
+	} while (0)
+	counter(index,IFT_IKBPS,ibytes);
+	counter(index,IFT_OKBPS,obytes);
+	counter(index,IFT_IPXPS,ipackets);
+	counter(index,IFT_OPXPS,opackets);
+	counter(index,IFT_IERRPS,ierrs);
+	counter(index,IFT_OERRPS,oerrs);
+#undef counter
+	for (r = 0; r < IFT_NRATES; r++) {
+		switch (rateavg_delta(now[r],then[r],&delta[r])) {
+		case RATEAVG_WRAP32:
+			wrapped++;
+			break;
+		case RATEAVG_RESET:
+			reset++;
+			break;
+		}
+	}
+	tbl->nwraps += wrapped;
+	if (reset)
+		tbl->nresets++;
+	else
+		for (r = 0; r < IFT_NRATES; r++)
+			rateavg_set_add(tbl->ra,index * IFT_NRATES + r,
+					delta[r],msecs);
+	tbl->cur[index] = *c;
+	tbl->last_msecs[index] = now_msecs;
+	return index;
+}
+
+/*
+ * Forget about the interface at the given index
+ */
+void
+iftable_remove(struct iftable *tbl, int index)
+{
+	int r;
+
+	if ((index < 0) || (index >= tbl->nslots) || !tbl->live[index])
+		return;
+	hash_remove(tbl,index);
+	if (index == tbl->wslot)
+		tbl->wslot = -1;
+	tbl->live[index] = tbl->watched[index] = 0;
+	tbl->name[index][0] = 0;
+	for (r = 0; r < IFT_NRATES; r++)
+		rateavg_set_clear(tbl->ra,index * IFT_NRATES + r);
+}
+
+/*
+ * Return the slot for the named interface or -1
+ */
+int
+iftable_lookup(struct iftable *tbl, const char *name)
+{
+	unsigned int b = name_hash(name) & (tbl->nbuckets - 1);
+	int i;
+
+	for (i = tbl->bucket[b]; i >= 0; i = tbl->next[i])
+		if (!strncmp(tbl->name[i],name,IFT_NAMSIZ))
+			return i;
+	return -1;
+}
+
+/*
+ * Return the slot for the named interface like iftable_lookup(), but
+ * remember the answer until that slot is removed or iftable_unwatch()
+ * is called, so asking on every tick costs nothing
+ */
+int
+iftable_watch(struct iftable *tbl, const char *name)
+{
+	if (tbl->wslot < 0)
+		tbl->wslot = iftable_lookup(tbl,name);
+	return tbl->wslot;
+}
+
+/*
+ * Forget which interfaces are watched, e.g. because -i changed
+ */
+void
+iftable_unwatch(struct iftable *tbl)
+{
+	memset(tbl->watched,0,tbl->nslots);
+	tbl->wslot = -1;
+}
+
+/*
+ * Return one of the IFT_xxx rates of a slot; bytes are in kbytes
+ */
+float
+iftable_rate(struct iftable *tbl, int slot, int r)
+{
+	float val = (float)rateavg_set_val(tbl->ra,slot * IFT_NRATES + r) /
+		RATEAVG_ONE;
+
+	if ((r == IFT_IKBPS) || (r == IFT_OKBPS))
+		val /= 1024.0;
+	return val;
+}
+
+/*
+ * Fill slots[] with up to n interfaces that are moving bytes, busiest
+ * first.  Returns how many were found.
+ */
+int
+iftable_top(struct iftable *tbl, int *slots, int n)
+{
+	int i, j, found = 0;
+
+#define kbps_of(ss) (iftable_rate(tbl,ss,IFT_IKBPS) +			\
+		     iftable_rate(tbl,ss,IFT_OKBPS))
+	for (i = 0; i < tbl->nslots; i++) {
+		float kbps = kbps_of(i);
+
+		if (!tbl->live[i] || (kbps <= 0))
+			continue;
+		for (j = found; j > 0; j--) {
+			if (kbps_of(slots[j-1]) >= kbps)
+				break;
+			if (j < n)
+				slots[j] = slots[j-1];
+		}
+		if (j < n) {
+			slots[j] = i;
+			if (found < n)
+				found++;
+		}
+	}
+#undef kbps_of
+	return found;
+}
+
+/*
+ * Local variables:
+ * mode: c
+ * c-file-style: "bsd"
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ */
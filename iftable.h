@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2015 by attila <attila@stalphonsos.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Raw interface counters as reported by the per-OS probes
+ */
+struct ifcounters {
+	u_int64_t	 ibytes;
+	u_int64_t	 obytes;
+	u_int64_t	 ipackets;
+	u_int64_t	 opackets;
+	u_int64_t	 ierrs;
+	u_int64_t	 oerrs;
+};
+
+#define IFT_IKBPS	0		/* the rate series we keep per slot */
+#define IFT_OKBPS	1
+#define IFT_IPXPS	2
+#define IFT_OPXPS	3
+#define IFT_IERRPS	4
+#define IFT_OERRPS	5
+#define IFT_NRATES	6
+
+#define IFT_NAMSIZ	16		/* same as IFNAMSIZ everywhere we run */
+
+/*
+ * Rates for every interface we have seen, kept as a structure of
+ * arrays indexed by interface index (slot == ifindex).  Names are
+ * found in O(1) through a chained hash.  All of the rates live in one
+ * integer rate average set, IFT_NRATES consecutive series per slot.
+ */
+struct iftable {
+	int		  nslots;	/* size of every per-slot array */
+	int		  wsize;	/* moving average window size */
+	unsigned int	  nbuckets;	/* power of two */
+	int		 *bucket;	/* name hash -> first slot or -1 */
+	int		 *next;		/* hash chain */
+	char		(*name)[IFT_NAMSIZ];
+	unsigned char	 *live;		/* slot is in use */
+	unsigned char	 *watched;	/* slot is part of what -i selects */
+	int		  wslot;	/* slot iftable_watch() found or -1 */
+	unsigned long	 *last_msecs;	/* when the counters were sampled */
+	struct ifcounters *cur;		/* last counters */
+	struct rateavg_set *ra;		/* rates, IFT_NRATES per slot */
+	u_int64_t	  nwraps;	/* 32-bit counter wraps seen */
+	u_int64_t	  nresets;	/* counter resets seen */
+};
+
+/*
+ * API
+ */
+struct iftable *iftable_new(int);
+void iftable_free(struct iftable *);
+int iftable_update(struct iftable *, int, const char *, struct ifcounters *,
+		   int, unsigned long);
+void iftable_remove(struct iftable *, int);
+int iftable_lookup(struct iftable *, const char *);
+int iftable_watch(struct iftable *, const char *);
+void iftable_unwatch(struct iftable *);
+float iftable_rate(struct iftable *, int, int);
+int iftable_top(struct iftable *, int *, int);
+
+/*
+ * Local variables:
+ * mode: c
+ * c-file-style: "bsd"
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ */
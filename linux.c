@@ -0,0 +1,1488 @@
+/*
+ * Copyright (C) 2014,2015 by attila <attila@stalphonsos.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Implement the probe_xxx() functions used by osdhud.c for Linux.
+ *
+ * Everything we want lives in /proc or /sys.  We are called every
+ * short_pause_msecs (80msec by default) so instead of doing an
+ * open/read/close dance on every file every time we open everything
+ * once in probe_init() and just pread(2) from offset zero on each
+ * tick; procfs and sysfs regenerate the contents when read from the
+ * beginning.
+ *
+ * Network statistics normally come from rtnetlink: once we know the
+ * ifindex of the interface we are watching we ask for just that
+ * interface's IFLA_STATS64 on each tick, which costs the same no
+ * matter how many veths the host has.  The table of interfaces
+ * (names, flags, link speeds) is kept up to date from RTMGRP_LINK
+ * notifications rather than rediscovered on every tick.  A full
+ * RTM_GETLINK dump is done at startup, if we ever miss events, and
+ * every NL_SWEEP_MSECS to refresh the rates of the interfaces we are
+ * not watching.  If we cannot open a netlink socket we fall back to
+ * scanning /proc/net/dev.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+#include <sys/queue.h>
+#include <syslog.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include "movavg.h"
+#include "iftable.h"
+#include "hud.h"
+#include "osdhud.h"
+
+#define PROC_LOADAVG	"/proc/loadavg"
+#define PROC_MEMINFO	"/proc/meminfo"
+#define PROC_UPTIME	"/proc/uptime"
+#define PROC_NET_DEV	"/proc/net/dev"
+#define SYS_NET		"/sys/class/net"
+#define SYS_POWER	"/sys/class/power_supply"
+#define SYS_THERMAL	"/sys/class/thermal"
+
+#define SMALL_BUFSIZ	256		/* enough for any one-liner in /sys */
+#define INITIAL_BUFSIZ	8192		/* initial size of our read buffer */
+#define MIN_IFSTATS	16		/* initial size of ifstats table */
+#define NETDEV_NFIELDS	16		/* #of counters per /proc/net/dev line */
+#define BENCH_NIFS	1000		/* #of fake interfaces for -B netdev */
+#define NL_BUFSIZ	65536		/* initial netlink receive buffer */
+#define NL_SWEEP_MSECS	5000		/* how often to dump every link */
+
+/* modeled on struct ifcount in openbsd.c, which came from systat */
+
+struct ifcount {
+	u_int64_t           ifc_ib;         /* input bytes */
+	u_int64_t           ifc_ip;         /* input packets */
+	u_int64_t           ifc_ie;         /* input errors */
+	u_int64_t           ifc_ob;         /* output bytes */
+	u_int64_t           ifc_op;         /* output packets */
+	u_int64_t           ifc_oe;         /* output errors */
+	u_int64_t           ifc_co;         /* collisions */
+};
+
+struct ifstat {
+	char                ifs_name[IFNAMSIZ]; /* interface name */
+	struct ifcount      ifs_cur;
+	int                 ifs_speed;	/* -1 until we ask sysfs */
+	unsigned int        ifs_flags;	/* IFF_xxx, netlink only */
+	unsigned int        ifs_gen;	/* last dump that saw us */
+};
+
+/* The bits of /proc/meminfo we care about, all in kbytes */
+
+struct meminfo {
+	u_int64_t	    mem_total;
+	u_int64_t	    mem_available;
+	u_int64_t	    swap_total;
+	u_int64_t	    swap_free;
+};
+
+/* For the temperature probe */
+
+SLIST_HEAD(, temp_sensor) temp_sensors;
+struct temp_sensor {
+	SLIST_ENTRY(temp_sensor) entries;
+	char name[128];
+	char path[PATH_MAX];
+	char desc[128];
+	double val;
+};
+int n_temp_sensors;
+
+struct linux_data {
+	int		    loadavg_fd;
+	int		    meminfo_fd;
+	int		    uptime_fd;
+	int		    netdev_fd;
+	int		    bat_capacity_fd;	/* battery, -1 if none */
+	int		    bat_status_fd;
+	int		    bat_energy_now_fd;
+	int		    bat_energy_full_fd;
+	int		    bat_power_now_fd;
+	int		    ac_online_fd;
+	int		    temp_fd;		/* current temp sensor */
+	struct temp_sensor *temp_sensor;
+	int		    ncpus;
+	int                 nifs;	/* number of interfaces seen */
+	int                 maxifs;	/* room in ifstats[] */
+	struct ifstat      *ifstats;	/* one per /proc/net/dev line */
+	int		    nl_fd;	/* rtnetlink socket, -1 => procfs */
+	int		    nl_mon_fd;	/* RTMGRP_LINK subscription */
+	u_int32_t	    nl_seq;
+	char		   *nl_buf;	/* receive buffer, reused */
+	size_t		    nl_bufsiz;
+	int		    nl_ifindex;	/* ifindex of net_iface or 0 */
+	int		    nl_resync;	/* missed events, dump again */
+	unsigned int	    nl_gen;	/* bumped on every full dump */
+	unsigned long	    nl_sweep_t;	/* when we last dumped everything */
+	int		    nlinks;	/* room in links[] */
+	struct ifstat	   *links;	/* indexed by ifindex */
+	struct meminfo	    meminfo;	/* last scan of /proc/meminfo */
+	int		    meminfo_fresh; /* set by probe_mem for probe_swap */
+	char		   *buf;	/* read buffer shared by all probes */
+	size_t		    bufsiz;
+};
+
+static void nl_open(struct osdhud_state *, struct linux_data *);
+
+/*
+ * Read the whole of an already-open /proc or /sys file into our
+ * buffer, growing it if it turns out to be too small.  Returns the
+ * number of bytes read or -1; the buffer is always NUL-terminated.
+ */
+static ssize_t
+reread(struct linux_data *lnx, int fd)
+{
+	ssize_t n;
+	size_t off = 0;
+
+	if (fd < 0)
+		return -1;
+	for (;;) {
+		n = pread(fd,&lnx->buf[off],lnx->bufsiz - off - 1,off);
+		if (n < 0)
+			return -1;
+		off += n;
+		if (!n || (off < lnx->bufsiz - 1))
+			break;
+		/* filled the buffer: there might be more */
+		lnx->bufsiz *= 2;
+		lnx->buf = realloc(lnx->buf,lnx->bufsiz);
+		assert(lnx->buf);
+	}
+	lnx->buf[off] = '\0';
+	return off;
+}
+
+/*
+ * Read a small one-line /sys attribute we do not keep open
+ */
+static int
+read_sysfs_line(char *path, char *buf, size_t bufsiz)
+{
+	int fd, n;
+
+	fd = open(path,O_RDONLY);
+	if (fd < 0)
+		return -1;
+	n = read(fd,buf,bufsiz - 1);
+	close(fd);
+	if (n < 0)
+		return -1;
+	buf[n] = '\0';
+	if (n && buf[n-1] == '\n')
+		buf[--n] = '\0';
+	return n;
+}
+
+static int
+open_sysfs(char *dir, char *name, char *attr)
+{
+	char path[PATH_MAX];
+
+	assert_snprintf(path,"%s/%s/%s",dir,name,attr);
+	return open(path,O_RDONLY);
+}
+
+static void
+close_fd(int *fdp)
+{
+	if (*fdp >= 0)
+		close(*fdp);
+	*fdp = -1;
+}
+
+/*
+ * Hand-rolled scanners for /proc/net/dev and /proc/meminfo.  These
+ * run on every tick, and on a busy host /proc/net/dev can have
+ * hundreds of lines, so they make one pass over the buffer, never
+ * allocate and stay away from the locale-aware strto*()/sscanf()
+ * family.  Numbers in procfs are plain unsigned decimal.
+ */
+
+static inline char *
+skip_blanks(char *p, char *lim)
+{
+	while ((p < lim) && ((*p == ' ') || (*p == '\t')))
+		p++;
+	return p;
+}
+
+static inline char *
+next_line(char *p, char *lim)
+{
+	while ((p < lim) && (*p != '\n'))
+		p++;
+	return (p < lim) ? p + 1 : lim;
+}
+
+static inline char *
+scan_u64(char *p, char *lim, u_int64_t *valp)
+{
+	u_int64_t val = 0;
+
+	p = skip_blanks(p,lim);
+	while ((p < lim) && ((unsigned char)(*p - '0') < 10))
+		val = (val * 10) + (*p++ - '0');
+	*valp = val;
+	return p;
+}
+
+static void
+grow_ifstats(struct linux_data *lnx, int need)
+{
+	int newmax = lnx->maxifs ? lnx->maxifs : MIN_IFSTATS;
+	struct ifstat *newstats;
+
+	while (newmax < need)
+		newmax *= 2;
+	newstats = realloc(lnx->ifstats,newmax * sizeof(struct ifstat));
+	assert(newstats);
+	memset(&newstats[lnx->maxifs],0,
+	       (newmax - lnx->maxifs) * sizeof(struct ifstat));
+	lnx->ifstats = newstats;
+	lnx->maxifs = newmax;
+}
+
+/*
+ * Scan /proc/net/dev into lnx->ifstats[], one slot per line in the
+ * order the kernel lists them.  That order only changes when
+ * interfaces come or go, so normally each line lands in a slot that
+ * already has its name and we just overwrite the counters; when the
+ * names differ the slot is recycled.  The table is sized in
+ * probe_init() and only grows if the interface count does.  Returns
+ * the number of interfaces seen.
+ */
+static int
+scan_net_dev(struct linux_data *lnx, char *buf, size_t len)
+{
+	char *p = buf, *lim = buf + len;
+	int n = 0;
+
+	p = next_line(p,lim);		/* two lines of headers */
+	p = next_line(p,lim);
+	while (p < lim) {
+		u_int64_t f[NETDEV_NFIELDS];
+		struct ifstat *ifs;
+		char *name;
+		size_t nlen;
+		int i;
+
+		name = p = skip_blanks(p,lim);
+		while ((p < lim) && (*p != ':') && (*p != '\n'))
+			p++;
+		nlen = p - name;
+		if ((p == lim) || (*p != ':') || !nlen || (nlen >= IFNAMSIZ)) {
+			p = next_line(p,lim);
+			continue;
+		}
+		p++;
+		for (i = 0; i < NETDEV_NFIELDS; i++)
+			p = scan_u64(p,lim,&f[i]);
+		p = next_line(p,lim);
+		if (n >= lnx->maxifs)
+			grow_ifstats(lnx,n + 1);
+		ifs = &lnx->ifstats[n++];
+		if (strncmp(ifs->ifs_name,name,nlen) || ifs->ifs_name[nlen]) {
+			memcpy(ifs->ifs_name,name,nlen);
+			ifs->ifs_name[nlen] = '\0';
+			ifs->ifs_speed = -1;
+		}
+		ifs->ifs_cur.ifc_ib = f[0];
+		ifs->ifs_cur.ifc_ip = f[1];
+		ifs->ifs_cur.ifc_ie = f[2];
+		ifs->ifs_cur.ifc_ob = f[8];
+		ifs->ifs_cur.ifc_op = f[9];
+		ifs->ifs_cur.ifc_oe = f[10];
+		ifs->ifs_cur.ifc_co = f[13];
+	}
+	/* forget interfaces that have gone away */
+	for (; lnx->nifs > n; lnx->nifs--)
+		lnx->ifstats[lnx->nifs - 1].ifs_name[0] = '\0';
+	lnx->nifs = n;
+	return n;
+}
+
+/*
+ * Scan /proc/meminfo for the four keys we use.  They all live near
+ * the top of the file so we stop as soon as we have seen them.
+ */
+static void
+scan_meminfo(char *buf, size_t len, struct meminfo *mi)
+{
+#define MI_KEY(kk,ff) { kk ":", sizeof(kk), offsetof(struct meminfo,ff) }
+	static const struct {
+		const char *key;
+		size_t	    len;
+		size_t	    off;
+	} keys[] = {
+		MI_KEY("MemTotal",	mem_total),
+		MI_KEY("MemAvailable",	mem_available),
+		MI_KEY("SwapTotal",	swap_total),
+		MI_KEY("SwapFree",	swap_free),
+	};
+#undef MI_KEY
+	char *p = buf, *lim = buf + len;
+	int i, nfound = 0;
+
+	memset(mi,0,sizeof(*mi));
+	while ((p < lim) && (nfound < ARRAY_SIZE(keys))) {
+		for (i = 0; i < ARRAY_SIZE(keys); i++) {
+			if ((lim - p > keys[i].len) &&
+			    !memcmp(p,keys[i].key,keys[i].len)) {
+				p = scan_u64(p + keys[i].len,lim,
+					     (u_int64_t *)((char *)mi +
+							   keys[i].off));
+				nfound++;
+				break;
+			}
+		}
+		p = next_line(p,lim);
+	}
+}
+
+static void
+free_temperature_sensors()
+{
+	struct temp_sensor *s;
+
+	while ((s = SLIST_FIRST(&temp_sensors)) != NULL) {
+		SLIST_REMOVE_HEAD(&temp_sensors, entries);
+		free(s);
+	}
+	n_temp_sensors = 0;
+}
+
+static void
+load_temperature_sensors()
+{
+	DIR *dir;
+	struct dirent *ent;
+	struct temp_sensor *tail;
+
+	free_temperature_sensors();	/* from an earlier probe_init() */
+	SLIST_INIT(&temp_sensors);
+	tail = NULL;
+	dir = opendir(SYS_THERMAL);
+	if (!dir)
+		return;
+	while ((ent = readdir(dir)) != NULL) {
+		struct temp_sensor *s;
+		char path[PATH_MAX];
+		char val[SMALL_BUFSIZ];
+
+		if (strncmp(ent->d_name,"thermal_zone",12))
+			continue;
+		assert_snprintf(path,"%s/%s/temp",SYS_THERMAL,ent->d_name);
+		if (read_sysfs_line(path,val,sizeof(val)) <= 0)
+			continue;
+		s = malloc(sizeof(struct temp_sensor));
+		assert(s);
+		assert_strlcpy(s->name,ent->d_name);
+		assert_strlcpy(s->path,path);
+		s->desc[0] = 0;
+		assert_snprintf(path,"%s/%s/type",SYS_THERMAL,ent->d_name);
+		(void) read_sysfs_line(path,s->desc,sizeof(s->desc));
+		s->val = strtol(val,NULL,10) / 1000.0;
+		if (tail == NULL)
+			SLIST_INSERT_HEAD(&temp_sensors, s, entries);
+		else
+			SLIST_INSERT_AFTER(tail, s, entries);
+		tail = s;
+		n_temp_sensors++;
+	}
+	closedir(dir);
+}
+
+static struct temp_sensor *
+find_temperature_sensor(char *name)
+{
+	struct temp_sensor *s;
+
+	SLIST_FOREACH(s, &temp_sensors, entries)
+		if (!strcmp(s->name, name))
+			return s;
+	return NULL;
+}
+
+void
+print_temperature_sensors()
+{
+	struct temp_sensor *s;
+
+	if (!n_temp_sensors)
+		load_temperature_sensors();
+	printf("Valid temperature sensors and their current values:\n");
+	SLIST_FOREACH(s, &temp_sensors, entries)
+		printf("%s = %.2f degC%s%s%s\n", s->name, s->val,
+		       s->desc[0] ? " (": "", s->desc, s->desc[0]? ")": "");
+}
+
+/*
+ * Find the first battery and AC adapter under /sys/class/power_supply
+ * and open the attributes we sample.  Not every battery has every
+ * attribute; anything missing stays -1.
+ */
+static void
+open_power_supply(struct linux_data *lnx)
+{
+	DIR *dir;
+	struct dirent *ent;
+
+	dir = opendir(SYS_POWER);
+	if (!dir)
+		return;
+	while ((ent = readdir(dir)) != NULL) {
+		char path[PATH_MAX];
+		char type[SMALL_BUFSIZ];
+
+		if (ent->d_name[0] == '.')
+			continue;
+		assert_snprintf(path,"%s/%s/type",SYS_POWER,ent->d_name);
+		if (read_sysfs_line(path,type,sizeof(type)) <= 0)
+			continue;
+		if (!strcmp(type,"Battery") && (lnx->bat_capacity_fd < 0)) {
+			lnx->bat_capacity_fd =
+				open_sysfs(SYS_POWER,ent->d_name,"capacity");
+			lnx->bat_status_fd =
+				open_sysfs(SYS_POWER,ent->d_name,"status");
+			lnx->bat_energy_now_fd =
+				open_sysfs(SYS_POWER,ent->d_name,"energy_now");
+			if (lnx->bat_energy_now_fd < 0)
+				lnx->bat_energy_now_fd = open_sysfs(
+					SYS_POWER,ent->d_name,"charge_now");
+			lnx->bat_energy_full_fd =
+				open_sysfs(SYS_POWER,ent->d_name,"energy_full");
+			if (lnx->bat_energy_full_fd < 0)
+				lnx->bat_energy_full_fd = open_sysfs(
+					SYS_POWER,ent->d_name,"charge_full");
+			lnx->bat_power_now_fd =
+				open_sysfs(SYS_POWER,ent->d_name,"power_now");
+			if (lnx->bat_power_now_fd < 0)
+				lnx->bat_power_now_fd = open_sysfs(
+					SYS_POWER,ent->d_name,"current_now");
+		} else if (!strcmp(type,"Mains") && (lnx->ac_online_fd < 0))
+			lnx->ac_online_fd =
+				open_sysfs(SYS_POWER,ent->d_name,"online");
+	}
+	closedir(dir);
+}
+
+static void
+use_temperature_sensor(struct linux_data *lnx, struct temp_sensor *tsens)
+{
+	close_fd(&lnx->temp_fd);
+	lnx->temp_sensor = tsens;
+	lnx->temp_fd = open(tsens->path,O_RDONLY);
+}
+
+static int
+open_or_die(struct osdhud_state *state, char *path)
+{
+	int fd = open(path,O_RDONLY);
+
+	if (fd < 0) {
+		SPEWE(path);
+		exit(1);
+	}
+	return fd;
+}
+
+void
+probe_init(struct osdhud_state *state)
+{
+	struct linux_data *lnx;
+
+	lnx = (struct linux_data *)malloc(sizeof(struct linux_data));
+	assert(lnx);
+	lnx->bufsiz = INITIAL_BUFSIZ;
+	lnx->buf = malloc(lnx->bufsiz);
+	assert(lnx->buf);
+	lnx->nifs = lnx->maxifs = 0;
+	lnx->ifstats = NULL;
+	lnx->meminfo_fresh = 0;
+
+	lnx->loadavg_fd = open_or_die(state,PROC_LOADAVG);
+	lnx->meminfo_fd = open_or_die(state,PROC_MEMINFO);
+	lnx->uptime_fd = open_or_die(state,PROC_UPTIME);
+	lnx->netdev_fd = open_or_die(state,PROC_NET_DEV);
+	nl_open(state,lnx);
+	/* size the interface table once, with room to spare */
+	if (reread(lnx,lnx->netdev_fd) > 0) {
+		char *p;
+		int nlines = 0;
+
+		for (p = lnx->buf; *p; p++)
+			if (*p == '\n')
+				nlines++;
+		grow_ifstats(lnx,2 * nlines);
+	}
+
+	lnx->bat_capacity_fd = lnx->bat_status_fd = lnx->ac_online_fd =
+		lnx->bat_energy_now_fd = lnx->bat_energy_full_fd =
+		lnx->bat_power_now_fd = -1;
+	open_power_supply(lnx);
+	if (lnx->bat_capacity_fd < 0)
+		state->battery_missing = 1;
+
+	lnx->ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (lnx->ncpus < 1)
+		lnx->ncpus = 1;
+	if (!state->max_load_avg)
+		state->max_load_avg = 2.0 * (float)lnx->ncpus; /* xxx 2? */
+	VSPEW("ncpus=%d, max load avg=%f",lnx->ncpus,state->max_load_avg);
+
+	lnx->temp_fd = -1;
+	lnx->temp_sensor = NULL;
+	load_temperature_sensors();
+	if (n_temp_sensors) {
+		struct temp_sensor *tsens;
+
+		tsens = SLIST_FIRST(&temp_sensors);
+		if (state->temp_sensor_name != NULL) {
+			tsens = find_temperature_sensor(
+				state->temp_sensor_name);
+			if (tsens == NULL) {
+				tsens = SLIST_FIRST(&temp_sensors);
+				syslog(LOG_ERR, "invalid temp sensor '%s'"
+				       " - using '%s' instead",
+				       state->temp_sensor_name, tsens->name);
+			}
+		}
+		use_temperature_sensor(lnx,tsens);
+		free(state->temp_sensor_name);
+		state->temp_sensor_name = strdup(tsens->name);
+	}
+
+	state->per_os_data = (void *)lnx;
+}
+
+void
+probe_cleanup(struct osdhud_state *state)
+{
+	if (state->per_os_data) {
+		struct linux_data *lnx =
+			(struct linux_data *)state->per_os_data;
+
+		close_fd(&lnx->loadavg_fd);
+		close_fd(&lnx->meminfo_fd);
+		close_fd(&lnx->uptime_fd);
+		close_fd(&lnx->netdev_fd);
+		close_fd(&lnx->nl_fd);
+		close_fd(&lnx->nl_mon_fd);
+		free(lnx->nl_buf);
+		free(lnx->links);
+		close_fd(&lnx->bat_capacity_fd);
+		close_fd(&lnx->bat_status_fd);
+		close_fd(&lnx->bat_energy_now_fd);
+		close_fd(&lnx->bat_energy_full_fd);
+		close_fd(&lnx->bat_power_now_fd);
+		close_fd(&lnx->ac_online_fd);
+		close_fd(&lnx->temp_fd);
+		free_temperature_sensors();
+		free(lnx->ifstats);
+		lnx->ifstats = NULL;
+		lnx->nifs = lnx->maxifs = 0;
+		free(lnx->buf);
+		free(lnx);
+		state->per_os_data = NULL;
+	}
+}
+
+void
+probe_load(struct osdhud_state *state)
+{
+	struct linux_data *lnx = (struct linux_data *)state->per_os_data;
+
+	if (reread(lnx,lnx->loadavg_fd) < 0) {
+		SPEWE(PROC_LOADAVG);
+		exit(1);
+	}
+	state->load_avg = strtof(lnx->buf,NULL);
+}
+
+void
+probe_mem(struct osdhud_state *state)
+{
+	struct linux_data *lnx = (struct linux_data *)state->per_os_data;
+	struct meminfo *mi = &lnx->meminfo;
+	ssize_t len;
+
+	if ((len = reread(lnx,lnx->meminfo_fd)) < 0) {
+		SPEWE(PROC_MEMINFO);
+		return;
+	}
+	scan_meminfo(lnx->buf,len,mi);
+	lnx->meminfo_fresh = 1;
+	state->mem_used_percent = mi->mem_total ?
+		(float)(mi->mem_total - mi->mem_available) /
+		(float)mi->mem_total : 0;
+}
+
+/*
+ * Swap comes out of /proc/meminfo too; probe() calls probe_mem()
+ * just before us so we normally reuse what it scanned.
+ */
+void
+probe_swap(struct osdhud_state *state)
+{
+	struct linux_data *lnx = (struct linux_data *)state->per_os_data;
+	struct meminfo *mi = &lnx->meminfo;
+	ssize_t len;
+
+	if (!state->nswap)
+		return;
+	if (!lnx->meminfo_fresh) {
+		if ((len = reread(lnx,lnx->meminfo_fd)) < 0) {
+			SPEWE(PROC_MEMINFO);
+			return;
+		}
+		scan_meminfo(lnx->buf,len,mi);
+	}
+	lnx->meminfo_fresh = 0;
+	state->swap_used_percent = mi->swap_total ?
+		(float)(mi->swap_total - mi->swap_free) /
+		(float)mi->swap_total : 0;
+}
+
+/*
+ * Link speed in mbit/sec from sysfs; -1 or missing means unknown,
+ * which we report as zero just like get_speed() in openbsd.c
+ */
+static int
+get_speed(char *name, struct osdhud_state *state)
+{
+	char path[PATH_MAX];
+	char val[SMALL_BUFSIZ];
+	int mbit_sec = 0;
+
+	assert_snprintf(path,"%s/%s/speed",SYS_NET,name);
+	if (read_sysfs_line(path,val,sizeof(val)) > 0)
+		mbit_sec = atoi(val);
+	if (mbit_sec < 0)
+		mbit_sec = 0;
+	VSPEW("iface %s: %d mbit/sec",name,mbit_sec);
+	return mbit_sec;
+}
+
+/*
+ * Feed the counters of one interface to the network statistics code.
+ * Only the watched interface needs its link speed.
+ */
+static void
+report_net(struct osdhud_state *state, int index, struct ifstat *ifs,
+	   int watched)
+{
+	struct ifcounters c;
+
+	if (watched) {
+		if (ifs->ifs_speed < 0)
+			ifs->ifs_speed = get_speed(ifs->ifs_name,state);
+		if (!state->net_speed_fixed &&
+		    (state->net_speed_mbits != ifs->ifs_speed)) {
+			VSPEW("%s net_speed_mbits = %d",ifs->ifs_name,
+			      ifs->ifs_speed);
+			state->net_speed_mbits = ifs->ifs_speed;
+		}
+	}
+	c.ibytes = ifs->ifs_cur.ifc_ib;
+	c.obytes = ifs->ifs_cur.ifc_ob;
+	c.ipackets = ifs->ifs_cur.ifc_ip;
+	c.opackets = ifs->ifs_cur.ifc_op;
+	c.ierrs = ifs->ifs_cur.ifc_ie;
+	c.oerrs = ifs->ifs_cur.ifc_oe;
+	update_net_statistics(state,index,ifs->ifs_name,&c,watched);
+}
+
+/*
+ * /proc/net/dev looks like this (two header lines, then one line per
+ * interface):
+ *
+ * Inter-|   Receive                      ...|  Transmit
+ *  face |bytes    packets errs drop fifo frame compressed multicast|bytes ...
+ *     lo: 1234 56 0 0 0 0 0 0 1234 56 0 0 0 0 0 0
+ */
+static void
+probe_net_procfs(struct osdhud_state *state, struct linux_data *lnx)
+{
+	int i, old_nifs = lnx->nifs;
+	ssize_t len;
+
+	if ((len = reread(lnx,lnx->netdev_fd)) < 0) {
+		SPEWE(PROC_NET_DEV);
+		return;
+	}
+	scan_net_dev(lnx,lnx->buf,len);
+	/*
+	 * If no interface specification was given we pick the first
+	 * non-loopback interface we find as the one we care about.
+	 * Arbitrary.
+	 */
+	for (i = 0; !state->net_iface && (i < lnx->nifs); i++)
+		if (strncmp(lnx->ifstats[i].ifs_name,"lo",2)) {
+			/* first non-loopback interface */
+			state->net_iface = strdup(lnx->ifstats[i].ifs_name);
+			VSPEW("choosing first non-loopback interface: %s",
+			      state->net_iface);
+		}
+	/* there is no ifindex here, so line number + 1 stands in */
+	for (i = 0; i < lnx->nifs; i++)
+		report_net(state,i + 1,&lnx->ifstats[i],
+			   net_watched(state,i + 1,lnx->ifstats[i].ifs_name));
+	for (i = lnx->nifs; i < old_nifs; i++)
+		forget_net_interface(state,i + 1);
+}
+
+/*
+ * rtnetlink
+ */
+
+static int
+nl_socket(struct osdhud_state *state, int flags, u_int32_t groups)
+{
+	struct sockaddr_nl sa;
+	int fd;
+
+	fd = socket(AF_NETLINK,SOCK_RAW|SOCK_CLOEXEC|flags,NETLINK_ROUTE);
+	if (fd < 0)
+		return -1;
+	memset(&sa,0,sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = groups;
+	if (bind(fd,(struct sockaddr *)&sa,sizeof(sa))) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * Open our query socket and subscribe to link events.  We subscribe
+ * before the initial dump so nothing can slip through between the two.
+ */
+static void
+nl_open(struct osdhud_state *state, struct linux_data *lnx)
+{
+	lnx->nl_seq = 0;
+	lnx->nl_ifindex = 0;
+	lnx->nl_resync = 1;
+	lnx->nl_gen = 0;
+	lnx->nl_sweep_t = 0;
+	lnx->nlinks = 0;
+	lnx->links = NULL;
+	lnx->nl_bufsiz = NL_BUFSIZ;
+	lnx->nl_buf = malloc(lnx->nl_bufsiz);
+	assert(lnx->nl_buf);
+	lnx->nl_mon_fd = -1;
+	lnx->nl_fd = nl_socket(state,0,0);
+	if (lnx->nl_fd < 0) {
+		SPEWE("netlink socket - falling back to " PROC_NET_DEV);
+		return;
+	}
+	lnx->nl_mon_fd = nl_socket(state,SOCK_NONBLOCK,RTMGRP_LINK);
+	if (lnx->nl_mon_fd < 0)
+		SPEWE("netlink RTMGRP_LINK - will dump every tick");
+}
+
+static struct ifstat *
+link_slot(struct linux_data *lnx, int ifindex)
+{
+	if (ifindex <= 0)
+		return NULL;
+	if (ifindex >= lnx->nlinks) {
+		int newmax = lnx->nlinks ? lnx->nlinks : MIN_IFSTATS;
+		struct ifstat *newlinks;
+
+		while (newmax <= ifindex)
+			newmax *= 2;
+		newlinks = realloc(lnx->links,newmax * sizeof(struct ifstat));
+		assert(newlinks);
+		memset(&newlinks[lnx->nlinks],0,
+		       (newmax - lnx->nlinks) * sizeof(struct ifstat));
+		lnx->links = newlinks;
+		lnx->nlinks = newmax;
+	}
+	return &lnx->links[ifindex];
+}
+
+/*
+ * Apply one RTM_NEWLINK or RTM_DELLINK, whether it is a reply to one
+ * of our requests or a notification, to the links[] table.  A change
+ * of name or of interface flags (up/down, carrier) forgets the link
+ * speed so that it is asked for again the next time it matters.
+ */
+static void
+nl_link(struct osdhud_state *state, struct linux_data *lnx,
+	struct nlmsghdr *nh)
+{
+	struct ifinfomsg *ifi = (struct ifinfomsg *)NLMSG_DATA(nh);
+	int len = IFLA_PAYLOAD(nh);
+	struct rtattr *rta;
+	struct rtnl_link_stats64 st;
+	int have_stats = 0;
+	char *name = NULL;
+	struct ifstat *ifs;
+
+	if (!(ifs = link_slot(lnx,ifi->ifi_index)))
+		return;
+	if (nh->nlmsg_type == RTM_DELLINK) {
+		VSPEW("%s (ifindex %d) went away",ifs->ifs_name,
+		      ifi->ifi_index);
+		memset(ifs,0,sizeof(*ifs));
+		forget_net_interface(state,ifi->ifi_index);
+		return;
+	}
+	memset(&st,0,sizeof(st));
+	for (rta = IFLA_RTA(ifi); RTA_OK(rta,len); rta = RTA_NEXT(rta,len)) {
+		switch (rta->rta_type) {
+		case IFLA_IFNAME:
+			name = (char *)RTA_DATA(rta);
+			break;
+		case IFLA_STATS64:
+			/* older kernels send a shorter struct */
+			memcpy(&st,RTA_DATA(rta),
+			       MIN(RTA_PAYLOAD(rta),sizeof(st)));
+			have_stats = 1;
+			break;
+		}
+	}
+	if (!name)
+		return;
+	if (strcmp(ifs->ifs_name,name)) {
+		VSPEW("%s is ifindex %d%s%s",name,ifi->ifi_index,
+		      ifs->ifs_name[0] ? ", was " : "",ifs->ifs_name);
+		assert_strlcpy(ifs->ifs_name,name);
+		ifs->ifs_speed = -1;
+		/* the index was recycled, or -i may now mean another slot */
+		forget_net_interface(state,ifi->ifi_index);
+	} else if (ifs->ifs_flags != ifi->ifi_flags) {
+		VSPEW("%s flags 0x%x -> 0x%x",name,ifs->ifs_flags,
+		      ifi->ifi_flags);
+		ifs->ifs_speed = -1;
+	}
+	ifs->ifs_flags = ifi->ifi_flags;
+	ifs->ifs_gen = lnx->nl_gen;
+	if (have_stats) {
+		ifs->ifs_cur.ifc_ib = st.rx_bytes;
+		ifs->ifs_cur.ifc_ip = st.rx_packets;
+		ifs->ifs_cur.ifc_ie = st.rx_errors;
+		ifs->ifs_cur.ifc_ob = st.tx_bytes;
+		ifs->ifs_cur.ifc_op = st.tx_packets;
+		ifs->ifs_cur.ifc_oe = st.tx_errors;
+		ifs->ifs_cur.ifc_co = st.collisions;
+	}
+}
+
+/*
+ * Hand every RTM_NEWLINK/RTM_DELLINK in the n bytes of nl_buf to
+ * nl_link().  If seq is nonzero only replies to that request are
+ * looked at.  Returns 1 if the reply is complete, -1 with errno set on
+ * an error reply, 0 if there is more to come.
+ */
+static int
+nl_parse(struct osdhud_state *state, struct linux_data *lnx, int n,
+	 u_int32_t seq)
+{
+	struct nlmsghdr *nh;
+
+	for (nh = (struct nlmsghdr *)lnx->nl_buf; NLMSG_OK(nh,n);
+	     nh = NLMSG_NEXT(nh,n)) {
+		if (seq && (nh->nlmsg_seq != seq))
+			continue;	/* leftovers from a lost dump */
+		if (nh->nlmsg_type == NLMSG_DONE)
+			return 1;
+		if (nh->nlmsg_type == NLMSG_ERROR) {
+			struct nlmsgerr *nerr = NLMSG_DATA(nh);
+
+			if (nerr->error) {
+				errno = -nerr->error;
+				return -1;
+			}
+			return 1;
+		}
+		if ((nh->nlmsg_type == RTM_NEWLINK) ||
+		    (nh->nlmsg_type == RTM_DELLINK))
+			nl_link(state,lnx,nh);
+		if (seq && !(nh->nlmsg_flags & NLM_F_MULTI))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * recv(2) one datagram from a netlink socket into nl_buf, growing the
+ * buffer for next time if it was truncated.  Returns the length or -1.
+ */
+static ssize_t
+nl_recv(struct osdhud_state *state, struct linux_data *lnx, int fd)
+{
+	ssize_t n;
+
+	do {
+		n = recv(fd,lnx->nl_buf,lnx->nl_bufsiz,MSG_TRUNC);
+	} while ((n < 0) && (errno == EINTR));
+	if ((n >= 0) && ((size_t)n > lnx->nl_bufsiz)) {
+		/* lost this one; make room for next time */
+		while (lnx->nl_bufsiz < (size_t)n)
+			lnx->nl_bufsiz *= 2;
+		lnx->nl_buf = realloc(lnx->nl_buf,lnx->nl_bufsiz);
+		assert(lnx->nl_buf);
+		errno = EMSGSIZE;
+		return -1;
+	}
+	return n;
+}
+
+/*
+ * Send an RTM_GETLINK for ifindex, or dump every link if ifindex is
+ * zero, and apply the replies to links[].  Returns 0 or -1 with errno
+ * set, e.g. to ENODEV if the ifindex has gone away.
+ */
+static int
+nl_getlink(struct osdhud_state *state, struct linux_data *lnx, int ifindex)
+{
+	struct {
+		struct nlmsghdr	 nh;
+		struct ifinfomsg ifi;
+	} req;
+	int done = 0;
+
+	memset(&req,0,sizeof(req));
+	req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifi));
+	req.nh.nlmsg_type = RTM_GETLINK;
+	req.nh.nlmsg_flags = NLM_F_REQUEST | (ifindex ? 0 : NLM_F_DUMP);
+	req.nh.nlmsg_seq = ++lnx->nl_seq;
+	req.ifi.ifi_family = AF_UNSPEC;
+	req.ifi.ifi_index = ifindex;
+	if (send(lnx->nl_fd,&req,req.nh.nlmsg_len,0) < 0) {
+		SPEWE("netlink send");
+		return -1;
+	}
+	while (!done) {
+		ssize_t n = nl_recv(state,lnx,lnx->nl_fd);
+
+		if (n < 0)
+			return -1;
+		done = nl_parse(state,lnx,n,lnx->nl_seq);
+		if (done < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Rebuild links[] from a full dump, forgetting anything the dump did
+ * not mention
+ */
+static void
+nl_resync(struct osdhud_state *state, struct linux_data *lnx)
+{
+	int i;
+
+	lnx->nl_gen++;
+	if (nl_getlink(state,lnx,0) < 0) {
+		SPEWE("netlink RTM_GETLINK dump");
+		return;
+	}
+	for (i = 0; i < lnx->nlinks; i++)
+		if (lnx->links[i].ifs_name[0] &&
+		    (lnx->links[i].ifs_gen != lnx->nl_gen)) {
+			memset(&lnx->links[i],0,sizeof(struct ifstat));
+			forget_net_interface(state,i);
+		}
+	lnx->nl_resync = (lnx->nl_mon_fd < 0);
+	lnx->nl_sweep_t = state->mono_t;
+}
+
+/*
+ * Drain pending link notifications.  If the kernel had to drop some
+ * (ENOBUFS) we no longer know what the table looks like and dump.
+ */
+static void
+nl_events(struct osdhud_state *state, struct linux_data *lnx)
+{
+	ssize_t n;
+
+	if (lnx->nl_mon_fd < 0)
+		return;
+	while ((n = nl_recv(state,lnx,lnx->nl_mon_fd)) >= 0)
+		(void) nl_parse(state,lnx,n,0);
+	if (errno == ENOBUFS || errno == EMSGSIZE) {
+		VSPEW("lost link notifications, resyncing");
+		lnx->nl_resync = 1;
+	} else if (errno != EAGAIN)
+		SPEWE("netlink RTMGRP_LINK");
+}
+
+/*
+ * Work out which links[] slot we are watching.  Once the watched
+ * interface has been reported the iftable remembers its slot, which
+ * for us is its ifindex, so links[] only has to be searched when no
+ * -i was given or -i names an interface we have not reported yet.
+ */
+static struct ifstat *
+nl_watched(struct osdhud_state *state, struct linux_data *lnx)
+{
+	int i;
+
+	/*
+	 * If no interface specification was given we pick the first
+	 * non-loopback interface we find as the one we care about.
+	 * Arbitrary.
+	 */
+	for (i = 1; !state->net_iface && (i < lnx->nlinks); i++) {
+		char *name = lnx->links[i].ifs_name;
+
+		if (name[0] && strncmp(name,"lo",2)) {
+			state->net_iface = strdup(name);
+			VSPEW("choosing first non-loopback interface: %s",
+			      state->net_iface);
+		}
+	}
+	lnx->nl_ifindex = 0;
+	if (!state->net_iface)
+		return NULL;
+	if ((i = iftable_watch(state->ifs,state->net_iface)) < 0)
+		for (i = 1; i < lnx->nlinks; i++)
+			if (!strcmp(lnx->links[i].ifs_name,state->net_iface))
+				break;
+	if ((i <= 0) || (i >= lnx->nlinks) || !lnx->links[i].ifs_name[0])
+		return NULL;
+	lnx->nl_ifindex = i;
+	return &lnx->links[i];
+}
+
+/*
+ * Only the watched interface is asked about on every tick.  A dump of
+ * every link costs several times as much, so the rest are only looked
+ * at every NL_SWEEP_MSECS: often enough for the -I line, and to have
+ * averages at most that old waiting should -i switch to one of them.
+ */
+static void
+probe_net_netlink(struct osdhud_state *state, struct linux_data *lnx)
+{
+	struct ifstat *ifs;
+	int i;
+
+	nl_events(state,lnx);
+	if (lnx->nl_resync ||
+	    (state->mono_t - lnx->nl_sweep_t >= NL_SWEEP_MSECS)) {
+		nl_resync(state,lnx);
+		(void) nl_watched(state,lnx);
+		for (i = 1; i < lnx->nlinks; i++)
+			if (lnx->links[i].ifs_name[0])
+				report_net(state,i,&lnx->links[i],
+					   i == lnx->nl_ifindex);
+		return;
+	}
+	if (!(ifs = nl_watched(state,lnx)))
+		return;
+	i = lnx->nl_ifindex;
+	if (nl_getlink(state,lnx,i) < 0) {
+		if (errno == ENODEV)
+			lnx->nl_resync = 1;	/* missed a DELLINK? */
+		else
+			SPEWE("netlink RTM_GETLINK");
+		return;
+	}
+	report_net(state,i,ifs,1);
+}
+
+void
+probe_net(struct osdhud_state *state)
+{
+	struct linux_data *lnx = (struct linux_data *)state->per_os_data;
+
+	if (lnx->nl_fd >= 0)
+		probe_net_netlink(state,lnx);
+	else
+		probe_net_procfs(state,lnx);
+}
+
+/*
+ * Read a single integer out of an already-open sysfs attribute
+ */
+static long long
+reread_number(struct linux_data *lnx, int fd)
+{
+	if (reread(lnx,fd) <= 0)
+		return -1;
+	return strtoll(lnx->buf,NULL,10);
+}
+
+/* c.f. Documentation/ABI/testing/sysfs-class-power */
+void
+probe_battery(struct osdhud_state *state)
+{
+	struct linux_data *lnx = (struct linux_data *)state->per_os_data;
+	char bat[SMALL_BUFSIZ];
+	char *ac;
+	long long energy_now, energy_full, power_now;
+	int i;
+
+	if (state->battery_missing)
+		return;
+	if (reread(lnx,lnx->bat_status_fd) > 0) {
+		assert_strlcpy(bat,lnx->buf);
+		for (i = 0; bat[i]; i++) {
+			if (bat[i] == '\n') {
+				bat[i] = '\0';
+				break;
+			}
+			if (bat[i] >= 'A' && bat[i] <= 'Z')
+				bat[i] += 'a' - 'A';
+		}
+	} else
+		assert_strlcpy(bat,"?");
+	switch (reread_number(lnx,lnx->ac_online_fd)) {
+	case 0:
+		ac = "no ac";
+		break;
+	case 1:
+		ac = "ac on";
+		break;
+	default:
+		ac = "?";
+		break;
+	}
+	assert_snprintf(state->battery_state,"%s/%s",bat,ac);
+	state->battery_life = reread_number(lnx,lnx->bat_capacity_fd);
+	energy_now = reread_number(lnx,lnx->bat_energy_now_fd);
+	energy_full = reread_number(lnx,lnx->bat_energy_full_fd);
+	power_now = reread_number(lnx,lnx->bat_power_now_fd);
+	state->battery_time = -1;
+	if ((power_now > 0) && (energy_now >= 0)) {
+		if (!strcmp(bat,"discharging"))
+			state->battery_time = (energy_now * 60) / power_now;
+		else if (!strcmp(bat,"charging") &&
+			 (energy_full > energy_now))
+			state->battery_time =
+				((energy_full - energy_now) * 60) / power_now;
+	}
+}
+
+void
+probe_temperature(struct osdhud_state *state)
+{
+	struct linux_data *lnx = (struct linux_data *)state->per_os_data;
+	long long millideg;
+
+	if (!n_temp_sensors)
+		return;
+	if (strcmp(state->temp_sensor_name, lnx->temp_sensor->name)) {
+		/* sensor was changed on the fly... */
+		struct temp_sensor *tsens;
+
+		tsens = find_temperature_sensor(state->temp_sensor_name);
+		if (tsens)
+			use_temperature_sensor(lnx,tsens);
+		else {
+			syslog(LOG_ERR, "invalid temp sensor name '%s'",
+				state->temp_sensor_name);
+			free(state->temp_sensor_name);
+			state->temp_sensor_name =
+				strdup(lnx->temp_sensor->name);
+		}
+	}
+	millideg = reread_number(lnx,lnx->temp_fd);
+	if (millideg < 0)
+		return;
+	lnx->temp_sensor->val = millideg / 1000.0;
+	state->temperature = lnx->temp_sensor->val;
+}
+
+void
+probe_uptime(struct osdhud_state *state)
+{
+	struct linux_data *lnx = (struct linux_data *)state->per_os_data;
+
+	if (reread(lnx,lnx->uptime_fd) < 0) {
+		SPEWE(PROC_UPTIME);
+		return;
+	}
+	state->sys_uptime = (time_t)strtod(lnx->buf,NULL);
+}
+
+/*
+ * Microbenchmarks for the scanners above, run via osdhud -B.  The
+ * netdev benchmark scans a made-up /proc/net/dev with BENCH_NIFS
+ * interfaces, so the per-pass figure is the cost per 1000 interfaces;
+ * the same text is then pushed through sscanf(3) for comparison.
+ */
+
+static void
+bench_net_dev(struct linux_data *lnx, int iters)
+{
+	size_t len = 0;
+	unsigned long long t0, sum = 0;
+	int i, j;
+
+	lnx->buf[0] = '\0';
+	len = strlcat(lnx->buf,"Inter-|   Receive  |  Transmit\n"
+		      " face |bytes packets|bytes packets\n",lnx->bufsiz);
+	for (i = 0; i < BENCH_NIFS; i++) {
+		char line[256];
+		int n;
+
+		n = snprintf(line,sizeof(line),"veth%05d: %llu %d 0 0 0 0 0 0"
+			     " %llu %d 0 0 0 0 0 0\n",i,
+			     1234567890123ULL + i,98765 + i,
+			     9876543210ULL + i,54321 + i);
+		if (len + n + 1 > lnx->bufsiz) {
+			lnx->bufsiz *= 2;
+			lnx->buf = realloc(lnx->buf,lnx->bufsiz);
+			assert(lnx->buf);
+		}
+		memcpy(&lnx->buf[len],line,n + 1);
+		len += n;
+	}
+	grow_ifstats(lnx,BENCH_NIFS);
+	scan_net_dev(lnx,lnx->buf,len);		/* warm up */
+	t0 = bench_nsecs();
+	for (i = 0; i < iters; i++)
+		scan_net_dev(lnx,lnx->buf,len);
+	bench_report("netdev scan",iters,BENCH_NIFS,bench_nsecs() - t0);
+	t0 = bench_nsecs();
+	for (i = 0; i < iters; i++) {
+		char *p = next_line(next_line(lnx->buf,lnx->buf + len),
+				    lnx->buf + len);
+
+		for (j = 0; j < BENCH_NIFS; j++) {
+			char name[IFNAMSIZ];
+			unsigned long long f[NETDEV_NFIELDS];
+			int used = 0;
+
+			if (sscanf(p," %15[^:]: %llu %llu %llu %llu %llu %llu"
+				   " %llu %llu %llu %llu %llu %llu %llu %llu"
+				   " %llu %llu%n",name,&f[0],&f[1],&f[2],&f[3],
+				   &f[4],&f[5],&f[6],&f[7],&f[8],&f[9],&f[10],
+				   &f[11],&f[12],&f[13],&f[14],&f[15],&used) <
+			    17)
+				break;
+			sum += f[0];
+			p = next_line(p + used,lnx->buf + len);
+		}
+	}
+	bench_report("netdev sscanf",iters,BENCH_NIFS,bench_nsecs() - t0);
+	if (!sum)
+		printf("(sscanf found nothing?)\n");
+}
+
+static void
+bench_meminfo(struct linux_data *lnx, int iters)
+{
+	struct meminfo mi;
+	unsigned long long t0;
+	ssize_t len;
+	int i;
+
+	if ((len = reread(lnx,lnx->meminfo_fd)) < 0) {
+		perror(PROC_MEMINFO);
+		return;
+	}
+	t0 = bench_nsecs();
+	for (i = 0; i < iters; i++)
+		scan_meminfo(lnx->buf,len,&mi);
+	bench_report("meminfo scan",iters,1,bench_nsecs() - t0);
+	t0 = bench_nsecs();
+	for (i = 0; i < iters; i++)
+		(void) reread(lnx,lnx->meminfo_fd);
+	bench_report("meminfo pread",iters,1,bench_nsecs() - t0);
+}
+
+static void
+bench_netlink(struct osdhud_state *state, struct linux_data *lnx, int iters)
+{
+	unsigned long long t0;
+	int i;
+
+	if (lnx->nl_fd < 0) {
+		printf("no netlink socket\n");
+		return;
+	}
+	nl_resync(state,lnx);
+	if (!nl_watched(state,lnx)) {
+		printf("no interface to watch\n");
+		return;
+	}
+	printf("watching %s (ifindex %d)\n",state->net_iface,lnx->nl_ifindex);
+	t0 = bench_nsecs();
+	for (i = 0; i < iters; i++)
+		probe_net_netlink(state,lnx);
+	bench_report("netlink tick",iters,1,bench_nsecs() - t0);
+	t0 = bench_nsecs();
+	for (i = 0; i < iters; i++)
+		(void) nl_getlink(state,lnx,0);
+	bench_report("netlink dump",iters,1,bench_nsecs() - t0);
+	t0 = bench_nsecs();
+	for (i = 0; i < iters; i++)
+		probe_net_procfs(state,lnx);
+	bench_report("procfs",iters,1,bench_nsecs() - t0);
+}
+
+int
+probe_benchmark(struct osdhud_state *state, char *name, int iters)
+{
+	struct linux_data *lnx;
+	int found = 1;
+
+	probe_init(state);
+	lnx = (struct linux_data *)state->per_os_data;
+	if (!strcmp(name,"netdev"))
+		bench_net_dev(lnx,iters);
+	else if (!strcmp(name,"meminfo"))
+		bench_meminfo(lnx,iters);
+	else if (!strcmp(name,"netlink"))
+		bench_netlink(state,lnx,iters);
+	else
+		found = 0;
+	probe_cleanup(state);
+	return found ? 0 : -1;
+}
+
+#if defined(__GLIBC__) && defined(OSDHUD_COUNT_ALLOCS)
+/*
+ * In a benchmark build (make COUNT_ALLOCS=1), count allocations for
+ * -B frame by standing in front of the whole malloc(3) family and
+ * passing each call on to glibc's own, so every block still comes
+ * from and goes back to the one allocator.  Never in a normal build.
+ */
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void __libc_free(void *);
+extern void *__libc_memalign(size_t, size_t);
+extern void *__libc_valloc(size_t);
+extern void *__libc_pvalloc(size_t);
+
+static long long nallocs;
+
+#define count_alloc() __atomic_add_fetch(&nallocs,1,__ATOMIC_RELAXED)
+
+void *
+malloc(size_t size)
+{
+	count_alloc();
+	return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+	count_alloc();
+	return __libc_calloc(nmemb,size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+	count_alloc();
+	return __libc_realloc(ptr,size);
+}
+
+void
+free(void *ptr)
+{
+	__libc_free(ptr);
+}
+
+void *
+memalign(size_t align, size_t size)
+{
+	count_alloc();
+	return __libc_memalign(align,size);
+}
+
+void *
+aligned_alloc(size_t align, size_t size)
+{
+	count_alloc();
+	return __libc_memalign(align,size);
+}
+
+int
+posix_memalign(void **ptrp, size_t align, size_t size)
+{
+	void *p;
+
+	if (!align || (align % sizeof(void *)) || (align & (align - 1)))
+		return EINVAL;
+	count_alloc();
+	p = __libc_memalign(align,size);
+	if (!p)
+		return ENOMEM;
+	*ptrp = p;
+	return 0;
+}
+
+void *
+valloc(size_t size)
+{
+	count_alloc();
+	return __libc_valloc(size);
+}
+
+void *
+pvalloc(size_t size)
+{
+	count_alloc();
+	return __libc_pvalloc(size);
+}
+
+long long
+probe_allocs(void)
+{
+	return __atomic_load_n(&nallocs,__ATOMIC_RELAXED);
+}
+#else
+long long
+probe_allocs(void)
+{
+	return -1;			/* not a COUNT_ALLOCS build */
+}
+#endif
+
+/*
+ * Local variables:
+ * mode: c
+ * c-file-style: "bsd"
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ */
@@ -20,8 +20,10 @@
  * Maintain moving averages.
  */
 
+#include <sys/types.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 #include "movavg.h"
 
 /*
@@ -104,6 +106,466 @@ movavg_val(struct movavg *ma)
 	return (ma && ma->count) ? (ma->sum / ma->count) : 0;
 }
 
+/*
+ * Sliding-window minima and maxima
+ */
+
+#define MINMAX_CAP (MINMAX_SLOTS + 2)	/* one entry per bucket, at most */
+
+static void
+deque_init(struct minmax_deque *dq)
+{
+	dq->val = calloc(MINMAX_CAP,sizeof(float));
+	dq->t = calloc(MINMAX_CAP,sizeof(unsigned long));
+	assert(dq->val && dq->t);
+	dq->head = dq->n = 0;
+}
+
+#define dq_at(dq,i) (((dq)->head + (i)) % MINMAX_CAP)
+
+/*
+ * Drop entries that have slid out of the window
+ */
+static void
+deque_expire(struct minmax_deque *dq, unsigned long now, unsigned long span)
+{
+	while (dq->n && (now - dq->t[dq->head] >= span)) {
+		dq->head = (dq->head + 1) % MINMAX_CAP;
+		dq->n--;
+	}
+}
+
+/*
+ * Queue val at time now, first dropping the entries it dominates:
+ * those not above it for the max deque (sign 1), not below it for the
+ * min deque (sign -1).  What is left at the tail beats val, and if it
+ * is in the same bucket val is not needed.
+ */
+static void
+deque_push(struct minmax_deque *dq, unsigned long now, float val,
+	   unsigned long bucket, int sign)
+{
+	int tail;
+
+	while (dq->n) {
+		tail = dq_at(dq,dq->n - 1);
+		if (sign * (dq->val[tail] - val) > 0)
+			break;
+		dq->n--;
+	}
+	if (dq->n) {
+		tail = dq_at(dq,dq->n - 1);
+		if (dq->t[tail] / bucket == now / bucket)
+			return;
+	}
+	if (dq->n == MINMAX_CAP) {	/* clock went backwards; cope */
+		dq->head = (dq->head + 1) % MINMAX_CAP;
+		dq->n--;
+	}
+	tail = dq_at(dq,dq->n);
+	dq->val[tail] = val;
+	dq->t[tail] = now;
+	dq->n++;
+}
+
+#undef dq_at
+
+/*
+ * Allocate a min/max tracker over the last span milliseconds
+ */
+struct minmax *
+minmax_new(unsigned long span)
+{
+	struct minmax *mm = malloc(sizeof(*mm));
+
+	assert(mm);
+	mm->span = span;
+	mm->bucket = span / MINMAX_SLOTS;
+	if (!mm->bucket)
+		mm->bucket = 1;
+	deque_init(&mm->max);
+	deque_init(&mm->min);
+	return mm;
+}
+
+/*
+ * Tear down a min/max tracker
+ */
+void
+minmax_free(struct minmax *mm)
+{
+	if (mm) {
+		free(mm->max.val);
+		free(mm->max.t);
+		free(mm->min.val);
+		free(mm->min.t);
+	}
+	free(mm);
+}
+
+/*
+ * Forget everything a min/max tracker has seen
+ */
+void
+minmax_clear(struct minmax *mm)
+{
+	if (mm)
+		mm->max.n = mm->min.n = 0;
+}
+
+/*
+ * Add a value seen at time now (milliseconds).  Amortized O(1): every
+ * value is queued and dequeued at most once.
+ */
+void
+minmax_add(struct minmax *mm, unsigned long now, float val)
+{
+	if (!mm)
+		return;
+	deque_expire(&mm->max,now,mm->span);
+	deque_expire(&mm->min,now,mm->span);
+	deque_push(&mm->max,now,val,mm->bucket,1);
+	deque_push(&mm->min,now,val,mm->bucket,-1);
+}
+
+/*
+ * Largest value seen in the span before now, or 0 if nothing was
+ */
+float
+minmax_max(struct minmax *mm, unsigned long now)
+{
+	if (!mm)
+		return 0;
+	deque_expire(&mm->max,now,mm->span);
+	return mm->max.n ? mm->max.val[mm->max.head] : 0;
+}
+
+/*
+ * Smallest value seen in the span before now, or 0 if nothing was
+ */
+float
+minmax_min(struct minmax *mm, unsigned long now)
+{
+	if (!mm)
+		return 0;
+	deque_expire(&mm->min,now,mm->span);
+	return mm->min.n ? mm->min.val[mm->min.head] : 0;
+}
+
+#undef MINMAX_CAP
+
+/*
+ * Moving average sets
+ */
+
+#define ALIGN_FLOATS (MOVAVG_ALIGN / sizeof(float))
+
+static float *
+aligned_floats(int n)
+{
+	void *p = NULL;
+
+	if (posix_memalign(&p,MOVAVG_ALIGN,n * sizeof(float)))
+		p = NULL;
+	assert(p);
+	memset(p,0,n * sizeof(float));
+	return (float *)p;
+}
+
+static int
+stride_for(int nseries)
+{
+	return (nseries + ALIGN_FLOATS - 1) & ~(ALIGN_FLOATS - 1);
+}
+
+/*
+ * Allocate a set of nseries moving averages over wsize values each
+ */
+struct movavg_set *
+movavg_set_new(int nseries, int wsize)
+{
+	struct movavg_set *set;
+
+	assert((wsize > 0) && (wsize <= MAX_WSIZE));
+	set = malloc(sizeof(*set));
+	assert(set);
+	set->window_size = wsize;
+	set->nseries = nseries;
+	set->stride = stride_for(nseries);
+	set->off = 0;
+	set->window = aligned_floats(wsize * set->stride);
+	set->sum = aligned_floats(set->stride);
+	set->val = aligned_floats(set->stride);
+	set->msecs = calloc(wsize,sizeof(unsigned long));
+	assert(set->msecs);
+	set->sum_msecs = 0;
+	return set;
+}
+
+/*
+ * Tear down a moving average set
+ */
+void
+movavg_set_free(struct movavg_set *set)
+{
+	if (set) {
+		free(set->window);
+		free(set->sum);
+		free(set->val);
+		free(set->msecs);
+	}
+	free(set);
+}
+
+static float *
+resize_floats(float *old, int oldn, int newn)
+{
+	float *p = aligned_floats(newn);
+
+	memcpy(p,old,(oldn < newn ? oldn : newn) * sizeof(float));
+	free(old);
+	return p;
+}
+
+/*
+ * Change the number of series in a set.  Existing series keep their
+ * history; new ones start out empty.
+ */
+void
+movavg_set_resize(struct movavg_set *set, int nseries)
+{
+	int stride = stride_for(nseries);
+	int keep = (nseries < set->nseries) ? nseries : set->nseries;
+
+	if (stride != set->stride) {
+		float *window = aligned_floats(set->window_size * stride);
+		int i;
+
+		for (i = 0; i < set->window_size; i++)
+			memcpy(&window[i * stride],&set->window[i * set->stride],
+			       keep * sizeof(float));
+		free(set->window);
+		set->window = window;
+		set->sum = resize_floats(set->sum,keep,stride);
+		set->val = resize_floats(set->val,keep,stride);
+		set->stride = stride;
+	}
+	set->nseries = nseries;
+}
+
+/*
+ * Reset one series of a set to its initial state.  The window's time
+ * is shared, so the series reads low until it has been fed for a
+ * whole window.
+ */
+void
+movavg_set_clear(struct movavg_set *set, int series)
+{
+	int i;
+
+	assert((series >= 0) && (series < set->nseries));
+	for (i = 0; i < set->window_size; i++)
+		set->window[i * set->stride + series] = 0;
+	set->sum[series] = set->val[series] = 0;
+}
+
+/*
+ * Add one new row of deltas, counted over msecs milliseconds, to the
+ * set; deltas[] must hold nseries values.  A series that was cleared
+ * has zeroes in its window, so the value dropped off the end can be
+ * subtracted unconditionally and the loop has no branches.
+ */
+void
+movavg_set_add(struct movavg_set *set, const float *deltas,
+	       unsigned long msecs)
+{
+	float *row, *sum, *val;
+	float per_sec;
+	int i, n;
+
+	if (!set)
+		return;
+	set->sum_msecs += msecs - set->msecs[set->off];
+	set->msecs[set->off] = msecs;
+	per_sec = set->sum_msecs ? 1000.0 / set->sum_msecs : 0;
+	row = &set->window[set->off * set->stride];
+	sum = set->sum;
+	val = set->val;
+	n = set->nseries;
+	for (i = 0; i < n; i++) {
+		sum[i] += deltas[i] - row[i];
+		row[i] = deltas[i];
+		val[i] = sum[i] * per_sec;
+	}
+	if (++set->off == set->window_size)
+		set->off = 0;
+}
+
+/*
+ * Return the current rate per second of one series in a set
+ */
+float
+movavg_set_val(struct movavg_set *set, int series)
+{
+	return (set && (series < set->nseries)) ? set->val[series] : 0;
+}
+
+#undef ALIGN_FLOATS
+
+/*
+ * Integer rate averages
+ */
+
+/*
+ * Allocate nseries integer rate averages over wsize samples each
+ */
+struct rateavg_set *
+rateavg_set_new(int nseries, int wsize)
+{
+	struct rateavg_set *set;
+
+	assert((wsize > 0) && (wsize <= MAX_WSIZE));
+	set = calloc(1,sizeof(*set));
+	assert(set);
+	set->window_size = wsize;
+	rateavg_set_resize(set,nseries);
+	return set;
+}
+
+/*
+ * Tear down an integer rate average set
+ */
+void
+rateavg_set_free(struct rateavg_set *set)
+{
+	if (set) {
+		free(set->deltas);
+		free(set->msecs);
+		free(set->sum);
+		free(set->sum_msecs);
+		free(set->off);
+		free(set->count);
+	}
+	free(set);
+}
+
+/*
+ * Change the number of series in a set.  Existing series keep their
+ * history; new ones start out empty.
+ */
+void
+rateavg_set_resize(struct rateavg_set *set, int nseries)
+{
+	int wsize = set->window_size;
+	int i;
+
+#define grow_array(aa,nn) do {						\
+		void *_p = realloc(aa,(nn) * sizeof(*(aa)));		\
+		assert(_p || ((nn) == 0));				\
+		aa = _p;						\
+	} while (0)
+	grow_array(set->deltas,nseries * wsize);
+	grow_array(set->msecs,nseries * wsize);
+	grow_array(set->sum,nseries);
+	grow_array(set->sum_msecs,nseries);
+	grow_array(set->off,nseries);
+	grow_array(set->count,nseries);
+#undef grow_array
+	for (i = set->nseries; i < nseries; i++) {
+		set->nseries = i + 1;
+		rateavg_set_clear(set,i);
+	}
+	set->nseries = nseries;
+}
+
+/*
+ * Reset one series of a set to its initial state
+ */
+void
+rateavg_set_clear(struct rateavg_set *set, int series)
+{
+	assert((series >= 0) && (series < set->nseries));
+	memset(&set->deltas[series * set->window_size],0,
+	       set->window_size * sizeof(u_int64_t));
+	memset(&set->msecs[series * set->window_size],0,
+	       set->window_size * sizeof(unsigned long));
+	set->sum[series] = set->sum_msecs[series] = 0;
+	set->off[series] = set->count[series] = 0;
+}
+
+/*
+ * Add delta units counted over msecs milliseconds to one series.  The
+ * sums are kept exactly by subtracting the sample that falls out of
+ * the window.
+ */
+void
+rateavg_set_add(struct rateavg_set *set, int series, u_int64_t delta,
+		unsigned long msecs)
+{
+	int base, off;
+
+	if (!set || !msecs)
+		return;
+	assert((series >= 0) && (series < set->nseries));
+	base = series * set->window_size;
+	off = set->off[series];
+	if (set->count[series] < set->window_size)
+		set->count[series]++;
+	else {
+		set->sum[series] -= set->deltas[base + off];
+		set->sum_msecs[series] -= set->msecs[base + off];
+	}
+	set->deltas[base + off] = delta;
+	set->msecs[base + off] = msecs;
+	set->sum[series] += delta;
+	set->sum_msecs[series] += msecs;
+	if (++off == set->window_size)
+		off = 0;
+	set->off[series] = off;
+}
+
+/*
+ * Return the rate of one series over its window in units per second,
+ * scaled by RATEAVG_ONE.  The quotient and remainder are scaled
+ * separately so that a long window at line rate cannot overflow.
+ */
+u_int64_t
+rateavg_set_val(struct rateavg_set *set, int series)
+{
+	u_int64_t sum, ms;
+
+	if (!set || (series >= set->nseries) || !set->sum_msecs[series])
+		return 0;
+	sum = set->sum[series];
+	ms = set->sum_msecs[series];
+	return ((sum / ms) * 1000 << RATEAVG_SHIFT) +
+		((sum % ms) * 1000 << RATEAVG_SHIFT) / ms;
+}
+
+/*
+ * Work out how far a counter moved from then to now.  A counter that
+ * went backwards from a value that fits in 32 bits is taken to have
+ * wrapped at 2^32, as 32-bit kernels' counters do, if the result is
+ * less than half the counter range; anything else that goes backwards
+ * was reset (interface recreated, driver reloaded) and the sample
+ * should be dropped.
+ */
+int
+rateavg_delta(u_int64_t now, u_int64_t then, u_int64_t *deltap)
+{
+	if (now >= then) {
+		*deltap = now - then;
+		return RATEAVG_OK;
+	}
+	if ((then <= 0xffffffffULL) &&
+	    ((0x100000000ULL - then) + now < 0x80000000ULL)) {
+		*deltap = (0x100000000ULL - then) + now;
+		return RATEAVG_WRAP32;
+	}
+	*deltap = 0;
+	return RATEAVG_RESET;
+}
+
 /*
  * Local variables:
  * mode: c
@@ -29,6 +29,78 @@ struct movavg {
 
 #define MAX_WSIZE 10000	       /* max size of moving average window */
 
+/*
+ * A set of moving rates that share a window size and are all fed at
+ * once.  Each update is a row of deltas, one per series, plus the
+ * milliseconds they were counted over; a series' value is the sum of
+ * its deltas divided by the time the window covers.  The windows are
+ * kept as one block of window_size rows, so an update is a single
+ * pass over contiguous floats.  Every per-series array is padded to a
+ * multiple of MOVAVG_ALIGN bytes.
+ */
+struct movavg_set {
+	float	*window;		/* window_size rows of stride floats */
+	float	*sum;			/* per series sum of the window */
+	float	*val;			/* per series current rate, per sec */
+	unsigned long *msecs;		/* interval of each row */
+	unsigned long sum_msecs;	/* time covered by the window */
+	int	 nseries;		/* #of averages in the set */
+	int	 stride;		/* nseries rounded up for alignment */
+	int	 off;			/* row the next update goes in */
+	int	 window_size;
+};
+
+#define MOVAVG_ALIGN 32		       /* bytes; enough for AVX */
+
+/*
+ * Integer moving rates.  Each series has its own window of (delta,
+ * milliseconds) samples and keeps exact u64 sums of both, so nothing
+ * drifts no matter how long we run, and the rate is the true one over
+ * the time the window covers however unevenly it was sampled.  Rates
+ * come out in fixed point (units per second << RATEAVG_SHIFT).  Series
+ * are fed independently, so each keeps its own offset/count.
+ */
+struct rateavg_set {
+	u_int64_t *deltas;		/* nseries windows of window_size */
+	unsigned long *msecs;		/* ditto, interval of each delta */
+	u_int64_t *sum;			/* per series sum of its deltas */
+	u_int64_t *sum_msecs;		/* per series sum of its msecs */
+	int	  *off;			/* per series write offset */
+	int	  *count;		/* per series #of valid entries */
+	int	   nseries;
+	int	   window_size;
+};
+
+#define RATEAVG_SHIFT 8		       /* fractional bits in a rate */
+#define RATEAVG_ONE (1 << RATEAVG_SHIFT)
+
+#define RATEAVG_OK	0		/* rateavg_delta() results */
+#define RATEAVG_WRAP32	1		/* a 32-bit counter wrapped */
+#define RATEAVG_RESET	2		/* counter went backwards */
+
+/*
+ * Sliding-window minimum and maximum over the last span milliseconds,
+ * kept as two monotonic deques of (time, value).  The window is cut
+ * into MINMAX_SLOTS buckets and a sample that is not a new extreme
+ * for its bucket is not queued, so each deque holds at most one entry
+ * per bucket and memory is fixed whatever the sampling rate.
+ */
+struct minmax_deque {
+	float		*val;
+	unsigned long	*t;
+	int		 head;		/* index of the oldest entry */
+	int		 n;		/* #of entries */
+};
+
+struct minmax {
+	unsigned long	 span;		/* msecs covered by the window */
+	unsigned long	 bucket;	/* span / MINMAX_SLOTS */
+	struct minmax_deque max;	/* values decreasing from head */
+	struct minmax_deque min;	/* values increasing from head */
+};
+
+#define MINMAX_SLOTS 120	       /* buckets per window */
+
 /*
  * API
  */
@@ -38,6 +110,28 @@ void movavg_clear(struct movavg *);
 float movavg_add(struct movavg *, float);
 float movavg_val(struct movavg *);
 
+struct movavg_set *movavg_set_new(int, int);
+void movavg_set_free(struct movavg_set *);
+void movavg_set_resize(struct movavg_set *, int);
+void movavg_set_clear(struct movavg_set *, int);
+void movavg_set_add(struct movavg_set *, const float *, unsigned long);
+float movavg_set_val(struct movavg_set *, int);
+
+struct minmax *minmax_new(unsigned long);
+void minmax_free(struct minmax *);
+void minmax_clear(struct minmax *);
+void minmax_add(struct minmax *, unsigned long, float);
+float minmax_max(struct minmax *, unsigned long);
+float minmax_min(struct minmax *, unsigned long);
+
+struct rateavg_set *rateavg_set_new(int, int);
+void rateavg_set_free(struct rateavg_set *);
+void rateavg_set_resize(struct rateavg_set *, int);
+void rateavg_set_clear(struct rateavg_set *, int);
+void rateavg_set_add(struct rateavg_set *, int, u_int64_t, unsigned long);
+u_int64_t rateavg_set_val(struct rateavg_set *, int);
+int rateavg_delta(u_int64_t, u_int64_t, u_int64_t *);
+
 /*
  * Local variables:
  * mode: c
@@ -102,6 +102,8 @@
 #include <xosd.h>
 #include <Judy.h>
 #include "movavg.h"
+#include "iftable.h"
+#include "hud.h"
 #include "osdhud.h"
 
 #define APM_DEV "/dev/apm"
@@ -586,10 +588,7 @@ probe_net(struct osdhud_state *state)
 	struct sockaddr_dl *sdl;
 	int num_ifs = 0;
 	struct ifstat *ifs;
-	unsigned long tot_delta_in_b = 0;
-	unsigned long tot_delta_out_b = 0;
-	unsigned long tot_delta_in_p = 0;
-	unsigned long tot_delta_out_p = 0;
+	struct ifcounters counters;
 	int interest;
 
 	/*
@@ -697,38 +696,31 @@ probe_net(struct osdhud_state *state)
 			}
 		}
 		/* after all is said and done, are we interested? */
-		if (interest) {
-#define delta_x(nn) ifi_x(nn) - state->net_tot_##nn
-			unsigned long delta_in_b = delta_x(ibytes);
-			unsigned long delta_out_b = delta_x(obytes);
-			unsigned long delta_in_p = delta_x(ipackets);
-			unsigned long delta_out_p = delta_x(opackets);
-#undef delta_x
-			if (!state->net_speed_mbits) {
-				VSPEW("%s net_speed_mbits = %d",
-				      ifs->ifs_name,ifs->ifs_speed);
-				state->net_speed_mbits = ifs->ifs_speed;
-			}
-			tot_delta_in_b += delta_in_b;
-			tot_delta_out_b += delta_out_b;
-			tot_delta_in_p += delta_in_p;
-			tot_delta_out_p += delta_out_p;
-			state->net_tot_ibytes = ifi_x(ibytes);
-			state->net_tot_obytes = ifi_x(obytes);
-			state->net_tot_ipackets = ifi_x(ipackets);
-			state->net_tot_opackets = ifi_x(opackets);
+		if (interest && !state->net_speed_mbits) {
+			VSPEW("%s net_speed_mbits = %d",
+			      ifs->ifs_name,ifs->ifs_speed);
+			state->net_speed_mbits = ifs->ifs_speed;
 		}
+		/* every interface is reported, for -I and warm averages */
+		counters.ibytes = ifi_x(ibytes);
+		counters.obytes = ifi_x(obytes);
+		counters.ipackets = ifi_x(ipackets);
+		counters.opackets = ifi_x(opackets);
+		counters.ierrs = ifi_x(ierrors);
+		counters.oerrs = ifi_x(oerrors);
+		update_net_statistics(state,ifm.ifm_index,ifs->ifs_name,
+				      &counters,interest);
 #undef ifi_x
 	}
-	update_net_statistics(state,tot_delta_in_b,tot_delta_out_b,
-			      tot_delta_in_p,tot_delta_out_p);
 	/* remove unreferenced interfaces */
 	for (i = 0; i < nifs; i++) {
 		ifs = &ifstats[i];
 		if (ifs->ifs_flag)
 			ifs->ifs_flag = 0;
-		else
+		else if (ifs->ifs_name[0]) {
 			ifs->ifs_name[0] = '\0';
+			forget_net_interface(state,i);
+		}
 	}
 	free(buf);
 	os_data->ifstats = ifstats;
@@ -909,6 +901,18 @@ probe_temperature(struct osdhud_state *state)
 	state->temperature = obsd->temp_sensor->val;
 }
 
+int
+probe_benchmark(struct osdhud_state *state, char *name, int iters)
+{
+	return -1;			/* none yet */
+}
+
+long long
+probe_allocs(void)
+{
+	return -1;			/* not counted */
+}
+
 void
 probe_uptime(struct osdhud_state *state)
 {
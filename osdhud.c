@@ -23,12 +23,20 @@
 #include <assert.h>
 #include <errno.h>
 #include <limits.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
-#include <sys/stdint.h>
+#ifdef __linux__
+# include <stdint.h>
+# include <sys/epoll.h>
+# include <sys/signalfd.h>
+# include <sys/timerfd.h>
+#else
+# include <sys/stdint.h>
+#endif
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
@@ -42,17 +50,30 @@
 #include <sys/socket.h>
 #include <net/if.h>
 #include <sys/un.h>
-#include <xosd.h>
 #include <Judy.h>
 #include <err.h>
 #include "config.h"
 #include "version.h"
 #include "movavg.h"
+#include "iftable.h"
+#include "rollup.h"
+#include "tsz.h"
+#include "histfile.h"
+#include "flightrec.h"
+#include "subscriber.h"
+#include "shmpage.h"
+#include "ctlmsg.h"
+#include "hud.h"
 #include "osdhud.h"
 
 volatile sig_atomic_t interrupted = 0;	/* got a SIGINT */
 volatile sig_atomic_t restart_req = 0;	/* got a SIGHUP */
 #ifdef SIGINFO
+# define INFO_SIGNAL SIGINFO
+#elif defined(HAVE_EPOLL)
+# define INFO_SIGNAL SIGUSR1		/* Linux has no SIGINFO */
+#endif
+#ifdef INFO_SIGNAL
 volatile sig_atomic_t bang_bang = 0;	/* got a SIGINFO */
 #endif
 
@@ -81,51 +102,110 @@ die(struct osdhud_state *state, char *msg)
 	exit(1);
 }
 
+/*
+ * Called by the per-OS probe_net() for every interface it sees
+ */
 void
-update_net_statistics(struct osdhud_state *state, u_int64_t delta_ibytes,
-		      u_int64_t delta_obytes, u_int64_t delta_ipackets,
-		      u_int64_t delta_opackets)
+update_net_statistics(struct osdhud_state *state, int ifindex, char *name,
+		      struct ifcounters *counters, int watched)
 {
-	if (state->delta_t) {
-		float dt = (float)state->delta_t / 1000.0;
+	struct iftable *tbl = state->ifs;
+	u_int64_t nresets = tbl->nresets, nwraps = tbl->nwraps;
+	int i = iftable_update(tbl,ifindex,name,counters,watched,state->mono_t);
+
+	if (tbl->nresets != nresets)
+		VSPEW("net %s counters were reset, sample dropped",name);
+	if (tbl->nwraps != nwraps)
+		VSPEW("net %s 32-bit counters wrapped",name);
+	DSPEW("net #%d %s%s in %.2f kB/s %.2f px/s out %.2f kB/s %.2f px/s",
+	      i,name,watched ? " (watched)" : "",
+	      iftable_rate(tbl,i,IFT_IKBPS),iftable_rate(tbl,i,IFT_IPXPS),
+	      iftable_rate(tbl,i,IFT_OKBPS),iftable_rate(tbl,i,IFT_OPXPS));
+}
 
-		state->net_ikbps =
-			(movavg_add(state->ikbps_ma,delta_ibytes) / dt)/KILO;
-		state->net_okbps =
-			(movavg_add(state->okbps_ma,delta_obytes) / dt)/KILO;
-		state->net_ipxps =
-			movavg_add(state->ipxps_ma,delta_ipackets) / dt;
-		state->net_opxps =
-			movavg_add(state->opxps_ma,delta_opackets) / dt;
+/*
+ * Called by the per-OS module when an interface goes away
+ */
+void
+forget_net_interface(struct osdhud_state *state, int ifindex)
+{
+	iftable_remove(state->ifs,ifindex);
+}
 
-		DSPEW("net %s bytes in  += %llu -> %.2f / %f secs => %.2f",
-		      state->net_iface,delta_ibytes,movavg_val(state->ikbps_ma),
-		      dt,state->net_ikbps);
-		DSPEW("net %s bytes out += %llu -> %.2f / %f secs => %.2f",
-		      state->net_iface,delta_obytes,movavg_val(state->okbps_ma),
-		      dt,state->net_okbps);
-		DSPEW("net %s packets   in  += %llu -> %.2f / %f secs => %.2f",
-		      state->net_iface,delta_ipackets,
-		      movavg_val(state->ipxps_ma),dt,state->net_ipxps);
-		DSPEW("net %s packets   out += %llu -> %.2f / %f secs => %.2f",
-		      state->net_iface,delta_opackets,
-		      movavg_val(state->opxps_ma),dt,state->net_opxps);
+/*
+ * Is the interface at ifindex the one -i selects?  Once it has been
+ * reported the iftable remembers its slot; only before that do we
+ * have to compare names.
+ */
+int
+net_watched(struct osdhud_state *state, int ifindex, const char *name)
+{
+	int slot;
 
+	if (!state->net_iface)
+		return 0;
+	if ((slot = iftable_watch(state->ifs,state->net_iface)) >= 0)
+		return ifindex == slot;
+	return !strcmp(name,state->net_iface);
+}
+
+/*
+ * Sum the rates and counters of the watched interfaces into the
+ * numbers we display
+ */
+void
+sum_net_statistics(struct osdhud_state *state)
+{
+	struct iftable *tbl = state->ifs;
+	int i;
+
+	state->net_ikbps = state->net_ipxps =
+		state->net_okbps = state->net_opxps = 0;
+	state->net_tot_ibytes = state->net_tot_obytes =
+		state->net_tot_ipackets = state->net_tot_opackets =
+		state->net_tot_ierr = state->net_tot_oerr = 0;
+	for (i = 0; i < tbl->nslots; i++) {
+		if (!tbl->watched[i])
+			continue;
+		state->net_ikbps += iftable_rate(tbl,i,IFT_IKBPS);
+		state->net_okbps += iftable_rate(tbl,i,IFT_OKBPS);
+		state->net_ipxps += iftable_rate(tbl,i,IFT_IPXPS);
+		state->net_opxps += iftable_rate(tbl,i,IFT_OPXPS);
+		state->net_tot_ibytes += tbl->cur[i].ibytes;
+		state->net_tot_obytes += tbl->cur[i].obytes;
+		state->net_tot_ipackets += tbl->cur[i].ipackets;
+		state->net_tot_opackets += tbl->cur[i].opackets;
+		state->net_tot_ierr += tbl->cur[i].ierrs;
+		state->net_tot_oerr += tbl->cur[i].oerrs;
 	}
 }
 
+/*
+ * The watched interfaces changed.  Every interface keeps its own
+ * averages so there is nothing to throw away except the peaks and
+ * history, which belonged to the old selection.
+ */
 void
 clear_net_statistics(struct osdhud_state *state)
 {
+	int i;
+
 	state->net_ikbps = state->net_ipxps =
 		state->net_okbps = state->net_opxps = 0;
 	state->net_tot_ibytes = state->net_tot_obytes =
 		state->net_tot_ipackets = state->net_tot_opackets = 0;
-	state->net_peak_kbps = state->net_peak_pxps = 0;
-	movavg_clear(state->ikbps_ma);
-	movavg_clear(state->okbps_ma);
-	movavg_clear(state->ipxps_ma);
-	movavg_clear(state->opxps_ma);
+	for (i = 0; i < NPEAKS; i++) {
+		minmax_clear(state->peaks[METRIC_NET_KBPS][i]);
+		minmax_clear(state->peaks[METRIC_NET_PXPS][i]);
+	}
+	histfile_begin(state->hist);
+	rollup_clear(state->rollups[METRIC_NET_KBPS]);
+	rollup_clear(state->rollups[METRIC_NET_PXPS]);
+	histfile_end(state->hist);
+	tsz_clear(state->series[METRIC_NET_KBPS]);
+	tsz_clear(state->series[METRIC_NET_PXPS]);
+	if (state->ifs)
+		iftable_unwatch(state->ifs);
 }
 
 void
@@ -134,16 +214,17 @@ update_disk_statistics(struct osdhud_state *state, u_int64_t delta_rbytes,
 		       u_int64_t delta_writes)
 {
 	if (state->delta_t) {
-		float dt = (float)state->delta_t / 1000.0;
-
-		state->disk_rkbps =
-			(movavg_add(state->rbdisk_ma,delta_rbytes)/dt)/KILO;
-		state->disk_wkbps =
-			(movavg_add(state->wbdisk_ma,delta_wbytes)/dt)/KILO;
-		state->disk_rxps =
-			movavg_add(state->rxdisk_ma,delta_reads) / dt;
-		state->disk_wxps =
-			movavg_add(state->wxdisk_ma,delta_writes) / dt;
+		float deltas[4];
+
+		deltas[0] = delta_rbytes;
+		deltas[1] = delta_wbytes;
+		deltas[2] = delta_reads;
+		deltas[3] = delta_writes;
+		movavg_set_add(state->disk_ma,deltas,state->delta_t);
+		state->disk_rkbps = movavg_set_val(state->disk_ma,0) / KILO;
+		state->disk_wkbps = movavg_set_val(state->disk_ma,1) / KILO;
+		state->disk_rxps = movavg_set_val(state->disk_ma,2);
+		state->disk_wxps = movavg_set_val(state->disk_ma,3);
 	}
 }
 
@@ -167,6 +248,21 @@ time_in_milliseconds(void)
 	return usecs / 1000;
 }
 
+/*
+ * Milliseconds on a clock that nobody can set, for measuring intervals
+ */
+unsigned long
+monotonic_msecs(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC,&ts)) {
+		perror("clock_gettime");
+		exit(1);
+	}
+	return (ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
 /*
  * Turn a number of seconds elapsed into a human-readable string.
  * e.g. "10 days 1 hour 23 mins 2 secs".  We have an snprintf-style
@@ -231,247 +327,1398 @@ DONE:
 }
 
 /*
- * Probe data and gather statistics
- *
- * This function invokes probe_xxx() routines defined in the per-OS
- * modules, e.g. openbsd.c, freebsd.c
+ * Names of the METRIC_xxx for history queries
+ */
+static const char *metric_names[NMETRICS] = {
+	"load", "mem", "swap", "net_kbps", "net_pxps", "temp"
+};
+
+/*
+ * The current value of every METRIC_xxx
+ */
+void
+metric_values(struct osdhud_state *state, float *vals)
+{
+	vals[METRIC_LOAD] = state->load_avg;
+	vals[METRIC_MEM] = state->mem_used_percent;
+	vals[METRIC_SWAP] = state->swap_used_percent;
+	vals[METRIC_NET_KBPS] = state->net_ikbps + state->net_okbps;
+	vals[METRIC_NET_PXPS] = state->net_ipxps + state->net_opxps;
+	vals[METRIC_TEMP] = state->temperature;
+}
+
+/*
+ * Feed the latest probe results to the history we keep
+ */
+void
+record_metrics(struct osdhud_state *state)
+{
+	float vals[NMETRICS];
+	int m, w;
+
+	metric_values(state,vals);
+	histfile_begin(state->hist);
+	for (m = 0; m < NMETRICS; m++) {
+		float v = vals[m];
+
+		for (w = 0; w < NPEAKS; w++)
+			minmax_add(state->peaks[m][w],state->mono_t,v);
+		rollup_add(state->rollups[m],state->last_t,v);
+		/*
+		 * Net rates are only ever shown in whole units; the
+		 * fraction is noise that costs a dozen bits a sample
+		 */
+		if ((m == METRIC_NET_KBPS) || (m == METRIC_NET_PXPS))
+			v = (unsigned long)(v + 0.5);
+		tsz_add(state->series[m],state->last_t,v);
+	}
+	histfile_append(state->hist,state->last_t,vals);
+	histfile_end(state->hist);
+}
+
+/*
+ * Map the -R history file.  Its rollups are used in place; the recent
+ * samples it holds are fed to the peaks and series so that they are
+ * warm from the start.
+ */
+void
+open_history(struct osdhud_state *state)
+{
+	struct histfile *hf;
+	u_int64_t s, first, n = 0;
+	char errbuf[1024];
+	int m, w;
+
+	hf = histfile_open(state->hist_path,NMETRICS,errbuf,sizeof(errbuf));
+	if (!hf) {
+		syslog(LOG_WARNING,"history not kept: %s",errbuf);
+		return;
+	}
+	state->hist = hf;
+	for (m = 0; m < NMETRICS; m++)
+		state->rollups[m] = &hf->rollups[m];
+	first = (hf->hdr->seq > HISTFILE_NRECS) ?
+		hf->hdr->seq - HISTFILE_NRECS : 0;
+	for (s = first; s < hf->hdr->seq; s++) {
+		struct histfile_rec *rec = histfile_rec(hf,s);
+		u_int64_t age;
+
+		if (!rec || (rec->t > state->last_t))
+			continue;
+		/* the peaks run on the monotonic clock, records on the wall */
+		age = state->last_t - rec->t;
+		for (m = 0; m < NMETRICS; m++) {
+			float v = rec->vals[m];
+
+			for (w = 0; (age <= state->mono_t) && (w < NPEAKS); w++)
+				minmax_add(state->peaks[m][w],
+					   state->mono_t - age,v);
+			if ((m == METRIC_NET_KBPS) || (m == METRIC_NET_PXPS))
+				v = (unsigned long)(v + 0.5);
+			tsz_add(state->series[m],rec->t,v);
+		}
+		n++;
+	}
+	VSPEW("history %s: %s, %llu samples replayed%s",state->hist_path,
+	      hf->created ? "created" : "attached",(unsigned long long)n,
+	      hf->rebuilt ? ", rollups rebuilt" : "");
+}
+
+/*
+ * Which ALERT_xxx conditions hold right now
+ */
+u_int32_t
+alert_conditions(struct osdhud_state *state)
+{
+	u_int32_t alerts = 0;
+
+	if (!state->battery_missing &&
+	    (state->battery_life<state->min_battery_life))
+		alerts |= ALERT_BATTERY;
+	if (state->max_load_avg &&
+	    (ipercent(state->load_avg/state->max_load_avg)>40))
+		alerts |= ALERT_LOAD;
+	if (state->max_mem_used &&
+	    (state->mem_used_percent > state->max_mem_used))
+		alerts |= ALERT_MEM;
+	return alerts;
+}
+
+/*
+ * Feed the flight recorder and dump it if an alert just went off
+ */
+void
+record_flight(struct osdhud_state *state)
+{
+	u_int32_t alerts = alert_conditions(state);
+	struct flightrec_snap snap;
+	char path[1024];
+
+	if (state->fr) {
+		memset(&snap,0,sizeof(snap));
+		snap.t = state->last_t;
+		snap.load_avg = state->load_avg;
+		snap.mem_used = state->mem_used_percent;
+		snap.swap_used = state->swap_used_percent;
+		snap.net_ikbps = state->net_ikbps;
+		snap.net_okbps = state->net_okbps;
+		snap.net_ipxps = state->net_ipxps;
+		snap.net_opxps = state->net_opxps;
+		snap.temperature = state->temperature;
+		snap.battery_life = state->battery_missing ?
+			-1 : state->battery_life;
+		snap.battery_time = state->battery_time;
+		snap.alerts = alerts;
+		flightrec_add(state->fr,&snap);
+		if (alerts & ~state->alerts) {
+			if (flightrec_dump(state->fr,alerts,path,sizeof(path)))
+				syslog(LOG_WARNING,"flight recorder: %s",path);
+			else
+				VSPEW("alerts 0x%x: flight recorder -> %s",
+				      alerts,path);
+		}
+	}
+	state->alerts = alerts;
+}
+
+/*
+ * Put the latest probe results in the -O page
+ */
+void
+publish_page(struct osdhud_state *state)
+{
+	struct shmpage_data data;
+
+	if (!state->page)
+		return;
+	memset(&data,0,sizeof(data));
+	data.t = state->last_t;
+	data.nprobes = state->page->data.nprobes + 1;
+	data.net_ibytes = state->net_tot_ibytes;
+	data.net_obytes = state->net_tot_obytes;
+	data.load_avg = state->load_avg;
+	data.max_load_avg = state->max_load_avg;
+	data.mem_used = state->mem_used_percent;
+	data.swap_used = state->swap_used_percent;
+	data.net_ikbps = state->net_ikbps;
+	data.net_okbps = state->net_okbps;
+	data.net_ipxps = state->net_ipxps;
+	data.net_opxps = state->net_opxps;
+	data.temperature = state->temperature;
+	data.battery_life = state->battery_missing ? -1 : state->battery_life;
+	data.battery_time = state->battery_time;
+	data.uptime = (u_int32_t)state->sys_uptime;
+	data.alerts = state->alerts;
+	data.nswap = state->nswap;
+	data.net_speed_mbits = state->net_speed_mbits;
+	if (state->net_iface)
+		strlcpy(data.iface,state->net_iface,sizeof(data.iface));
+	strlcpy(data.battery_state,state->battery_state,
+		sizeof(data.battery_state));
+	if (state->temp_sensor_name)
+		strlcpy(data.temp_sensor,state->temp_sensor_name,
+			sizeof(data.temp_sensor));
+	shmpage_publish(state->page,&data);
+}
+
+/*
+ * Replace a malloc'd string in state if it has changed
+ */
+static void
+follow_str(char **strp, char *val)
+{
+	if (*strp && !strcmp(*strp,val))
+		return;
+	free(*strp);
+	*strp = val[0] ? strdup(val) : NULL;
+}
+
+/*
+ * Is the page we follow one that no collector will write again?  A
+ * collector that died never got to zero its pid, so we look for the
+ * process, and for a new page that a new collector put in its place.
+ */
+static int
+follow_stale(struct osdhud_state *state)
+{
+	struct stat st;
+	pid_t pid = state->follow->pid;
+
+	if (stat(state->follow_path,&st) || (st.st_dev != state->follow_dev) ||
+	    (st.st_ino != state->follow_ino))
+		return 1;
+	return pid && kill(pid,0) && (errno == ESRCH);
+}
+
+/*
+ * Take the probe results from the collector's page given to -c
+ * instead of probing ourselves.  If the collector has gone away we
+ * look for a new page every time we are called and keep showing the
+ * last results until one turns up.  Returns true if there are new
+ * results.
+ */
+int
+follow_page(struct osdhud_state *state)
+{
+	struct shmpage_data data;
+	struct stat st;
+	char errbuf[1024];
+	int r = -1;
+
+	if (state->follow) {
+		r = shmpage_read(state->follow,&data);
+		if (!r && (data.nprobes == state->follow_seen) &&
+		    (++state->follow_still >= FOLLOW_STALE_PROBES)) {
+			state->follow_still = 0;
+			r = follow_stale(state);
+		}
+	}
+	if (r) {
+		shmpage_detach(state->follow);
+		state->follow = shmpage_attach(state->follow_path,errbuf,
+					       sizeof(errbuf));
+		if (state->follow && !stat(state->follow_path,&st)) {
+			state->follow_dev = st.st_dev;
+			state->follow_ino = st.st_ino;
+			r = shmpage_read(state->follow,&data);
+			if (!r && follow_stale(state)) {
+				assert_strlcpy(errbuf,"collector died");
+				shmpage_detach(state->follow);
+				state->follow = NULL;
+				r = -1;
+			}
+		}
+		if (r) {
+			if (!state->follow_lost)
+				syslog(LOG_WARNING,"no collector: %s",
+				       state->follow ? "not publishing" :
+				       errbuf);
+			state->follow_lost = 1;
+			return 0;
+		}
+		if (state->follow_lost)
+			syslog(LOG_WARNING,"collector is back");
+		state->follow_lost = 0;
+	}
+	if (data.nprobes == state->follow_seen)
+		return 0;
+	state->follow_seen = data.nprobes;
+	state->follow_still = 0;
+	state->load_avg = data.load_avg;
+	state->max_load_avg = data.max_load_avg;
+	state->mem_used_percent = data.mem_used;
+	state->swap_used_percent = data.swap_used;
+	state->nswap = data.nswap;
+	state->net_ikbps = data.net_ikbps;
+	state->net_okbps = data.net_okbps;
+	state->net_ipxps = data.net_ipxps;
+	state->net_opxps = data.net_opxps;
+	state->net_tot_ibytes = data.net_ibytes;
+	state->net_tot_obytes = data.net_obytes;
+	if (!state->net_speed_fixed)
+		state->net_speed_mbits = data.net_speed_mbits;
+	state->temperature = data.temperature;
+	state->battery_missing = (data.battery_life < 0);
+	state->battery_life = state->battery_missing ? 0 : data.battery_life;
+	state->battery_time = data.battery_time;
+	state->sys_uptime = data.uptime;
+	data.iface[sizeof(data.iface) - 1] = 0;
+	data.battery_state[sizeof(data.battery_state) - 1] = 0;
+	data.temp_sensor[sizeof(data.temp_sensor) - 1] = 0;
+	strlcpy(state->battery_state,data.battery_state,
+		sizeof(state->battery_state));
+	follow_str(&state->net_iface,data.iface);
+	follow_str(&state->temp_sensor_name,data.temp_sensor);
+	return 1;
+}
+
+/*
+ * Parse a span of time like 90, 90s, 15m or 2h into seconds
+ */
+int
+parse_span(char *str, int *secsp)
+{
+	char unit = 's';
+	int n = sscanf(str,"%d%c",secsp,&unit);
+
+	if (n < 1)
+		return -1;
+	switch (unit) {
+	case 's':
+		break;
+	case 'm':
+		*secsp *= SECSPERMIN;
+		break;
+	case 'h':
+		*secsp *= SECSPERHOUR;
+		break;
+	default:
+		return -1;
+	}
+	if ((*secsp <= 0) || (*secsp > MAX_HISTORY_SECS))
+		return -1;
+	return 0;
+}
+
+/*
+ * The inverse of parse_span(), as short as possible
+ */
+void
+format_span(char *buf, size_t len, int secs)
+{
+	if (!(secs % SECSPERHOUR))
+		assert(snprintf(buf,len,"%dh",secs / SECSPERHOUR) < len);
+	else if (!(secs % SECSPERMIN))
+		assert(snprintf(buf,len,"%dm",secs / SECSPERMIN) < len);
+	else
+		assert(snprintf(buf,len,"%ds",secs) < len);
+}
+
+/*
+ * Summarize the full-resolution samples of a series between from and
+ * to the way rollup_query() would.  Returns 0, leaving the rollups to
+ * answer, if the series may be missing some of them: it has thrown
+ * some away, or older says there may be samples from before its first
+ * one (-R) and it starts after from.
+ */
+int
+series_query(struct tsz *ts, unsigned long from, unsigned long to,
+	     int older, struct rollup_stats *st)
+{
+	struct tsz_iter it;
+	unsigned long t;
+	double sum = 0;
+	float v;
+
+	if (!ts->head || (ts->dropped_t >= from) ||
+	    (older && (ts->head->t0 > from)))
+		return 0;
+	memset(st,0,sizeof(*st));
+	tsz_iter_init(&it,ts,from,to);
+	while (tsz_iter_next(&it,&t,&v)) {
+		if (!st->count || (v < st->min))
+			st->min = v;
+		if (!st->count || (v > st->max))
+			st->max = v;
+		sum += v;
+		st->count++;
+	}
+	if (st->count)
+		st->avg = sum / st->count;
+	return 1;
+}
+
+/*
+ * Answer a -Q query: one line per metric summarizing the last secs
+ * seconds, and one describing its full-resolution history, written
+ * back to the client.  Spans the series covers are read from it
+ * sample by sample; anything longer comes from the rollups.
+ */
+void
+reply_history(struct osdhud_state *state, int fd, int secs)
+{
+	char buf[2048], span[32];
+	unsigned long from = state->last_t - secs * 1000UL;
+	int m, off = 0, left = sizeof(buf);
+
+	memset(buf,0,sizeof(buf));
+	format_span(span,sizeof(span),secs);
+	for (m = 0; m < NMETRICS; m++) {
+		struct rollup_stats st;
+		char res[32];
+		int x;
+
+		if ((secs <= SERIES_SECS) &&
+		    series_query(state->series[m],from,state->last_t,
+				 state->hist != NULL,&st))
+			assert_strlcpy(res,"raw");
+		else {
+			rollup_query(state->rollups[m],state->last_t,
+				     secs * 1000UL,&st);
+			format_span(res,sizeof(res),
+				    rollup_res[st.level] / 1000);
+		}
+		x = snprintf(&buf[off],left,"%s %s avg %.2f min %.2f max %.2f"
+			     " samples %u res %s\n",metric_names[m],span,
+			     st.avg,st.min,st.max,st.count,res);
+		assert(x < left);
+		off += x;
+		left -= x;
+		x = snprintf(&buf[off],left,"%s series %llu samples %lu bytes"
+			     " %.1f bits/sample\n",metric_names[m],
+			     (unsigned long long)state->series[m]->count,
+			     (unsigned long)tsz_bytes(state->series[m]),
+			     tsz_bits_per_sample(state->series[m]));
+		assert(x < left);
+		off += x;
+		left -= x;
+	}
+	if (write(fd,buf,off) != off)
+		syslog(LOG_WARNING,"short reply to client: %s (#%d)",
+		       err_str(state,errno),errno);
+}
+
+/*
+ * Probe data and gather statistics
+ *
+ * This function invokes probe_xxx() routines defined in the per-OS
+ * modules, e.g. openbsd.c, freebsd.c, unless we are rendering for a
+ * collector (-c), in which case it has done the probing for us.
+ * now is monotonic_msecs(), or a stand-in for it under -B frame.
+ */
+void
+probe(struct osdhud_state *state, unsigned long now)
+{
+	/* Intervals come from the monotonic clock, timestamps the wall's */
+	state->delta_t = now - state->mono_t;
+	state->mono_t = now;
+	state->last_t = time_in_milliseconds();
+	if (state->follow_path) {
+		if (!follow_page(state))
+			return;
+	} else {
+		probe_load(state);
+		probe_mem(state);
+		probe_swap(state);
+		probe_net(state);
+		sum_net_statistics(state);
+		/*probe_disk(state);*/
+		probe_battery(state);
+		probe_temperature(state);
+		probe_uptime(state);
+	}
+	record_metrics(state);
+	record_flight(state);
+	publish_page(state);
+}
+
+/*
+ * Display Routines
+ */
+
+const char *hud_color_names[HUD_NCOLORS] = {
+	"green", "yellow", "orange", "red", "violet"
+};
+
+/* Display backends for -b; the first is the default */
+struct hud_backend *hud_backends[] = {
+	&hud_xlib, &hud_xosd, &hud_tty, &hud_null, NULL
+};
+
+/*
+ * The backend named by a -b spec, which may be name:arg
+ */
+struct hud_backend *
+find_hud(char *spec)
+{
+	size_t len = strcspn(spec,":");
+	int i;
+
+	for (i = 0; hud_backends[i]; i++)
+		if ((strlen(hud_backends[i]->name) == len) &&
+		    !strncmp(hud_backends[i]->name,spec,len))
+			return hud_backends[i];
+	return NULL;
+}
+
+int
+reading_to_color(float percent)
+{
+	if (percent <= 0.25)
+		return HUD_GREEN;
+	else if (percent <= 0.5)
+		return HUD_YELLOW;
+	else if (percent <= 0.75)
+		return HUD_ORANGE;
+	else if (percent <= 1.0)
+		return HUD_RED;
+	return HUD_VIOLET;
+}
+
+/*
+ * Forget what the backend has been given, e.g. because it is new
+ */
+void
+hud_invalidate(struct osdhud_state *state)
+{
+	int i;
+
+	if (!state->hud_lines) {
+		state->hud_lines = calloc(NLINES + 1,sizeof(struct hud_line));
+		assert(state->hud_lines);
+	}
+	for (i = 0; i <= NLINES; i++) {
+		state->hud_lines[i].valid = 0;
+		state->hud_lines[i].color = HUD_GREEN;	/* as xosd starts */
+	}
+	state->disp_last = NLINES;		/* blank what we do not draw */
+}
+
+/*
+ * Hand line (NLINES for the meta line) to the backend unless it has
+ * not changed since the last frame.  percent is -1 for text.
+ */
+void
+hud_line(struct osdhud_state *state, int line, int color, int percent,
+	 const char *text)
+{
+	struct hud_line *hl = &state->hud_lines[line];
+
+	if (color == HUD_NOCOLOR)
+		color = hl->color;
+	if (hl->valid && (hl->color == color) && (hl->percent == percent) &&
+	    ((percent >= 0) || !strcmp(hl->text,text))) {
+		state->hud_stats.skipped++;
+		return;
+	}
+	state->hud_stats.lines++;
+	if (line == NLINES)
+		state->hud->meta(state,text);
+	else if (percent >= 0)
+		state->hud->bar(state,line,
+				(hl->color == color) ? HUD_NOCOLOR : color,
+				percent);
+	else
+		state->hud->text(state,line,
+				 (hl->color == color) ? HUD_NOCOLOR : color,
+				 text);
+	hl->valid = 1;
+	hl->color = color;
+	hl->percent = percent;
+	if (percent < 0)
+		strlcpy(hl->text,text,sizeof(hl->text));
+}
+
+/*
+ * Claim the next line of the HUD.  If do_color, it takes on the color
+ * for reading.
+ */
+int
+next_line(struct osdhud_state *state, int do_color, float reading,
+	  int *colorp)
+{
+	int line = state->disp_line++;
+
+	assert(line < state->nlines);
+	*colorp = do_color ? reading_to_color(reading) : HUD_NOCOLOR;
+	return line;
+}
+
+/*
+ * Integer formatters for the layout ops.  Each appends to op->buf,
+ * quietly stopping short of HUD_LINE_MAX; op_text() ends the line.
+ */
+void
+op_char(struct hud_op *op, char c)
+{
+	if (op->len < HUD_LINE_MAX - 1)
+		op->buf[op->len++] = c;
+}
+
+void
+op_str(struct hud_op *op, const char *s)
+{
+	while (*s && (op->len < HUD_LINE_MAX - 1))
+		op->buf[op->len++] = *s++;
+}
+
+/*
+ * v in decimal, padded on the left with pad to width
+ */
+void
+op_num(struct hud_op *op, unsigned long v, int width, char pad)
+{
+	char digits[24];
+	int n = 0;
+
+	do {
+		digits[n++] = '0' + (v % 10);
+		v /= 10;
+	} while (v);
+	while (width-- > n)
+		op_char(op,pad);
+	while (n)
+		op_char(op,digits[--n]);
+}
+
+#define op_uint(op,v) op_num(op,v,0,' ')
+
+void
+op_int(struct hud_op *op, long v)
+{
+	if (v < 0) {
+		op_char(op,'-');
+		op_uint(op,-(unsigned long)v);
+	} else
+		op_uint(op,v);
+}
+
+/*
+ * Like %.<places>f
+ */
+void
+op_fixed(struct hud_op *op, double v, int places)
+{
+	unsigned long scale = 1, scaled;
+	int i;
+
+	if (v < 0) {
+		op_char(op,'-');
+		v = -v;
+	}
+	for (i = 0; i < places; i++)
+		scale *= 10;
+	scaled = (unsigned long)(v * scale + 0.5);
+	op_uint(op,scaled / scale);
+	if (places) {
+		op_char(op,'.');
+		op_num(op,scaled % scale,places,'0');
+	}
+}
+
+/*
+ * Like elapsed(), e.g. "1 day 2 hours"
+ */
+void
+op_elapsed(struct hud_op *op, unsigned long secs)
+{
+	static const struct {
+		unsigned long	 secs;
+		const char	*unit;
+	} units[] = {
+		{ SECSPERDAY,	" day" },
+		{ SECSPERHOUR,	" hour" },
+		{ SECSPERMIN,	" min" },
+		{ 1,		" sec" },
+	};
+	int i, first = 1;
+
+	for (i = 0; i < 4; i++) {
+		unsigned long n = secs / units[i].secs;
+
+		secs %= units[i].secs;
+		if (!n)
+			continue;
+		if (!first)
+			op_char(op,' ');
+		first = 0;
+		op_uint(op,n);
+		op_str(op,units[i].unit);
+		if (n != 1)
+			op_char(op,'s');
+	}
+}
+
+/*
+ * Like format_span()
+ */
+void
+op_span(struct hud_op *op, int secs)
+{
+	if (!(secs % SECSPERHOUR)) {
+		op_int(op,secs / SECSPERHOUR);
+		op_char(op,'h');
+	} else if (!(secs % SECSPERMIN)) {
+		op_int(op,secs / SECSPERMIN);
+		op_char(op,'m');
+	} else {
+		op_int(op,secs);
+		op_char(op,'s');
+	}
+}
+
+/*
+ * Hand what op has built up to the next line of the HUD.  If
+ * do_color, it takes on the color for reading.
+ */
+void
+op_text(struct osdhud_state *state, struct hud_op *op, int do_color,
+	float reading)
+{
+	int color, line = next_line(state,do_color,reading,&color);
+
+	op->buf[op->len] = '\0';
+	hud_line(state,line,color,-1,op->buf);
+	op->len = 0;
+}
+
+void
+hud_bar(struct osdhud_state *state, float reading, int percent)
+{
+	int color, line = next_line(state,1,reading,&color);
+
+	hud_line(state,line,color,(percent < 0) ? 0 : percent,NULL);
+}
+
+void
+hud_meta(struct osdhud_state *state, const char *fmt, ...)
+{
+	char buf[HUD_LINE_MAX];
+	va_list ap;
+
+	va_start(ap,fmt);
+	(void) vsnprintf(buf,sizeof(buf),fmt,ap);
+	va_end(ap);
+	hud_line(state,NLINES,HUD_NOCOLOR,-1,buf);
+}
+
+void
+display_load(struct osdhud_state *state, struct hud_op *op)
+{
+	float percent = safe_percent(state->load_avg,state->max_load_avg);
+
+	op_str(op,"load: ");
+	op_fixed(op,state->load_avg,2);
+	op_text(state,op,1,percent);
+	if (state->max_load_avg)
+		hud_bar(state,percent,ipercent(percent));
+}
+
+void
+display_mem(struct osdhud_state *state, struct hud_op *op)
+{
+	op_str(op,"mem: ");
+	op_int(op,ipercent(state->mem_used_percent));
+	op_char(op,'%');
+	op_text(state,op,1,state->mem_used_percent);
+	hud_bar(state,state->mem_used_percent,
+		ipercent(state->mem_used_percent));
+}
+
+void
+display_swap(struct osdhud_state *state, struct hud_op *op)
+{
+	if (!state->nswap)
+		return;
+	op_str(op,"swap: ");
+	op_int(op,ipercent(state->swap_used_percent));
+	op_char(op,'%');
+	op_text(state,op,1,state->swap_used_percent);
+	hud_bar(state,state->swap_used_percent,
+		ipercent(state->swap_used_percent));
+}
+
+/*
+ * Pick k, m or g for a number of kbytes and set *divp to match
+ */
+char
+kbps_unit(float kbps, float *divp)
+{
+	if (kbps > MEGA) {
+		*divp = MEGA;
+		return 'g';
+	} else if (kbps > KILO) {
+		*divp = KILO;
+		return 'm';
+	}
+	*divp = 1.0;
+	return 'k';
+}
+
+/*
+ * e.g. "12 mB/s"
+ */
+void
+op_kbps(struct hud_op *op, float kbps)
+{
+	float unit_div;
+	char unit = kbps_unit(kbps,&unit_div);
+
+	op_uint(op,(unsigned long)(kbps/unit_div));
+	op_char(op,' ');
+	op_char(op,unit);
+	op_str(op,"B/s");
+}
+
+void
+display_net(struct osdhud_state *state, struct hud_op *op)
+{
+	char *iface = state->net_iface? state->net_iface: "-";
+	float net_kbps = state->net_ikbps + state->net_okbps;
+	float net_pxps = state->net_ipxps + state->net_opxps;
+	float max_kbps = ((float)state->net_speed_mbits / 8.0) * KILO;
+	float raw_percent = safe_percent(net_kbps,max_kbps);
+	int percent = ipercent(raw_percent);
+	float peak_kbps = minmax_max(state->peaks[METRIC_NET_KBPS][PEAK_1M],
+				     state->mono_t);
+
+	VSPEW("display_net %s net_speed_mbits %d max_kbps %f",
+	      iface,state->net_speed_mbits,max_kbps);
+
+	/* The label */
+	op_str(op,"net (");
+	op_str(op,iface);
+	if (max_kbps) {
+		op_char(op,' ');
+		op_int(op,state->net_speed_mbits);
+		op_str(op,"mb/s");
+	}
+	op_str(op,"): ");
+	/* The details, as short as possible */
+	if ((unsigned long)net_kbps) {
+		if (max_kbps && percent) {
+			if (percent <= 100) {
+				op_num(op,percent,3,' ');
+				op_str(op,"% ");
+			} else
+				/*
+				 * This must be because max_kbps is
+				 * wrong, which can happen if my guess
+				 * is wrong or if the user gives us a
+				 * value for -X that is wrong.
+				 */
+				op_str(op,"> 100%(!) ");
+		}
+		/*
+		 * If there are gigabytes or megabytes flying by then
+		 * op_kbps() switches to the appropriate unit.
+		 */
+		op_kbps(op,net_kbps);
+		op_str(op," (");
+		op_uint(op,(unsigned long)net_pxps);
+		op_str(op," px/s)");
+		if (peak_kbps > net_kbps) {
+			op_str(op," 1m peak ");
+			op_kbps(op,peak_kbps);
+		}
+	} else {
+		op_str(op,TXT__QUIET_);
+	}
+
+	op_text(state,op,1,raw_percent);
+	if (max_kbps)
+		hud_bar(state,raw_percent,percent);
+}
+
+/*
+ * Show the busiest interfaces (-I), whether watched or not
+ */
+void
+display_net_top(struct osdhud_state *state, struct hud_op *op)
+{
+	int slots[MAX_NET_TOP];
+	int i, n;
+
+	if (!state->net_top_n || !state->ifs)
+		return;
+	n = iftable_top(state->ifs,slots,state->net_top_n);
+	op_str(op,"top: ");
+	for (i = 0; i < n; i++) {
+		if (i)
+			op_str(op,", ");
+		op_str(op,state->ifs->name[slots[i]]);
+		op_char(op,' ');
+		op_kbps(op,iftable_rate(state->ifs,slots[i],IFT_IKBPS) +
+			iftable_rate(state->ifs,slots[i],IFT_OKBPS));
+	}
+	if (!n)
+		op_str(op,TXT__QUIET_);
+	op_text(state,op,0,0);
+}
+
+/*
+ * Copy a string into a snapshot reply: quoted and escaped for JSON,
+ * or with anything that would break up a key=value line replaced
+ */
+void
+snapshot_str(char *out, size_t len, const char *in, int json)
+{
+	size_t off = 0;
+
+	if (json)
+		out[off++] = '"';
+	else if (!*in)
+		in = "-";
+	for (; *in && (off + 8 < len); in++) {
+		unsigned char c = *in;
+
+		if (!json)
+			out[off++] = ((c <= ' ') || (c == '=')) ? '_' : c;
+		else if ((c == '"') || (c == '\\')) {
+			out[off++] = '\\';
+			out[off++] = c;
+		} else if (c < ' ')
+			off += snprintf(&out[off],len - off,"\\u%04x",c);
+		else
+			out[off++] = c;
+	}
+	if (json)
+		out[off++] = '"';
+	out[off] = 0;
+}
+
+/*
+ * Format the latest probe results into buf, as one line of key=value
+ * pairs or as a JSON object.  If dropped is not negative it is
+ * included, for streaming clients.  Returns the length.
+ */
+int
+format_snapshot(struct osdhud_state *state, char *buf, int len, int json,
+		long dropped)
+{
+	char str[256];
+	int off = 0, left = len, x;
+
+#define field(kk,ff,vv)							\
+	do {								\
+		x = snprintf(&buf[off],left,json ? "%s\"%s\":" ff :	\
+			     "%s%s=" ff,off ? (json ? "," : " ") :	\
+			     (json ? "{" : ""),kk,vv);			\
+		assert(x < left);					\
+		off += x;						\
+		left -= x;						\
+	} while (0)
+#define str_field(kk,vv)						\
+	do {								\
+		snapshot_str(str,sizeof(str),vv,json);			\
+		field(kk,"%s",str);					\
+	} while (0)
+	field("t","%lu",(unsigned long)state->last_t);
+	str_field("host",state->hostname);
+	field("uptime","%lu",(unsigned long)state->sys_uptime);
+	field("load","%.2f",state->load_avg);
+	field("mem","%.4f",state->mem_used_percent);
+	field("swap","%.4f",state->swap_used_percent);
+	str_field("iface",state->net_iface ? state->net_iface : "");
+	field("net_ikbps","%.1f",state->net_ikbps);
+	field("net_okbps","%.1f",state->net_okbps);
+	field("net_ipxps","%.1f",state->net_ipxps);
+	field("net_opxps","%.1f",state->net_opxps);
+	field("net_ibytes","%llu",(unsigned long long)state->net_tot_ibytes);
+	field("net_obytes","%llu",(unsigned long long)state->net_tot_obytes);
+	field("temp","%.1f",state->temperature);
+	field("battery","%d",state->battery_missing ?
+	      -1 : state->battery_life);
+	str_field("battery_state",state->battery_state);
+	field("battery_time","%d",state->battery_time);
+	field("alerts","%u",state->alerts);
+	field("hud_frames","%llu",
+	      (unsigned long long)state->hud_stats.frames);
+	field("hud_lines","%llu",(unsigned long long)state->hud_stats.lines);
+	field("hud_skipped","%llu",
+	      (unsigned long long)state->hud_stats.skipped);
+	field("hud_requests","%llu",
+	      (unsigned long long)state->hud_stats.requests);
+	if (dropped >= 0)
+		field("dropped","%ld",dropped);
+#undef str_field
+#undef field
+	x = snprintf(&buf[off],left,"%s\n",json ? "}" : "");
+	assert(x < left);
+	off += x;
+	return off;
+}
+
+/*
+ * Answer a -q query
+ */
+void
+reply_snapshot(struct osdhud_state *state, int fd, int json)
+{
+	char buf[SUB_FRAME_MAX];
+	int off = format_snapshot(state,buf,sizeof(buf),json,-1);
+
+	if (write(fd,buf,off) != off)
+		syslog(LOG_WARNING,"short reply to client: %s (#%d)",
+		       err_str(state,errno),errno);
+}
+
+#ifdef HAVE_EPOLL
+
+/*
+ * Add fd to the epoll set; ptr is what we get back when it is ready,
+ * either the address of one of our own fds in state or a subscriber
+ */
+void
+watch_fd(struct osdhud_state *state, int fd, u_int32_t events, void *ptr)
+{
+	struct epoll_event ev;
+
+	memset(&ev,0,sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = ptr;
+	if (epoll_ctl(state->ev_fd,EPOLL_CTL_ADD,fd,&ev)) {
+		syslog(LOG_ERR,"epoll_ctl(%d) => %s (#%d)",fd,
+		       err_str(state,errno),errno);
+		exit(1);
+	}
+}
+
+void
+unwatch_fd(struct osdhud_state *state, int fd)
+{
+	if (state->ev_fd >= 0)
+		(void) epoll_ctl(state->ev_fd,EPOLL_CTL_DEL,fd,NULL);
+}
+
+/*
+ * Set a timerfd to go off at msecs on the monotonic clock, or disarm
+ * it if msecs is zero
+ */
+void
+arm_timer(struct osdhud_state *state, int fd, unsigned long msecs)
+{
+	struct itimerspec its;
+
+	memset(&its,0,sizeof(its));
+	its.it_value.tv_sec = msecs / 1000;
+	its.it_value.tv_nsec = (msecs % 1000) * 1000000;
+	if (timerfd_settime(fd,TFD_TIMER_ABSTIME,&its,NULL))
+		syslog(LOG_ERR,"timerfd_settime() => %s (#%d)",
+		       err_str(state,errno),errno);
+}
+
+/*
+ * Set up the epoll set that check() waits on: the control socket, a
+ * timer for sampling, a timer for the HUD coming down and the signals
+ * we care about, which are blocked and read from a signalfd instead
+ * of being delivered to handle_signal().  Subscribers are added as
+ * they arrive and leave the set when they are closed.
+ */
+void
+init_events(struct osdhud_state *state)
+{
+	sigset_t sigs;
+
+	sigemptyset(&sigs);
+	sigaddset(&sigs,SIGINT);
+	sigaddset(&sigs,SIGTERM);
+	sigaddset(&sigs,SIGHUP);
+	sigaddset(&sigs,INFO_SIGNAL);
+	if (sigprocmask(SIG_BLOCK,&sigs,NULL))
+		die(state,err_str(state,errno));
+	state->ev_fd = epoll_create1(EPOLL_CLOEXEC);
+	state->sample_fd = timerfd_create(CLOCK_MONOTONIC,
+					  TFD_NONBLOCK|TFD_CLOEXEC);
+	state->expire_fd = timerfd_create(CLOCK_MONOTONIC,
+					  TFD_NONBLOCK|TFD_CLOEXEC);
+	state->sig_fd = signalfd(-1,&sigs,SFD_NONBLOCK|SFD_CLOEXEC);
+	if ((state->ev_fd < 0) || (state->sample_fd < 0) ||
+	    (state->expire_fd < 0) || (state->sig_fd < 0)) {
+		syslog(LOG_ERR,"could not set up events: %s (#%d)",
+		       err_str(state,errno),errno);
+		exit(1);
+	}
+	watch_fd(state,state->sock_fd,EPOLLIN,&state->sock_fd);
+	watch_fd(state,state->sample_fd,EPOLLIN,&state->sample_fd);
+	watch_fd(state,state->expire_fd,EPOLLIN,&state->expire_fd);
+	watch_fd(state,state->sig_fd,EPOLLIN,&state->sig_fd);
+}
+#endif /* HAVE_EPOLL */
+
+/*
+ * Take on a client that asked for -q with -e: it keeps its connection
+ * and gets a snapshot every so many probes until it hangs up
+ */
+void
+add_subscriber(struct osdhud_state *state, int client, int json, int every)
+{
+	static const char busy[] = "too many subscribers\n";
+	struct subscriber *sub;
+	int fd;
+
+	if (state->nsubs == MAX_SUBSCRIBERS) {
+		syslog(LOG_WARNING,"%d subscribers, turning one away",
+		       state->nsubs);
+		if (write(client,busy,sizeof(busy) - 1) < 0)
+			DSPEW("write(busy) => %s",err_str(state,errno));
+		return;
+	}
+	fd = dup(client);
+	if (fd < 0) {
+		syslog(LOG_ERR,"dup(%d) => %s (#%d)",client,
+		       err_str(state,errno),errno);
+		return;
+	}
+	if (!(sub = sub_new(fd,json,every))) {
+		syslog(LOG_ERR,"fcntl(%d,O_NONBLOCK) => %s (#%d)",fd,
+		       err_str(state,errno),errno);
+		close(fd);
+		return;
+	}
+	state->subs[state->nsubs++] = sub;
+#ifdef HAVE_EPOLL
+	/* publish() writes first; we only need to hear when it drains */
+	watch_fd(state,fd,EPOLLOUT|EPOLLET,sub);
+#endif
+	VSPEW("subscriber on fd %d every %d (%d total)",fd,every,
+	      state->nsubs);
+}
+
+/*
+ * Hang up on the i'th subscriber
  */
 void
-probe(struct osdhud_state *state)
+drop_subscriber(struct osdhud_state *state, int i)
 {
-	unsigned long now = time_in_milliseconds();
+	struct subscriber *sub = state->subs[i];
 
-	state->delta_t = now - state->last_t;
-	state->last_t = now;
-	probe_load(state);
-	probe_mem(state);
-	probe_swap(state);
-	probe_net(state);
-	/*probe_disk(state);*/
-	probe_battery(state);
-	probe_temperature(state);
-	probe_uptime(state);
+	VSPEW("subscriber on fd %d gone: %lu sent, %lu dropped",sub->fd,
+	      sub->nsent,sub->ndropped);
+	sub_free(sub);
+	state->subs[i] = state->subs[--state->nsubs];
+	state->subs[state->nsubs] = NULL;
 }
 
 /*
- * Display Routines
+ * Find a connection by its address, or -1 if it is not one of ours
  */
-
-char *
-reading_to_color(float percent)
+int
+client_index(struct osdhud_state *state, void *ptr)
 {
-	static char *colors[] = {
-		"green", "yellow", "orange", "red", "violet"
-	};
-	int severity;
+	int i;
 
-	if (percent <= 0.25)
-		severity = 0;
-	else if (percent <= 0.5)
-		severity = 1;
-	else if (percent <= 0.75)
-		severity = 2;
-	else if (percent <= 1.0)
-		severity = 3;
-	else
-		severity = 4;
-	return colors[severity];
+	for (i = 0; i < state->nclients; i++)
+		if (state->clients[i] == ptr)
+			return i;
+	return -1;
 }
 
-xosd *
-osd_to_use(struct osdhud_state *state, int do_color, float reading)
+/*
+ * Hang up on the i'th connection
+ */
+void
+drop_client(struct osdhud_state *state, int i)
 {
-	int off;
-	xosd *osd;
+	struct client *cl = state->clients[i];
 
-	off = state->disp_line++;
-	assert(off < state->nlines);
-	osd = state->osds[off];
-	if (do_color) {
-		char *color;
-
-		color = reading_to_color(reading);
-		if (xosd_set_colour(osd, color))
-			syslog(LOG_WARNING,
-			       "could not set osd[%d] color to %s (%f)",
-				off,color,reading);
-	}
-	return osd;
+#ifdef HAVE_EPOLL
+	/* a subscriber may hold a dup of fd, so closing it is not enough */
+	unwatch_fd(state,cl->fd);
+#endif
+	close(cl->fd);
+	free(cl);
+	state->clients[i] = state->clients[--state->nclients];
+	state->clients[state->nclients] = NULL;
 }
 
+/*
+ * Queue the latest probe results for every subscriber that is due
+ * one and write out as much as each will take without blocking.  A
+ * subscriber that falls behind loses its oldest frames; the "dropped"
+ * field in each frame says how many so far.
+ */
 void
-display_load(struct osdhud_state *state)
+publish(struct osdhud_state *state)
 {
-	float percent = safe_percent(state->load_avg,state->max_load_avg);
+	struct subscriber *sub;
+	char *frame;
+	int i = 0;
 
-	xosd_display(osd_to_use(state,1,percent),0,XOSD_printf,"load: %.2f",
-		     state->load_avg);
-	if (state->max_load_avg)
-		xosd_display(osd_to_use(state,1,percent),0,XOSD_percentage,
-			     ipercent(percent));
+	while (i < state->nsubs) {
+		sub = state->subs[i];
+		if (sub_due(sub)) {
+			frame = sub_frame(sub);
+			sub_push(sub,format_snapshot(state,frame,SUB_FRAME_MAX,
+						     sub->json,
+						     (long)sub->ndropped));
+			if (sub_flush(sub) < 0) {
+				drop_subscriber(state,i);
+				continue;
+			}
+		}
+		i++;
+	}
 }
 
+#ifndef HAVE_EPOLL
+/*
+ * Write out queued frames to subscribers whose sockets drained
+ */
 void
-display_mem(struct osdhud_state *state)
+flush_subscribers(struct osdhud_state *state, fd_set *wfds)
 {
-	xosd_display(osd_to_use(state,1,state->mem_used_percent),0,
-		     XOSD_printf,"mem: %d%%",ipercent(state->mem_used_percent));
-	xosd_display(osd_to_use(state,1,state->mem_used_percent),0,
-		     XOSD_percentage,ipercent(state->mem_used_percent));
-}
+	int i = 0;
 
+	while (i < state->nsubs) {
+		if (FD_ISSET(state->subs[i]->fd,wfds) &&
+		    (sub_flush(state->subs[i]) < 0)) {
+			drop_subscriber(state,i);
+			continue;
+		}
+		i++;
+	}
+}
+#else /* HAVE_EPOLL */
+/*
+ * Write out queued frames to a subscriber whose socket drained; ptr
+ * may be one that has already gone, if it went earlier in the batch
+ * of events that reported it
+ */
 void
-display_swap(struct osdhud_state *state)
+flush_subscriber(struct osdhud_state *state, void *ptr)
 {
-	if (!state->nswap)
-		return;
-	xosd_display(osd_to_use(state,1,state->swap_used_percent),0,XOSD_printf,
-		     "swap: %d%%",ipercent(state->swap_used_percent));
-	xosd_display(osd_to_use(state,1,state->swap_used_percent),0,
-		     XOSD_percentage,ipercent(state->swap_used_percent));
+	int i;
+
+	for (i = 0; i < state->nsubs; i++)
+		if (state->subs[i] == ptr) {
+			if (sub_flush(state->subs[i]) < 0)
+				drop_subscriber(state,i);
+			break;
+		}
 }
+#endif /* HAVE_EPOLL */
 
+/*
+ * Show averages and the net peak over the -H span
+ */
 void
-display_net(struct osdhud_state *state)
+display_history(struct osdhud_state *state, struct hud_op *op)
 {
-	char *iface = state->net_iface? state->net_iface: "-";
-	int left, off, n;
-	char label[256];
-	char details[1024];
-	float net_kbps = state->net_ikbps + state->net_okbps;
-	float net_pxps = state->net_ipxps + state->net_opxps;
-	char unit = 'k';
-	float unit_div = 1.0;
-	float max_kbps = ((float)state->net_speed_mbits / 8.0) * KILO;
-	float raw_percent = safe_percent(net_kbps,max_kbps);
-	int percent = ipercent(raw_percent);
-
-	VSPEW("display_net %s net_speed_mbits %d max_kbps %f",
-	      iface,state->net_speed_mbits,max_kbps);
-	memset(label,0,sizeof(label));
-	memset(details,0,sizeof(details));
-	/*
-	 * If there are gigabytes or megabytes flying by then
-	 * switch to the appropriate unit.
-	 */
-	if (net_kbps > state->net_peak_kbps)
-		state->net_peak_kbps = net_kbps;
-	if (net_pxps > state->net_peak_pxps)
-		state->net_peak_pxps = net_pxps;
-	if (net_kbps > MEGA) {
-		unit = 'g';
-		unit_div = MEGA;
-	} else if (net_kbps > KILO) {
-		unit = 'm';
-		unit_div = KILO;
-	}
-	/* Put together the label */
-	if (!max_kbps)
-		assert_snprintf(label,"net (%s):",iface);
-	else
-		assert_snprintf(label,"net (%s %dmb/s):",iface,
-				state->net_speed_mbits);
-	/* Put together the details string, as short as possible */
-	if ((unsigned long)net_kbps) {
-		left = sizeof(details);
-		off = 0;
-		if (max_kbps && percent) {
-			if (percent <= 100)
-				n = snprintf(&details[off],left,"%3d%% ",
-					     percent);
-			else
-				/*
-				 * This must be because max_kbps is
-				 * wrong, which can happen if my guess
-				 * is wrong or if the user gives us a
-				 * value for -X that is wrong.
-				 */
-				n = snprintf(&details[off],left,"> 100%%(!) ");
-			assert(n < left);
-			left -= n;
-			off += n;
-		}
-		n = snprintf(&details[off],left,"%lu %cB/s (%lu px/s)",
-			     (unsigned long)(net_kbps/unit_div),unit,
-			     (unsigned long)net_pxps);
-		assert(n < left);
-		left -= n;
-		off += n;
-	} else {
-		assert_strlcpy(details,TXT__QUIET_);
-	}
+	struct rollup_stats load, mem, net;
+	unsigned long span = state->history_secs * 1000UL;
 
-	xosd_display(osd_to_use(state,1,raw_percent),0,XOSD_printf,"%s %s",
-		     label,details);
-	if (max_kbps)
-		xosd_display(osd_to_use(state,1,raw_percent),0,XOSD_percentage,
-			     percent);
+	if (!state->history_secs)
+		return;
+	rollup_query(state->rollups[METRIC_LOAD],state->last_t,span,&load);
+	rollup_query(state->rollups[METRIC_MEM],state->last_t,span,&mem);
+	rollup_query(state->rollups[METRIC_NET_KBPS],state->last_t,span,&net);
+	op_span(op,state->history_secs);
+	op_str(op," avg: load ");
+	op_fixed(op,load.avg,2);
+	op_str(op," mem ");
+	op_int(op,ipercent(mem.avg));
+	op_str(op,"% net ");
+	op_kbps(op,net.avg);
+	op_str(op," (max ");
+	op_kbps(op,net.max);
+	op_char(op,')');
+	op_text(state,op,0,0);
 }
 
 void
-display_disk(struct osdhud_state *state)
+display_disk(struct osdhud_state *state, struct hud_op *op)
 {
 }
 
 void
-display_battery(struct osdhud_state *state)
+display_battery(struct osdhud_state *state, struct hud_op *op)
 {
-	char *charging = state->battery_state[0] ?
-		state->battery_state : TXT__UNKNOWN_;
-	char mins[128] = { 0 };
 	float battery_used;
 
 	if (state->battery_missing)
 		return;
-	if (state->battery_time < 0) {
-		assert_strlcpy(mins,TXT_TIME_UNKNOWN);
-	} else {
-		assert_elapsed(mins,state->battery_time*60);
-	}
+	op_str(op,"battery: ");
+	op_str(op,state->battery_state[0] ?
+	       state->battery_state : TXT__UNKNOWN_);
+	op_str(op,", ");
+	op_int(op,state->battery_life);
+	op_str(op,"% charged (");
+	if (state->battery_time < 0)
+		op_str(op,TXT_TIME_UNKNOWN);
+	else
+		op_elapsed(op,state->battery_time*60);
+	op_char(op,')');
 	/* We want the color based on the percentage used, not remaining: */
 	battery_used = 1.0 - ((float)state->battery_life / 100.0);
-	xosd_display(osd_to_use(state,1,battery_used),0,XOSD_printf,
-		     "battery: %s, %d%% charged (%s)",charging,
-		     state->battery_life,mins);
-	xosd_display(osd_to_use(state,1,battery_used),0,XOSD_percentage,
-		     state->battery_life);
+	op_text(state,op,1,battery_used);
+	hud_bar(state,battery_used,state->battery_life);
 }
 
 void
-display_temperature(struct osdhud_state *state)
+display_temperature(struct osdhud_state *state, struct hud_op *op)
 {
 	float percent = safe_percent(state->temperature,state->max_temperature);
 
-	xosd_display(osd_to_use(state,1,percent),0,XOSD_printf,
-		     "temp: %.0f degC (%s)", state->temperature,
-		     state->temp_sensor_name);
-	xosd_display(osd_to_use(state,1,percent),0,XOSD_percentage,
-		     ipercent(percent));
+	op_str(op,"temp: ");
+	op_fixed(op,state->temperature,0);
+	op_str(op," degC (");
+	op_str(op,NULLS(state->temp_sensor_name));
+	op_char(op,')');
+	op_text(state,op,1,percent);
+	hud_bar(state,percent,ipercent(percent));
 }
 
 void
-display_uptime(struct osdhud_state *state)
+display_uptime(struct osdhud_state *state, struct hud_op *op)
 {
 	if (state->sys_uptime) {
-		unsigned long secs = state->sys_uptime;
-		char upbuf[64] = { 0 };
-
-		assert_elapsed(upbuf,secs);
-		xosd_display(osd_to_use(state,0,0),0,XOSD_printf,
-			     "%s up %s",state->hostname,upbuf);
+		op_str(op,state->hostname);
+		op_str(op," up ");
+		op_elapsed(op,state->sys_uptime);
+		op_text(state,op,0,0);
 	}
 }
 
 void
-display_message(struct osdhud_state *state)
+display_message(struct osdhud_state *state, struct hud_op *op)
 {
 	if (!state->message_seen && state->message[0]) {
-		xosd_display(osd_to_use(state,0,0),0,XOSD_printf,"%s",
-			     state->message);
+		op_str(op,state->message);
 		state->message_seen = 1;
-	} else {
-		xosd_display(osd_to_use(state,0,0),0,XOSD_printf,"");
 	}
+	op_text(state,op,0,0);
+}
+
+/*
+ * What -L can ask for, and how many lines of the HUD each can take
+ */
+static const struct {
+	const char	*name;
+	void		(*fn)(struct osdhud_state *, struct hud_op *);
+	int		 nlines;
+} layout_items[] = {
+	{ "uptime",	display_uptime,		1 },
+	{ "load",	display_load,		2 },
+	{ "mem",	display_mem,		2 },
+	{ "swap",	display_swap,		2 },
+	{ "net",	display_net,		2 },
+	{ "top",	display_net_top,	1 },
+	{ "history",	display_history,	1 },
+	{ "disk",	display_disk,		0 },
+	{ "battery",	display_battery,	2 },
+	{ "temp",	display_temperature,	2 },
+	{ "message",	display_message,	1 },
+	{ NULL,		NULL,			0 }
+};
+
+/*
+ * Compile a -L list like "load,mem,net" into state's layout ops, each
+ * with its own line buffer, so that display() need not look at it
+ * again.  If state is NULL spec is only checked.  Returns -1 if spec
+ * names something we do not know or would not fit on the HUD.
+ */
+int
+compile_layout(struct osdhud_state *state, const char *spec)
+{
+	struct hud_op *ops = NULL;
+	char *copy, *rest, *name;
+	int i, nops = 0, nlines = 0, retval = -1;
+
+	if (!spec || !(copy = strdup(spec)))
+		return -1;
+	if (state) {
+		ops = (struct hud_op *)calloc(NLINES,sizeof(struct hud_op));
+		assert(ops);
+	}
+	rest = copy;
+	while ((name = strsep(&rest,",")) != NULL) {
+		if (!*name)
+			continue;
+		for (i = 0; layout_items[i].name; i++)
+			if (!strcmp(name,layout_items[i].name))
+				break;
+		if (!layout_items[i].name || (nops == NLINES) ||
+		    (nlines + layout_items[i].nlines > NLINES))
+			goto DONE;
+		nlines += layout_items[i].nlines;
+		if (ops)
+			ops[nops].fn = layout_items[i].fn;
+		nops++;
+	}
+	if (!nops)
+		goto DONE;
+	if (state) {
+		free(state->layout_ops);
+		state->layout_ops = ops;
+		state->layout_nops = nops;
+		ops = NULL;
+	}
+	retval = 0;
+DONE:
+	free(ops);
+	free(copy);
+	return retval;
 }
 
 void
@@ -482,7 +1729,6 @@ display_hudmeta(struct osdhud_state *state)
 	unsigned int left = (dt < state->duration_msecs) ?
 		state->duration_msecs - dt : 0;
 	unsigned int left_secs = (left + 500) / 1000;
-	xosd *osd = state->osd_bot;
 	char now_str[512] = { 0 };
 	char left_s[512] = { 0 };
 
@@ -511,10 +1757,10 @@ display_hudmeta(struct osdhud_state *state)
 			assert_strlcpy(left_s,TXT__BLINK_);
 	}
 	if (state->time_fmt)
-		xosd_display(osd,0,XOSD_printf,"%s%s%s%s",now_str,
-			     left_s[0]? " [": "",left_s,left_s[0]? "]":"");
+		hud_meta(state,"%s%s%s%s",now_str,
+			 left_s[0]? " [": "",left_s,left_s[0]? "]":"");
 	else if (left_s[0])
-		xosd_display(osd,0,XOSD_printf,"[%s]",left_s);
+		hud_meta(state,"[%s]",left_s);
 }
 
 /*
@@ -523,22 +1769,32 @@ display_hudmeta(struct osdhud_state *state)
 void
 display(struct osdhud_state *state)
 {
+	int i;
+
+	if (!state->layout_ops &&
+	    compile_layout(state,state->layout? state->layout: DEFAULT_LAYOUT)) {
+		syslog(LOG_WARNING,"bad layout %s, using the default",
+		       NULLS(state->layout));
+		assert(!compile_layout(state,DEFAULT_LAYOUT));
+	}
 	state->disp_line = 0;
-	display_uptime(state);
-	display_load(state);
-	display_mem(state);
-	display_swap(state);
-	display_net(state);
-	display_disk(state);
-	display_battery(state);
-	display_temperature(state);
-	display_message(state);
+	state->hud_stats.frames++;
+	for (i = 0; i < state->layout_nops; i++)
+		state->layout_ops[i].fn(state,&state->layout_ops[i]);
+	/* Blank whatever the last frame drew below us */
+	for (i = state->disp_line; i < state->disp_last; i++)
+		hud_line(state,i,HUD_NOCOLOR,-1,"");
+	state->disp_last = state->disp_line;
 	display_hudmeta(state);
+	state->hud->flush(state);
 }
 
-#define OSDHUD_OPTIONS "d:p:P:vf:s:i:T:X:m:M:knDUSNFCwhgaAt?"
+#define OSDHUD_OPTIONS "b:L:d:p:P:vf:s:i:I:H:Q:q:e:R:W:O:c:Z:T:X:m:M:B:knDUSNFCwhgaAt?"
 #define USAGE_MSG "usage: %s [-vgtkFDUSNCwh?] [-d msec] [-p msec] [-P msec]\n\
-              [-f font] [-s path] [-i iface] [-T fmt] [-m sensor_name] [-M max_temp]\n\
+              [-f font] [-b backend] [-L list] [-s path] [-i iface] [-I n]\n\
+              [-T fmt] [-m sensor_name] [-M max_temp] [-H span] [-Q span]\n\
+              [-q fmt] [-e n] [-R path] [-W dir] [-O path] [-c path] [-Z file]\n\
+              [-B bench[:iterations]]\n\
    -v verbose      | -k kill server | -F run in foreground\n\
    -D down HUD     | -U up HUD      | -S stick HUD | -N unstick HUD\n\
    -g debug mode   | -t toggle mode | -w don't show swap\n\
@@ -552,9 +1808,22 @@ display(struct osdhud_state *state)
    -p msec  millis between sampling when HUD is up (def: 100)\n\
    -P msec  millis between sampling when HUD is down (def: 100)\n\
    -f font  (def: "DEFAULT_FONT")\n\
+   -b name  draw the HUD with xlib, xosd, tty or null[:path] (def: xlib)\n\
+   -L list  lines to show, e.g. load,mem,net (def: all of them)\n\
    -s path  path to Unix-domain socket (def: ~/.%s_%s.sock)\n\
    -i iface network interface to watch\n\
-   -X mb/s  fix max net link speed in mbit/sec (def: query interface)\n"
+   -I n     show the n busiest interfaces (def: 0, max: 4)\n\
+   -H span  show averages over span, e.g. 15m or 1h (def: off)\n\
+   -Q span  print history over span from the running daemon\n\
+   -q fmt   print the latest sample from the running daemon (line, json)\n\
+   -e n     with -q, keep printing a sample every n probes\n\
+   -R path  keep history in path across daemon restarts\n\
+   -W dir   dump the last ~80s of samples to dir when an alert fires\n\
+   -O path  publish the latest sample in a shared page at path\n\
+   -c path  show what a collector started with -O path probes\n\
+   -Z file  print a flight recording made by -W as CSV and exit\n\
+   -X mb/s  fix max net link speed in mbit/sec (def: query interface)\n\
+   -B name  run a microbenchmark and exit (e.g. movavg, tsz, netdev, frame)\n"
 
 int
 usage(struct osdhud_state *state, char *msg)
@@ -578,6 +1847,132 @@ usage(struct osdhud_state *state, char *msg)
 	return fail;
 }
 
+/*
+ * Microbenchmark support, shared with the per-OS modules
+ */
+unsigned long long
+bench_nsecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+void
+bench_report(char *what, int iters, int nitems, unsigned long long nsecs)
+{
+	printf("%-16s %8d passes %12.0f ns/pass %10.1f ns/item\n",what,
+	       iters,(double)nsecs / iters,(double)nsecs / iters / nitems);
+}
+
+/*
+ * One tick's worth of moving average updates for BENCH_NSERIES series,
+ * one movavg_add() at a time and then as a single movavg_set
+ */
+void
+bench_movavg(struct osdhud_state *state, int iters)
+{
+	struct movavg *mas[BENCH_NSERIES];
+	struct movavg_set *set;
+	float vals[BENCH_NSERIES];
+	unsigned long long t0;
+	int i, j;
+
+	for (j = 0; j < BENCH_NSERIES; j++) {
+		mas[j] = movavg_new(state->net_movavg_wsize);
+		vals[j] = j;
+	}
+	set = movavg_set_new(BENCH_NSERIES,state->net_movavg_wsize);
+	t0 = bench_nsecs();
+	for (i = 0; i < iters; i++)
+		for (j = 0; j < BENCH_NSERIES; j++)
+			(void) movavg_add(mas[j],vals[j] + i);
+	bench_report("movavg_add",iters,BENCH_NSERIES,bench_nsecs() - t0);
+	t0 = bench_nsecs();
+	for (i = 0; i < iters; i++) {
+		vals[i % BENCH_NSERIES] += i;
+		movavg_set_add(set,vals,state->short_pause_msecs);
+	}
+	bench_report("movavg_set_add",iters,BENCH_NSERIES,bench_nsecs() - t0);
+	for (j = 0; j < BENCH_NSERIES; j++)
+		movavg_free(mas[j]);
+	movavg_set_free(set);
+}
+
+/*
+ * Compress iters samples that look like a load average and a network
+ * rate sampled every -p msecs, then decode them again
+ */
+void
+bench_tsz(struct osdhud_state *state, int iters)
+{
+	struct tsz *load = tsz_new(~0UL,(size_t)iters * 16);
+	struct tsz *net = tsz_new(~0UL,(size_t)iters * 16);
+	unsigned long t = time_in_milliseconds(), t1;
+	unsigned long long t0;
+	struct tsz_iter it;
+	float v, lv = 0.25, nv = 0;
+	int i, n;
+
+	srandom(1);
+	t0 = bench_nsecs();
+	for (i = 0; i < iters; i++) {
+		t += state->short_pause_msecs + (random() % 3);
+		if (!(i % 64))
+			lv = (random() % 400) / 100.0;
+		nv = nv * 0.8 + (random() % 10000) / 7.0;
+		tsz_add(load,t,lv);
+		tsz_add(net,t,(unsigned long)(nv + 0.5));
+	}
+	bench_report("tsz_add",iters,2,bench_nsecs() - t0);
+	t0 = bench_nsecs();
+	n = 0;
+	tsz_iter_init(&it,load,0,t);
+	while (tsz_iter_next(&it,&t1,&v))
+		n++;
+	tsz_iter_init(&it,net,0,t);
+	while (tsz_iter_next(&it,&t1,&v))
+		n++;
+	bench_report("tsz_iter_next",iters,2,bench_nsecs() - t0);
+	assert(n == 2 * iters);
+	printf("%-16s %8.2f bits/sample load %8.2f bits/sample net\n",
+	       "tsz",tsz_bits_per_sample(load),tsz_bits_per_sample(net));
+	tsz_free(load);
+	tsz_free(net);
+}
+
+/*
+ * Run one of the -B microbenchmarks and exit; spec is name[:iterations]
+ */
+void
+benchmark(struct osdhud_state *state, char *spec)
+{
+	char *name = strdup(spec);
+	char *colon = strchr(name,':');
+	int iters = DEFAULT_BENCH_ITERS;
+
+	if (colon) {
+		*colon++ = 0;
+		if ((sscanf(colon,"%d",&iters) != 1) || (iters < 1))
+			usage(state,"bad iteration count for -B");
+	}
+	if (!state->ifs)
+		state->ifs = iftable_new(state->net_movavg_wsize);
+	if (!strcmp(name,"movavg"))
+		bench_movavg(state,iters);
+	else if (!strcmp(name,"tsz"))
+		bench_tsz(state,iters);
+	else if (!strcmp(name,"msg"))
+		bench_msg(state,iters);
+	else if (!strcmp(name,"frame"))
+		bench_frame(state,iters);
+	else if (probe_benchmark(state,name,iters) < 0)
+		usage(state,"unknown benchmark for -B");
+	free(name);
+	exit(0);
+}
+
 /*
  * Parse command-line arguments into struct osdhud_state structure
  */
@@ -610,6 +2005,50 @@ parse(struct osdhud_state *state, int argc, char **argv)
 				fail = usage(state,"bad value for -P");
 			DBG2("parsed -%c %d",ch,state->long_pause_msecs);
 			break;
+		case 'q':
+			if (strcmp(optarg,"line") && strcmp(optarg,"json"))
+				fail = usage(state,"-q takes line or json");
+			else
+				state->snapshot_fmt = strdup(optarg);
+			DBG2("parsed -%c %s",ch,NULLS(state->snapshot_fmt));
+			break;
+		case 'e':
+			if ((sscanf(optarg,"%d",&state->stream_every) != 1) ||
+			    (state->stream_every < 1))
+				fail = usage(state,"bad value for -e");
+			DBG2("parsed -%c %d",ch,state->stream_every);
+			break;
+		case 'R':
+			state->hist_path = strdup(optarg);
+			DBG2("parsed -%c %s",ch,state->hist_path);
+			break;
+		case 'W':
+			state->fr_dir = strdup(optarg);
+			DBG2("parsed -%c %s",ch,state->fr_dir);
+			break;
+		case 'O':
+			state->page_path = strdup(optarg);
+			DBG2("parsed -%c %s",ch,state->page_path);
+			break;
+		case 'c':
+			state->follow_path = strdup(optarg);
+			DBG2("parsed -%c %s",ch,state->follow_path);
+			break;
+		case 'Z':
+			if (!state->argv0)
+				fail = usage(state,"-Z only on the command line");
+			else {
+				char errbuf[1024];
+
+				if (flightrec_decode(optarg,stdout,errbuf,
+						     sizeof(errbuf))) {
+					fprintf(stderr,"%s: %s\n",
+						state->argv0,errbuf);
+					exit(1);
+				}
+				exit(0);
+			}
+			break;
 		case 'T':
 			state->time_fmt = strdup(optarg);
 			DBG2("parsed -%c %s",ch,state->time_fmt);
@@ -626,6 +2065,15 @@ parse(struct osdhud_state *state, int argc, char **argv)
 			if (sscanf(optarg,"%f",&state->max_temperature) != 1)
 				fail = usage(state,"bad value for -M");
 			break;
+		case 'B':
+			if (!state->argv0)
+				fail = usage(state,"-B only on the command line");
+			else {
+				/* run by main() once all options are in */
+				free(state->bench_spec);
+				state->bench_spec = strdup(optarg);
+			}
+			break;
 		case 'v':                       /* verbose */
 			state->verbose++;
 			DBG2("parsed -%c => %d",ch,state->verbose);
@@ -634,6 +2082,24 @@ parse(struct osdhud_state *state, int argc, char **argv)
 			state->font = strdup(optarg);
 			DBG2("parsed -%c %s",ch,state->font);
 			break;
+		case 'b':                       /* display backend */
+			state->hud = find_hud(optarg);
+			if (!state->hud)
+				fail = usage(state,"unknown backend for -b");
+			else if (strchr(optarg,':')) {
+				free(state->hud_arg);
+				state->hud_arg = strdup(strchr(optarg,':') + 1);
+			}
+			break;
+		case 'L':                       /* layout */
+			if (compile_layout(NULL,optarg))
+				fail = usage(state,"bad value for -L");
+			else {
+				free(state->layout);
+				state->layout = strdup(optarg);
+			}
+			DBG2("parsed -%c %s",ch,NULLS(state->layout));
+			break;
 		case 's':                       /* path to unix socket */
 			state->sock_path = strdup(optarg);
 			DBG2("parsed -%c %s",ch,state->sock_path);
@@ -643,9 +2109,27 @@ parse(struct osdhud_state *state, int argc, char **argv)
 			state->net_iface = strdup(optarg);
 			DBG2("parsed -%c %s",ch,state->net_iface);
 			break;
+		case 'I':
+			if ((sscanf(optarg,"%d",&state->net_top_n) != 1) ||
+			    (state->net_top_n < 0) ||
+			    (state->net_top_n > MAX_NET_TOP))
+				fail = usage(state,"bad value for -I");
+			DBG2("parsed -%c %d",ch,state->net_top_n);
+			break;
+		case 'H':
+			if (parse_span(optarg,&state->history_secs))
+				fail = usage(state,"bad value for -H");
+			DBG2("parsed -%c %d",ch,state->history_secs);
+			break;
+		case 'Q':
+			if (parse_span(optarg,&state->query_secs))
+				fail = usage(state,"bad value for -Q");
+			DBG2("parsed -%c %d",ch,state->query_secs);
+			break;
 		case 'X':
 			if (sscanf(optarg,"%d",&state->net_speed_mbits) != 1)
 				fail = usage(state,"bad value for -X");
+			state->net_speed_fixed = 1;
 			DBG2("parsed -%c %d",ch,state->net_speed_mbits);
 			break;
 		case 'k':
@@ -717,8 +2201,6 @@ parse(struct osdhud_state *state, int argc, char **argv)
 void
 init_state(struct osdhud_state *state, char *argv0)
 {
-	int i;
-
 	if (!argv0)
 		state->argv0 = NULL;
 	else {
@@ -734,6 +2216,9 @@ init_state(struct osdhud_state *state, char *argv0)
 		state->cancel_alerts = 0;
 	state->pid = 0;
 	state->sock_fd = -1;
+	state->ev_fd = state->sample_fd = state->expire_fd =
+		state->sig_fd = -1;
+	state->next_sample = 0;
 	state->sock_path = NULL;
 #ifdef DEFAULT_TIME_FMT
 	state->time_fmt = strdup(DEFAULT_TIME_FMT);
@@ -744,6 +2229,7 @@ init_state(struct osdhud_state *state, char *argv0)
 	state->font = NULL;
 	state->net_iface = NULL;
 	state->net_speed_mbits = 0;
+	state->net_speed_fixed = 0;
 	state->net_tot_ipackets = state->net_tot_ierr =
 		state->net_tot_opackets = state->net_tot_oerr =
 		state->net_tot_ibytes = state->net_tot_obytes = 0;
@@ -768,11 +2254,34 @@ init_state(struct osdhud_state *state, char *argv0)
 	state->per_os_data = NULL;
 	state->net_ikbps = state->net_ipxps =
 		state->net_okbps = state->net_opxps = 0;
-	state->net_peak_kbps = state->net_peak_pxps = 0;
-	state->ikbps_ma = state->ipxps_ma =
-		state->okbps_ma = state->opxps_ma = NULL;
-	state->rxdisk_ma = state->wxdisk_ma =
-		state->rbdisk_ma = state->wbdisk_ma = NULL;
+	memset(state->peaks,0,sizeof(state->peaks));
+	state->ifs = NULL;
+	state->net_top_n = 0;
+	memset(state->rollups,0,sizeof(state->rollups));
+	memset(state->series,0,sizeof(state->series));
+	state->hist_path = NULL;
+	state->hist = NULL;
+	state->fr_dir = NULL;
+	state->fr = NULL;
+	state->page_path = NULL;
+	state->page = NULL;
+	state->follow_path = NULL;
+	state->follow = NULL;
+	state->follow_seen = 0;
+	state->follow_lost = 0;
+	state->follow_still = 0;
+	state->follow_dev = 0;
+	state->follow_ino = 0;
+	state->alerts = 0;
+	state->history_secs = 0;
+	state->query_secs = 0;
+	state->snapshot_fmt = NULL;
+	state->stream_every = 0;
+	memset(state->subs,0,sizeof(state->subs));
+	state->nsubs = 0;
+	memset(state->clients,0,sizeof(state->clients));
+	state->nclients = 0;
+	state->disk_ma = NULL;
 	state->disk_rkbps = state->disk_wkbps =
 		state->disk_rxps = state->disk_wxps = 0;
 	state->battery_missing = 0;
@@ -781,11 +2290,19 @@ init_state(struct osdhud_state *state, char *argv0)
 	state->battery_time = 0;
 	state->last_t = 0;
 	state->first_t = 0;
+	state->mono_t = 0;
 	state->sys_uptime = 0;
-	for (i = 0; i < ARRAY_SIZE(state->osds); i++)
-		state->osds[i] = NULL;
-	state->osd_bot = NULL;
+	state->hud = &hud_xlib;
+	state->hud_arg = NULL;
+	state->hud_priv = NULL;
+	state->bench_spec = NULL;
+	state->hud_lines = NULL;
+	memset(&state->hud_stats,0,sizeof(state->hud_stats));
 	state->disp_line = 0;
+	state->disp_last = 0;
+	state->layout = NULL;
+	state->layout_ops = NULL;
+	state->layout_nops = 0;
 	memset(state->message,0,sizeof(state->message));
 	state->message_seen = 0;
 	memset(state->errbuf,0,sizeof(state->errbuf));
@@ -825,8 +2342,14 @@ create_state(struct osdhud_state *state)
 		dup_field(font);
 		dup_field(net_iface);
 		set_field(net_speed_mbits);
+		set_field(net_top_n);
+		set_field(history_secs);
+		set_field(query_secs);
+		set_field(stream_every);
+		dup_field(snapshot_fmt);
 		dup_field(time_fmt);
 		dup_field(temp_sensor_name);
+		dup_field(layout);
 		set_field(max_temperature);
 		set_field(pos_x);
 		set_field(pos_y);
@@ -848,13 +2371,19 @@ cleanup_state(struct osdhud_state *state)
 	int i;
 
 	if (state) {
-		if (state->osds[0]) {
-			for (i = 0; i < state->nlines; i++) {
-				xosd_destroy(state->osds[i]);
-				state->osds[i] = NULL;
-			}
-			xosd_destroy(state->osd_bot);
-		}
+		if (state->hud_priv)
+			state->hud->close(state);
+		free(state->hud_lines);
+		state->hud_lines = NULL;
+		free(state->hud_arg);
+		state->hud_arg = NULL;
+		free(state->bench_spec);
+		state->bench_spec = NULL;
+		free(state->layout);
+		state->layout = NULL;
+		free(state->layout_ops);
+		state->layout_ops = NULL;
+		state->layout_nops = 0;
 		probe_cleanup(state);
 		if (state->time_fmt) {
 			free(state->time_fmt);
@@ -866,22 +2395,45 @@ cleanup_state(struct osdhud_state *state)
 		state->font = NULL;
 		free(state->net_iface);
 		state->net_iface = NULL;
-		movavg_free(state->ikbps_ma);
-		state->ikbps_ma = NULL;
-		movavg_free(state->okbps_ma);
-		state->okbps_ma = NULL;
-		movavg_free(state->ipxps_ma);
-		state->ipxps_ma = NULL;
-		movavg_free(state->opxps_ma);
-		state->opxps_ma = NULL;
-		movavg_free(state->rxdisk_ma);
-		state->rxdisk_ma = NULL;
-		movavg_free(state->wxdisk_ma);
-		state->wxdisk_ma = NULL;
-		movavg_free(state->rbdisk_ma);
-		state->rbdisk_ma = NULL;
-		movavg_free(state->wbdisk_ma);
-		state->wbdisk_ma = NULL;
+		free(state->snapshot_fmt);
+		state->snapshot_fmt = NULL;
+		while (state->nsubs)
+			drop_subscriber(state,state->nsubs - 1);
+		while (state->nclients)
+			drop_client(state,state->nclients - 1);
+		iftable_free(state->ifs);
+		state->ifs = NULL;
+		for (i = 0; i < NMETRICS; i++) {
+			int w;
+
+			for (w = 0; w < NPEAKS; w++) {
+				minmax_free(state->peaks[i][w]);
+				state->peaks[i][w] = NULL;
+			}
+			if (!state->hist)
+				rollup_free(state->rollups[i]);
+			state->rollups[i] = NULL;
+			tsz_free(state->series[i]);
+			state->series[i] = NULL;
+		}
+		movavg_set_free(state->disk_ma);
+		state->disk_ma = NULL;
+		histfile_close(state->hist);
+		state->hist = NULL;
+		free(state->hist_path);
+		state->hist_path = NULL;
+		flightrec_free(state->fr);
+		state->fr = NULL;
+		free(state->fr_dir);
+		state->fr_dir = NULL;
+		shmpage_destroy(state->page,state->page_path);
+		state->page = NULL;
+		free(state->page_path);
+		state->page_path = NULL;
+		shmpage_detach(state->follow);
+		state->follow = NULL;
+		free(state->follow_path);
+		state->follow_path = NULL;
 	}
 }
 
@@ -929,202 +2481,436 @@ split(char *str, char ***out_words)
 }
 
 /*
- * Free the results of calling split()
+ * Free the results of calling split()
+ */
+void
+free_split(int argc, char **argv)
+{
+	if (argv) {
+		int i = 0;
+
+		for (i = 0; i < argc; i++)
+			free(argv[i]);
+		free(argv);
+	}
+}
+
+void
+cleanup_daemon(struct osdhud_state *state)
+{
+	if (state->sock_fd >= 0) {
+		close(state->sock_fd);
+		if (unlink(state->sock_path))
+			syslog(LOG_ERR,"could not unlink socket %s: %s (#%d)",
+			       state->sock_path,err_str(state,errno),errno);
+		state->sock_fd = -1;
+		if (state->ev_fd >= 0) {
+			close(state->ev_fd);
+			close(state->sample_fd);
+			close(state->expire_fd);
+			close(state->sig_fd);
+			state->ev_fd = state->sample_fd = state->expire_fd =
+				state->sig_fd = -1;
+		}
+		cleanup_state(state);
+	}
+	closelog();
+}
+
+void
+clear_net_info(struct osdhud_state *state)
+{
+	clear_net_statistics(state);
+	state->net_speed_mbits = 0;
+	state->net_speed_fixed = 0;
+}
+
+/*
+ * The -k, -D, -U, -S, -N, -t, -a, -A and -C flags of state as
+ * CTL_F_xxx bits
+ */
+u_int32_t
+cmd_flags(struct osdhud_state *state)
+{
+	u_int32_t flags = 0;
+
+#define flag(ff,bb) if (state->ff) flags |= bb
+	flag(kill_server,CTL_F_KILL);
+	flag(down_hud,CTL_F_DOWN);
+	flag(up_hud,CTL_F_UP);
+	flag(stick_hud,CTL_F_STICK);
+	flag(unstick_hud,CTL_F_UNSTICK);
+	flag(toggle_mode,CTL_F_TOGGLE);
+	flag(alerts_mode,CTL_F_ALERTS);
+	flag(cancel_alerts,CTL_F_NOALERTS);
+	flag(countdown,CTL_F_COUNTDOWN);
+#undef flag
+	return flags;
+}
+
+/*
+ * Describe state as a control message.  A client only sends what it
+ * was given, as pack_message() does, but all=1 includes every setting,
+ * which is how a parsed text message is turned into the same thing.
+ * Strings in cmd point into state.
+ */
+void
+state_to_cmd(struct osdhud_state *state, struct ctl_cmd *cmd, int all)
+{
+	memset(cmd,0,sizeof(*cmd));
+#define cmd_int(tt,ff,cc) do {						\
+		if (all || (cc)) {					\
+			cmd->ff = state->ff;				\
+			cmd->present |= CTL_BIT(tt);			\
+		}							\
+	} while (0)
+#define cmd_str(tt,ff,ss) do {						\
+		if (state->ss) {					\
+			cmd->ff.s = state->ss;				\
+			cmd->ff.len = strlen(state->ss);		\
+			cmd->present |= CTL_BIT(tt);			\
+		}							\
+	} while (0)
+	cmd->flags = cmd_flags(state);
+	cmd->present |= CTL_BIT(CTL_FLAGS);
+	cmd_int(CTL_DISPLAY,display_msecs,1);
+	cmd_int(CTL_LONG_PAUSE,long_pause_msecs,1);
+	cmd_int(CTL_NET_TOP,net_top_n,state->net_top_n);
+	cmd_int(CTL_HISTORY,history_secs,state->history_secs);
+	cmd_int(CTL_QUERY,query_secs,state->query_secs);
+	cmd_int(CTL_STREAM,stream_every,state->stream_every);
+	cmd_int(CTL_MAX_TEMP,max_temperature,1);
+	if (state->net_speed_fixed) {
+		cmd->net_speed_mbits = state->net_speed_mbits;
+		cmd->present |= CTL_BIT(CTL_NET_SPEED);
+	}
+	if (state->snapshot_fmt) {
+		cmd->snapshot = strcmp(state->snapshot_fmt,"json") ?
+			CTL_SNAP_LINE : CTL_SNAP_JSON;
+		cmd->present |= CTL_BIT(CTL_SNAPSHOT);
+	}
+	cmd_str(CTL_FONT,font,font);
+	cmd_str(CTL_IFACE,iface,net_iface);
+	cmd_str(CTL_SENSOR,sensor,temp_sensor_name);
+	cmd_str(CTL_LAYOUT,layout,layout);
+	if (all)
+		cmd_str(CTL_TIME_FMT,time_fmt,time_fmt);
+#undef cmd_str
+#undef cmd_int
+}
+
+/*
+ * Carry out a control message from client.  Settings it does not
+ * mention are left alone.  Returns 1 if the HUD should change state.
+ */
+int
+apply_command(struct osdhud_state *state, int client, struct ctl_cmd *cmd)
+{
+	u_int32_t flags = cmd->flags | cmd_flags(state);
+	int retval = 0;
+
+#define has(tt) (cmd->present & CTL_BIT(tt))
+#define setparam(tt,nn,vv,ff)						\
+	do {								\
+		if (has(tt)) {						\
+			if (state->verbose)				\
+				syslog(LOG_WARNING,			\
+				       #nn" "ff" => "ff,		\
+				       state->nn,cmd->vv);		\
+			state->nn = cmd->vv;				\
+		}							\
+	} while (0)
+#define is_different(nn,vv)						\
+	(state->nn ? (!cmd->vv.len ||					\
+		      strncmp(state->nn,cmd->vv.s,cmd->vv.len) ||	\
+		      state->nn[cmd->vv.len]) : (cmd->vv.len > 0))
+#define maybe_setstrparam2(tt,nn,vv,cc)					\
+	do {								\
+		if (has(tt) && is_different(nn,vv)) {			\
+			if (state->verbose)				\
+				syslog(LOG_WARNING,			\
+				       #nn" %s => %.*s",		\
+				       NULLS(state->nn),		\
+				       cmd->vv.len,cmd->vv.s);		\
+			free(state->nn);				\
+			state->nn = cmd->vv.len ?			\
+				strndup(cmd->vv.s,cmd->vv.len) : NULL;	\
+			cc;						\
+		}							\
+	} while (0)
+#define maybe_setstrparam(tt,nn,vv) maybe_setstrparam2(tt,nn,vv,)
+
+	/* -k trumps all else */
+	if (flags & CTL_F_KILL) {
+		state->server_quit = retval = 1;
+		goto DONE;
+	}
+	/* -Q and -q are only questions */
+	if (has(CTL_QUERY) && cmd->query_secs) {
+		reply_history(state,client,cmd->query_secs);
+		goto DONE;
+	}
+	if (has(CTL_SNAPSHOT)) {
+		int json = (cmd->snapshot == CTL_SNAP_JSON);
+
+		if (has(CTL_STREAM) && (cmd->stream_every > 0))
+			add_subscriber(state,client,json,cmd->stream_every);
+		else
+			reply_snapshot(state,client,json);
+		goto DONE;
+	}
+	setparam(CTL_DISPLAY,display_msecs,display_msecs,"%d");
+	if (!state->hud_is_up || state->toggle_mode)
+		retval = 1;
+	else
+		/* hud is up: bump duration */
+		state->duration_msecs += state->display_msecs;
+	setparam(CTL_LONG_PAUSE,long_pause_msecs,long_pause_msecs,"%d");
+	maybe_setstrparam(CTL_FONT,font,font);
+	maybe_setstrparam(CTL_TIME_FMT,time_fmt,time_fmt);
+	maybe_setstrparam(CTL_SENSOR,temp_sensor_name,sensor);
+	setparam(CTL_MAX_TEMP,max_temperature,max_temperature,"%f");
+	maybe_setstrparam2(CTL_IFACE,net_iface,iface,clear_net_info(state));
+	setparam(CTL_NET_TOP,net_top_n,net_top_n,"%d");
+	setparam(CTL_HISTORY,history_secs,history_secs,"%d");
+	maybe_setstrparam2(CTL_LAYOUT,layout,layout,{
+			free(state->layout_ops);
+			state->layout_ops = NULL;
+			state->layout_nops = 0;
+		});
+
+#undef maybe_setstrparam
+#undef maybe_setstrparam2
+#undef is_different
+#undef setparam
+	if (flags & CTL_F_TOGGLE) {
+		/* -t overrides -S/-N */
+		retval = 1;
+		state->stuck = !state->stuck;
+	} else if (flags & (CTL_F_UP|CTL_F_STICK)) {
+		retval = !state->hud_is_up;
+		state->stuck = (flags & CTL_F_STICK) ? 1 : 0;
+	} else if (flags & CTL_F_DOWN)
+		retval = state->hud_is_up ? 1 : 0;
+	else if (flags & CTL_F_UNSTICK)
+		state->stuck = 0;
+	state->countdown = (flags & CTL_F_COUNTDOWN) ? 1 : 0;
+	if (flags & CTL_F_NOALERTS)
+		state->alerts_mode = 0;
+	else if (flags & CTL_F_ALERTS)
+		state->alerts_mode = 1;
+	if (has(CTL_NET_SPEED)) {
+		state->net_speed_mbits = cmd->net_speed_mbits;
+		state->net_speed_fixed = 1;
+	}
+#undef has
+DONE:
+	return retval;
+}
+
+/*
+ * Act on a message of len bytes that arrived on our control socket.
+ * It is either binary (ctlmsg.h) or, as older clients and scripts
+ * send, the client's command-line arguments; either way it ends up as
+ * a struct ctl_cmd.  client is its connection, for the options that
+ * want an answer.
+ */
+int
+handle_message(struct osdhud_state *state, int client, char *msg, int len)
+{
+	struct ctl_cmd cmd;
+	struct osdhud_state *foo = NULL;
+	int retval = 0;
+	int argc = 0;
+	char **argv = NULL;
+
+	if (len && (msg[0] == CTL_MAGIC)) {
+		if (ctl_decode(msg,len,&cmd)) {
+			syslog(LOG_WARNING,"malformed binary msg, %d bytes",
+			       len);
+			return 0;
+		}
+		retval = apply_command(state,client,&cmd);
+		goto DONE;
+	}
+	/* The message is just command-line args */
+	if (len && (msg[len-1] == '\n'))
+		msg[len-1] = 0;
+	argc = split(msg,&argv);
+	if (argc < 1) {
+		syslog(LOG_ERR,"too many args in %d bytes: '%.50s%s'",
+		       len,msg,(len>50)? "...": "");
+		cleanup_daemon(state);
+		exit(1);
+	}
+	if (state->verbose) {
+		int i = 0;
+
+		for (i = 0; i < argc; i++)
+			syslog(LOG_WARNING,"msg arg#%d: '%s'",
+			       i,argv[i]);
+	}
+	foo = create_state(state);
+	if (parse(foo,argc,argv))
+		syslog(LOG_WARNING,"parse error for '%s'",msg);
+	else {
+		state_to_cmd(foo,&cmd,1);
+		retval = apply_command(state,client,&cmd);
+	}
+	free_state(foo);
+	free_split(argc,argv);
+DONE:
+	if (state->verbose) {
+		syslog(LOG_WARNING,"done handling client");
+		syslog(LOG_WARNING,"handle_message => %d, is_up:%d",
+		       retval,state->hud_is_up);
+	}
+	return retval;
+}
+
+/*
+ * Take on everyone waiting to connect to the control socket.  Their
+ * messages are read as they arrive, so one that is slow to send holds
+ * up nobody else.
  */
 void
-free_split(int argc, char **argv)
+accept_clients(struct osdhud_state *state)
 {
-	if (argv) {
-		int i = 0;
-
-		for (i = 0; i < argc; i++)
-			free(argv[i]);
-		free(argv);
+	struct sockaddr_un cli;
+	socklen_t cli_sz;
+	struct client *cl;
+	int fd;
+
+	for (;;) {
+		cli_sz = sizeof(cli);
+		fd = accept(state->sock_fd,(struct sockaddr *)&cli,&cli_sz);
+		if (fd < 0) {
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK) &&
+			    (errno != ECONNABORTED) && (errno != EINTR))
+				syslog(LOG_WARNING,"accept(#%d) failed: %s (#%d)",
+				       state->sock_fd,err_str(state,errno),
+				       errno);
+			break;
+		}
+		if (state->verbose)
+			syslog(LOG_WARNING,"accepted client #%d, HUD is %s",
+			       fd,state->hud_is_up ? "UP": "DOWN");
+		if (state->nclients == MAX_CLIENTS) {
+			syslog(LOG_WARNING,"%d clients still sending, "
+			       "turning one away",state->nclients);
+			close(fd);
+			continue;
+		}
+		if (fcntl(fd,F_SETFL,fcntl(fd,F_GETFL) | O_NONBLOCK) < 0) {
+			syslog(LOG_WARNING,"fcntl(#%d) failed: %s (#%d)",fd,
+			       err_str(state,errno),errno);
+			close(fd);
+			continue;
+		}
+		cl = calloc(1,sizeof(*cl));
+		assert(cl);
+		cl->fd = fd;
+		cl->deadline = time_in_milliseconds() + CLIENT_TIMEOUT_MSECS;
+		state->clients[state->nclients++] = cl;
+#ifdef HAVE_EPOLL
+		watch_fd(state,fd,EPOLLIN,cl);
+#endif
 	}
 }
 
-void
-cleanup_daemon(struct osdhud_state *state)
+/*
+ * Read what the i'th connection has sent.  Once its message is
+ * complete, i.e. we have all the bytes its header promised, a newline
+ * or it has stopped sending, act on it and hang up.  Returns what
+ * handle_message() did.
+ */
+int
+read_client(struct osdhud_state *state, int i)
 {
-	if (state->sock_fd >= 0) {
-		close(state->sock_fd);
-		if (unlink(state->sock_path))
-			syslog(LOG_ERR,"could not unlink socket %s: %s (#%d)",
-			       state->sock_path,err_str(state,errno),errno);
-		state->sock_fd = -1;
-		cleanup_state(state);
+	struct client *cl = state->clients[i];
+	int n, want, retval = 0;
+	char *nl;
+
+	n = read(cl->fd,&cl->buf[cl->len],OSDHUD_MAX_MSG_SIZE - cl->len);
+	if (n < 0) {
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK) ||
+		    (errno == EINTR))
+			return 0;
+		syslog(LOG_WARNING,"error reading client: %s (#%d)",
+		       err_str(state,errno),errno);
+		drop_client(state,i);
+		return 0;
 	}
-	closelog();
+	cl->len += n;
+	cl->buf[cl->len] = 0;
+	if (cl->len && (cl->buf[0] == CTL_MAGIC)) {
+		/* binary: the header says how long it is */
+		want = ctl_msglen(cl->buf,cl->len);
+		if (want < 0) {
+			syslog(LOG_WARNING,"client #%d sent a bad header, "
+			       "dropped",cl->fd);
+			drop_client(state,i);
+			return 0;
+		}
+		if (n && (!want || (cl->len < want)))
+			return 0;	/* more to come */
+	} else if ((nl = memchr(cl->buf,'\n',cl->len)))
+		nl[1] = 0;
+	else if (cl->len == OSDHUD_MAX_MSG_SIZE) {
+		syslog(LOG_WARNING,"client #%d sent too much, dropped",cl->fd);
+		drop_client(state,i);
+		return 0;
+	} else if (n)
+		return 0;		/* more to come */
+	if (cl->len)
+		retval = handle_message(state,cl->fd,cl->buf,cl->len);
+	drop_client(state,i);
+	return retval;
 }
 
+/*
+ * Hang up on connections that have had long enough to send a message
+ */
 void
-clear_net_info(struct osdhud_state *state)
+expire_clients(struct osdhud_state *state)
 {
-	clear_net_statistics(state);
-	state->net_speed_mbits = 0;
+	unsigned long now = time_in_milliseconds();
+	int i = 0;
+
+	while (i < state->nclients) {
+		if (now >= state->clients[i]->deadline) {
+			syslog(LOG_WARNING,"client #%d too slow, dropped",
+			       state->clients[i]->fd);
+			drop_client(state,i);
+			continue;
+		}
+		i++;
+	}
 }
 
 /*
- * Attempt to receive a message via our control socket and act on it
+ * How long until the next connection runs out of time, or -1
  */
 int
-handle_message(struct osdhud_state *state)
+client_wait_msecs(struct osdhud_state *state)
 {
-	int client = -1;
-	int retval = 0;
-	struct sockaddr_un cli;
-	socklen_t cli_sz = sizeof(cli);
-
-	if (state->verbose)
-		syslog(LOG_WARNING,"accepting conn on sock # %d, HUD is %s",
-			state->sock_fd,state->hud_is_up ? "UP": "DOWN");
-	client = accept(state->sock_fd,(struct sockaddr *)&cli,&cli_sz);
-	if (client < 0)
-		syslog(LOG_WARNING,"accept(#%d) failed: %s (#%d)",
-		       state->sock_fd, err_str(state,errno), errno);
-	else {
-		/* the client just sends its command-line args to the daemon */
-		FILE *stream = fdopen(client, "r");
-		char msgbuf[OSDHUD_MAX_MSG_SIZE+1] = { 0 };
-		char *msg = fgets(msgbuf,OSDHUD_MAX_MSG_SIZE,stream);
-
-		if (!msg)
-			syslog(LOG_WARNING,"error reading client: %s (#%d)",
-				err_str(state,errno),errno);
-		else {
-			int argc = 0;
-			char **argv = NULL;
-			struct osdhud_state *foo = create_state(state);
-			size_t msglen = strlen(msg);
-
-			/* The message is just command-line args */
-			if (msglen && (msg[msglen-1] == '\n'))
-				msg[msglen-1] = 0;
-			argc = split(msg,&argv);
-			if (argc < 1) {
-				syslog(LOG_ERR,"too many args in "
-				       SIZE_T_F" bytes: '%.50s%s'",msglen,
-				       msg,(msglen>50)? "...": "");
-				cleanup_daemon(state);
-				exit(1);
-			}
-			if (state->verbose) {
-				int i = 0;
-
-				for (i = 0; i < argc; i++)
-					syslog(LOG_WARNING,"msg arg#%d: '%s'",
-					       i,argv[i]);
-			}
-			if (!argc)
-				syslog(LOG_WARNING,"malformed msg buf |%.*s|",
-					OSDHUD_MAX_MSG_SIZE,msgbuf);
-			else if (parse(foo,argc,argv))
-				syslog(LOG_WARNING,"parse error for '%s'",msg);
-			else {
-				/* Successfully parsed msg */
-
-#define setparam(nn,ff)							\
-				do {					\
-					if (state->verbose)		\
-						syslog(LOG_WARNING,	\
-						       #nn" "ff" => "ff, \
-						       state->nn,foo->nn); \
-					state->nn = foo->nn;		\
-				} while(0)
-#define setstrparam(nn)							\
-				do {					\
-					if (state->verbose)		\
-						syslog(LOG_WARNING,	\
-						       #nn" %s => %s",	\
-						       NULLS(state->nn),\
-						       NULLS(foo->nn));	\
-					free(state->nn);		\
-					state->nn = foo->nn ?		\
-						strdup(foo->nn) : NULL; \
-				} while (0)
-#define is_different(nn) (((state->nn && foo->nn) &&			\
-			   strcmp(state->nn,foo->nn)) ||		\
-			  (state->nn && !foo->nn) ||			\
-			  (!state->nn && foo->nn))
-#define maybe_setstrparam(nn)						\
-				do {					\
-					if (is_different(nn)) {		\
-						setstrparam(nn);	\
-					}				\
-				} while (0)
-#define maybe_setstrparam2(nn,cc)					\
-				do {					\
-					if (is_different(nn)) {		\
-						setstrparam(nn);	\
-						cc;			\
-					}				\
-				} while (0)
-				
-				/* -k trumps all else */
-				if (foo->kill_server) {
-					state->server_quit = retval = 1;
-					goto DONE;
-				}
-				setparam(display_msecs,"%d");
-				if (!state->hud_is_up || state->toggle_mode)
-					retval = 1;
-				else
-					/* hud is up: bump duration */
-					state->duration_msecs +=
-						state->display_msecs;
-				setparam(long_pause_msecs,"%d");
-				maybe_setstrparam(font);
-				maybe_setstrparam(time_fmt);
-				maybe_setstrparam(temp_sensor_name);
-				setparam(max_temperature,"%f");
-				maybe_setstrparam2(net_iface,
-						   clear_net_info(state));
+	unsigned long now = time_in_milliseconds();
+	unsigned long first = 0;
+	int i;
 
-#undef maybe_setstrparam2
-#undef maybe_setstrparam
-#undef is_different
-#undef setstrparam
-#undef setparam
-				if (foo->toggle_mode) {
-					/* -t overrides -S/-N */
-					foo->stick_hud = foo->unstick_hud = 0;
-					retval = 1;
-					state->stuck = !state->stuck;
-				} else if (foo->up_hud || foo->stick_hud) {
-					retval = !state->hud_is_up;
-					state->stuck = foo->stick_hud ? 1 : 0;
-				} else if (foo->down_hud)
-					retval = state->hud_is_up ? 1 : 0;
-				else if (foo->unstick_hud)
-					state->stuck = 0;
-				state->countdown = foo->countdown;
-				if (foo->cancel_alerts)
-					state->alerts_mode = 0;
-				else if (foo->alerts_mode)
-					state->alerts_mode = 1;
-				if (foo->net_speed_mbits)
-					state->net_speed_mbits = 
-						foo->net_speed_mbits;
-			}
-		DONE:
-			free_state(foo);
-			free_split(argc,argv);
-		}
-		fclose(stream);
-		close(client);
-		if (state->verbose)
-			syslog(LOG_WARNING,"done handling client");
-	}
-	if (state->verbose)
-		syslog(LOG_WARNING,"handle_message => %d, is_up:%d",
-		       retval,state->hud_is_up);
-	return retval;
+	if (!state->nclients)
+		return -1;
+	for (i = 0; i < state->nclients; i++)
+		if (!first || (state->clients[i]->deadline < first))
+			first = state->clients[i]->deadline;
+	return (first > now) ? (int)(first - now) : 0;
 }
 
 #ifdef ENABLE_ALERTS
 int
 check_alerts(struct osdhud_state *state)
 {
+	u_int32_t alerts = alert_conditions(state);
 	int nalerts = 0;
 
 	memset(state->message,0,sizeof(state->message));
@@ -1138,14 +2924,11 @@ check_alerts(struct osdhud_state *state)
 		nalerts++;					\
 	} while (0);
 
-	if (!state->battery_missing &&
-	    (state->battery_life<state->min_battery_life))
+	if (alerts & ALERT_BATTERY)
 		catmsg(TXT_ALERT_BATTERY_LOW);
-	if (state->max_load_avg &&
-	    (ipercent(state->load_avg/state->max_load_avg)>40))
+	if (alerts & ALERT_LOAD)
 		catmsg(TXT_ALERT_LOAD_HIGH);
-	if (state->max_mem_used &&
-	    (state->mem_used_percent > state->max_mem_used))
+	if (alerts & ALERT_MEM)
 		catmsg(TXT_ALERT_MEM_LOW);
 
 #undef catmsg
@@ -1154,6 +2937,76 @@ check_alerts(struct osdhud_state *state)
 }
 #endif /* ENABLE_ALERTS */
 
+/*
+ * Set the flag for a signal; check_flags() acts on it
+ */
+void
+note_signal(int signo)
+{
+	switch (signo) {
+	case SIGINT:
+	case SIGTERM:
+		interrupted = 1;
+		break;
+	case SIGHUP:
+		restart_req = 1;
+		break;
+#ifdef INFO_SIGNAL
+	case INFO_SIGNAL:
+		bang_bang = 1;
+		break;
+#endif
+	default:
+		syslog(LOG_ERR,"received unexpected signal #%d",signo);
+		break;
+	}
+}
+
+void
+handle_signal(int signo, siginfo_t *info, void *ptr)
+{
+	note_signal(info->si_signo);
+}
+
+/*
+ * Act on what signals and alerts have told us since we last looked
+ */
+void
+check_flags(struct osdhud_state *state, int *donep, int *quitp)
+{
+	int have_alerts;
+
+	if (interrupted) {
+		syslog(LOG_WARNING,"interrupted - bailing out");
+		*donep = *quitp = state->server_quit = 1;
+	}
+	if (restart_req)
+		syslog(LOG_WARNING,
+		       "restart requested - not doing anything");
+	interrupted = restart_req = 0;
+#ifdef INFO_SIGNAL
+	if (bang_bang) {
+		syslog(LOG_WARNING,"bang, bang");
+		*donep = 1;
+		if (!state->hud_is_up)
+			*quitp = 1;
+		else
+			state->duration_msecs += state->display_msecs;
+	}
+	bang_bang = 0;
+#endif
+#ifdef ENABLE_ALERTS
+	have_alerts = check_alerts(state);
+#else
+	have_alerts = 0;
+#endif /* ENABLE_ALERTS */
+	if (have_alerts && state->alerts_mode && !state->hud_is_up) {
+		*quitp = *donep = 1;
+		state->stuck = 1; /* alerts force them to unstick...? */
+	}
+}
+
+#ifndef HAVE_EPOLL
 /*
  * Pause for the appropriate amount of time given our state
  *
@@ -1188,27 +3041,58 @@ check(struct osdhud_state *state)
 		unsigned long b4;
 		int pause_secs;
 		int pause_usecs;
-		fd_set rfds;
-		int have_alerts;
+		fd_set rfds, wfds;
+		int maxfd, i, wait_msecs, client_msecs;
 
 		FD_ZERO(&rfds);
+		FD_ZERO(&wfds);
 		FD_SET(state->sock_fd,&rfds);
-		/* set up our timeout */
-		pause_secs = pause_msecs / 1000;
-		pause_usecs = (pause_msecs - (pause_secs*1000)) * 1000;
+		maxfd = state->sock_fd;
+		/* subscribers with frames queued want to be written to */
+		for (i = 0; i < state->nsubs; i++) {
+			if (!state->subs[i]->n)
+				continue;
+			FD_SET(state->subs[i]->fd,&wfds);
+			if (state->subs[i]->fd > maxfd)
+				maxfd = state->subs[i]->fd;
+		}
+		/* connections still sending want to be read */
+		for (i = 0; i < state->nclients; i++) {
+			FD_SET(state->clients[i]->fd,&rfds);
+			if (state->clients[i]->fd > maxfd)
+				maxfd = state->clients[i]->fd;
+		}
+		/* set up our timeout, shorter if a client's time is up sooner */
+		wait_msecs = pause_msecs;
+		client_msecs = client_wait_msecs(state);
+		if ((client_msecs >= 0) && (client_msecs < wait_msecs))
+			wait_msecs = client_msecs;
+		pause_secs = wait_msecs / 1000;
+		pause_usecs = (wait_msecs - (pause_secs*1000)) * 1000;
 		tout.tv_sec = pause_secs;
 		tout.tv_usec = pause_usecs;
 		/* wait for I/O on the socket or a timeout */
 		b4 = time_in_milliseconds();
-		x = select(state->sock_fd+1,&rfds,NULL,NULL,&tout);
-		if (x < 0) {                    /* error */
+		x = select(maxfd+1,&rfds,&wfds,NULL,&tout);
+		if ((x < 0) && (errno != EINTR)) {	/* error */
 			syslog(LOG_ERR,"select() => %s (#%d)",
 			       err_str(state,errno),errno);
 			cleanup_daemon(state);
 			exit(1);
-		} else if (x > 0) {
-			/* command */
-			quit_loop = handle_message(state);
+		} else if (x || (wait_msecs < pause_msecs)) {
+			if (x > 0) {
+				flush_subscribers(state,&wfds);
+				/* commands; last first, as read_client()
+				   may move the last one into slot i */
+				for (i = state->nclients - 1; i >= 0; i--)
+					if (FD_ISSET(state->clients[i]->fd,
+						     &rfds) &&
+					    read_client(state,i))
+						quit_loop = 1;
+				if (FD_ISSET(state->sock_fd,&rfds))
+					accept_clients(state);
+			}
+			expire_clients(state);
 			if (!quit_loop) {
 				/* client didn't tell us to quit so continue */
 				int dt = time_in_milliseconds() - b4;
@@ -1232,38 +3116,113 @@ check(struct osdhud_state *state)
 					quit_loop = 1;
 			} /* else done=1 will force sample and pause again */
 		}
-		/* Deal with signals-based flags */
-		if (interrupted) {
-			syslog(LOG_WARNING,"interrupted - bailing out");
-			done = quit_loop = state->server_quit = 1;
-		}
-		if (restart_req)
-			syslog(LOG_WARNING,
-			       "restart requested - not doing anything");
-		interrupted = restart_req = 0;
-#ifdef SIGINFO
-		if (bang_bang) {
-			syslog(LOG_WARNING,"bang, bang");
-			done = 1;
-			if (!state->hud_is_up)
-				quit_loop = 1;
-			else
-				state->duration_msecs += state->display_msecs;
+		check_flags(state,&done,&quit_loop);
+	} while (!done && !quit_loop);
+	return quit_loop;
+}
+#else /* HAVE_EPOLL */
+#define MAX_EVENTS (4 + MAX_SUBSCRIBERS + MAX_CLIENTS)
+
+/*
+ * How long the HUD has left to stay up, or -1 if nothing but a
+ * command will bring it down
+ */
+int
+hud_time_left(struct osdhud_state *state)
+{
+	int left;
+
+	if (!state->hud_is_up || state->toggle_mode || state->stuck)
+		return -1;
+	left = state->duration_msecs -
+		((int)time_in_milliseconds() - state->t0_msecs);
+	return (left > 0) ? left : 0;
+}
+
+/*
+ * Pause for the appropriate amount of time given our state
+ *
+ * This is the same as the select(2) version above, but with epoll(7).
+ * Samples are due at fixed intervals kept by a timer with an absolute
+ * deadline, so time spent probing and answering clients does not make
+ * them drift; the HUD coming down has a timer of its own; and signals
+ * arrive on a signalfd, so one cannot slip in between our looking at
+ * the flags and going to sleep.
+ */
+int
+check(struct osdhud_state *state)
+{
+	struct epoll_event evs[MAX_EVENTS];
+	int done = 0;
+	int quit_loop = 0;
+	int pause_msecs = state->hud_is_up ? state->short_pause_msecs :
+		state->long_pause_msecs;
+	unsigned long now = monotonic_msecs();
+	int i, n, c, left;
+
+	if (state->verbose > 1)
+		syslog(LOG_WARNING,"check: pause is %d, HUD is %s",
+			pause_msecs,state->hud_is_up ? "UP": "DOWN");
+	/*
+	 * The next sample is due a pause after the last one was, unless
+	 * we have fallen a whole pause behind or the pause just shrank
+	 */
+	if (state->next_sample <= now)
+		state->next_sample += pause_msecs;
+	if ((state->next_sample <= now) ||
+	    (state->next_sample > now + pause_msecs))
+		state->next_sample = now + pause_msecs;
+	arm_timer(state,state->sample_fd,state->next_sample);
+	do {
+		u_int64_t ticks;
+		struct signalfd_siginfo si;
+
+		left = hud_time_left(state);
+		arm_timer(state,state->expire_fd,
+			  (left < 0) ? 0 : monotonic_msecs() + left);
+		n = epoll_wait(state->ev_fd,evs,MAX_EVENTS,
+			       client_wait_msecs(state));
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			syslog(LOG_ERR,"epoll_wait() => %s (#%d)",
+			       err_str(state,errno),errno);
+			cleanup_daemon(state);
+			exit(1);
 		}
-		bang_bang = 0;
-#endif
-#ifdef ENABLE_ALERTS
-		have_alerts = check_alerts(state);
-#else
-		have_alerts = 0;
-#endif /* ENABLE_ALERTS */
-		if (have_alerts && state->alerts_mode && !state->hud_is_up) {
-			quit_loop = done = 1;
-			state->stuck = 1; /* alerts force them to unstick...? */
+		for (i = 0; i < n; i++) {
+			void *ptr = evs[i].data.ptr;
+
+			if (ptr == &state->sock_fd) {
+				accept_clients(state);
+			} else if (ptr == &state->sample_fd) {
+				/* time for another sample */
+				if (read(state->sample_fd,&ticks,
+					 sizeof(ticks)) > 0)
+					done = 1;
+			} else if (ptr == &state->expire_fd) {
+				/* time for the HUD to come down? */
+				if ((read(state->expire_fd,&ticks,
+					  sizeof(ticks)) > 0) &&
+				    !hud_time_left(state))
+					quit_loop = 1;
+			} else if (ptr == &state->sig_fd) {
+				while (read(state->sig_fd,&si,sizeof(si)) ==
+				       sizeof(si))
+					note_signal(si.ssi_signo);
+			} else if ((c = client_index(state,ptr)) >= 0) {
+				/* command */
+				if (read_client(state,c))
+					quit_loop = 1;
+			} else
+				flush_subscriber(state,ptr);
 		}
+		expire_clients(state);
+		check_flags(state,&done,&quit_loop);
 	} while (!done && !quit_loop);
 	return quit_loop;
 }
+#endif /* HAVE_EPOLL */
 
 /*
  * Turn state into equivalent command-line options to send to running instance
@@ -1271,39 +3230,40 @@ check(struct osdhud_state *state)
 int
 pack_message(struct osdhud_state *state, char **out_msg)
 {
-	int len = 1, off = 0, left = 0;
+	int len = 2, off = 0, left = 0;		/* newline and NUL */
 	char *packed = NULL;
 
-	if (state->kill_server)
-		len += 3;
-	if (state->down_hud)
-		len += 3;
-	if (state->up_hud)
-		len += 3;
-	if (state->unstick_hud)
-		len += 3;
-	if (state->stick_hud)
-		len += 3;
-	if (state->font)
-		len += 4 + strlen(state->font);
-	if (state->net_iface)
-		len += 4 + strlen(state->net_iface);
-	if (state->temp_sensor_name)
-		len += 4 + strlen(state->temp_sensor_name);
-	if (state->max_temperature)
-		len += 10;
-	if (state->pos_x != DEFAULT_POS_X)
-		len += 10;
-	if (state->pos_y != DEFAULT_POS_Y)
-		len += 10;
-	if (state->width != DEFAULT_WIDTH)
-		len += 10;
-	if (state->display_msecs)
-		len += 10;
-	if (state->short_pause_msecs)
-		len += 10;
-	if (state->long_pause_msecs)
-		len += 10;
+	/*
+	 * Room for everything emitted below: " -x" for each flag,
+	 * " -x " and the value for the rest.  PACK_NUM_LEN covers any
+	 * %d and any %f.
+	 */
+#define PACK_NUM_LEN 64
+#define count_flag(f)	if (state->f) len += 3
+#define count_str(f)	if (state->f) len += 4 + strlen(state->f)
+	count_flag(verbose);
+	count_flag(debug);
+	count_flag(kill_server);
+	count_flag(down_hud);
+	count_flag(up_hud);
+	count_flag(stick_hud);
+	count_flag(unstick_hud);
+	count_flag(toggle_mode);
+	count_flag(alerts_mode);
+	count_flag(cancel_alerts);
+	count_flag(countdown);
+	count_str(font);
+	count_str(net_iface);
+	count_str(snapshot_fmt);
+	count_str(temp_sensor_name);
+	count_str(layout);
+#undef count_flag
+#undef count_str
+	/* -X -I -H -Q -e if set, -d -p -P -M always */
+	len += PACK_NUM_LEN * (4 + !!state->net_speed_mbits +
+			       !!state->net_top_n + !!state->history_secs +
+			       !!state->query_secs + !!state->stream_every);
+#undef PACK_NUM_LEN
 	packed = (char *)malloc(len);
 	memset((void *)packed,0,len);
 	off = 0;
@@ -1313,7 +3273,7 @@ pack_message(struct osdhud_state *state, char **out_msg)
 #define single_opt(f,o)                                                 \
 	if (state->f) {							\
 		int x = snprintf(&packed[off],left,"%s-%s",lead,o);	\
-		if (x < 0)						\
+		if ((x < 0) || (x >= left))				\
 			die(state,"pack: " o " failed !?");		\
 		off += x;						\
 		left -= x;						\
@@ -1321,7 +3281,7 @@ pack_message(struct osdhud_state *state, char **out_msg)
 #define integer_opt(f,o)                                                \
 	do  {								\
 		int x=snprintf(&packed[off],left,"%s-%s %d",lead,o,state->f); \
-		if (x < 0)						\
+		if ((x < 0) || (x >= left))				\
 			die(state,"pack: " o " failed !?");		\
 		off += x;						\
 		left -= x;						\
@@ -1329,7 +3289,7 @@ pack_message(struct osdhud_state *state, char **out_msg)
 #define float_opt(f,o)							\
 	do  {								\
 		int x=snprintf(&packed[off],left,"%s-%s %f",lead,o,state->f); \
-		if (x < 0)						\
+		if ((x < 0) || (x >= left))				\
 			die(state,"pack: " o " failed !?");		\
 		off += x;						\
 		left -= x;						\
@@ -1337,7 +3297,7 @@ pack_message(struct osdhud_state *state, char **out_msg)
 #define string_opt(f,o)                                                 \
 	if (state->f) {							\
 		int x=snprintf(&packed[off],left,"%s-%s %s",lead,o,state->f); \
-		if (x < 0)						\
+		if ((x < 0) || (x >= left))				\
 			die(state,"pack: " o " failed !?");		\
 		off += x;						\
 		left -= x;						\
@@ -1359,10 +3319,24 @@ pack_message(struct osdhud_state *state, char **out_msg)
 	if (state->net_speed_mbits) {
 		integer_opt(net_speed_mbits,"X");
 	}
+	if (state->net_top_n) {
+		integer_opt(net_top_n,"I");
+	}
+	if (state->history_secs) {
+		integer_opt(history_secs,"H");
+	}
+	if (state->query_secs) {
+		integer_opt(query_secs,"Q");
+	}
+	string_opt(snapshot_fmt,"q");
+	if (state->stream_every) {
+		integer_opt(stream_every,"e");
+	}
 	integer_opt(display_msecs,"d");
 	integer_opt(short_pause_msecs,"p");
 	integer_opt(long_pause_msecs,"P");
 	string_opt(temp_sensor_name,"m");
+	string_opt(layout,"L");
 	float_opt(max_temperature,"M");
 
 #undef string_opt
@@ -1376,6 +3350,45 @@ pack_message(struct osdhud_state *state, char **out_msg)
 	return strlen(packed);
 }
 
+/*
+ * Push the message this client would send through handle_message(),
+ * as text and as binary, to see how many of each we can take a second
+ */
+void
+bench_msg(struct osdhud_state *state, int iters)
+{
+	struct ctl_cmd cmd;
+	char bin[CTL_MAX_LEN];
+	char buf[OSDHUD_MAX_MSG_SIZE+1];
+	unsigned long long t0, text_ns, bin_ns;
+	char *text = NULL;
+	int i, tlen, blen;
+
+	tlen = pack_message(state,&text);
+	state_to_cmd(state,&cmd,0);
+	blen = ctl_encode(&cmd,bin,sizeof(bin));
+	assert((tlen < sizeof(buf)) && (blen > 0));
+	t0 = bench_nsecs();
+	for (i = 0; i < iters; i++) {
+		/* handle_message() writes on text messages */
+		memcpy(buf,text,tlen + 1);
+		(void) handle_message(state,-1,buf,tlen);
+	}
+	text_ns = bench_nsecs() - t0;
+	bench_report("msg_text",iters,1,text_ns);
+	t0 = bench_nsecs();
+	for (i = 0; i < iters; i++) {
+		memcpy(buf,bin,blen);
+		(void) handle_message(state,-1,buf,blen);
+	}
+	bin_ns = bench_nsecs() - t0;
+	bench_report("msg_binary",iters,1,bin_ns);
+	printf("%-16s %8.0f msgs/sec text %8.0f msgs/sec binary "
+	       "(%d vs %d bytes)\n","handle_message",iters * 1e9 / text_ns,
+	       iters * 1e9 / bin_ns,tlen,blen);
+	free(text);
+}
+
 /*
  * Try to kick an existing instance of ourselves
  *
@@ -1397,13 +3410,18 @@ int kicked(struct osdhud_state *state)
 	}
 	if (!connect(sock_fd, (struct sockaddr *)&state->addr,
 		     sizeof(state->addr))) {
+		struct ctl_cmd cmd;
+		char buf[CTL_MAX_LEN];
 		int len = 0;
 		char *msg = NULL;
 		int nw = -1;
 
-		/* we use command-line args as our rpc format */
-		len = pack_message(state,&msg);
-		nw = write(sock_fd,msg,len);
+		state_to_cmd(state,&cmd,0);
+		len = ctl_encode(&cmd,buf,sizeof(buf));
+		if (len < 0)
+			/* too big for a binary message: send our args */
+			len = pack_message(state,&msg);
+		nw = write(sock_fd,msg ? msg : buf,len);
 		if (nw != len) {
 			if (nw < 0)
 				perror("write to server");
@@ -1414,6 +3432,22 @@ int kicked(struct osdhud_state *state)
 			exit(1);
 		}
 		free(msg);
+		if (state->query_secs || state->snapshot_fmt) {
+			/* -Q, -q: the daemon answers and hangs up; with -e
+			   it goes on answering until one of us goes away */
+			char buf[1024];
+			int nr;
+
+			(void) shutdown(sock_fd,SHUT_WR);
+			while ((nr = read(sock_fd,buf,sizeof(buf))) > 0) {
+				fwrite(buf,1,nr,stdout);
+				fflush(stdout);
+			}
+			if (nr < 0) {
+				perror("read from server");
+				exit(1);
+			}
+		}
 		close(sock_fd);
 		return 1;
 	}
@@ -1460,76 +3494,25 @@ forked(struct osdhud_state *state)
 	return 1;
 }
 
-xosd *
-create_big_osd(struct osdhud_state *state, char *font)
-{
-	xosd *osd;
-
-	osd = xosd_create(1);
-	if (!osd) {
-		SPEWE("could not create osd display");
-		exit(1);
-	}
-	xosd_set_font(osd,font);
-	xosd_set_outline_offset(osd,1);
-	xosd_set_shadow_offset(osd,4);
-	xosd_set_outline_colour(osd,"black");
-	xosd_set_align(osd,XOSD_left);
-	xosd_set_pos(osd,XOSD_top);
-	xosd_set_horizontal_offset(osd,state->pos_x);
-	xosd_set_vertical_offset(osd,state->pos_y +
-				 (state->line_height * state->nlines++));
-	xosd_set_bar_length(osd,state->width);
-
-	return osd;
-}
-
-xosd *
-create_small_osd(struct osdhud_state *state, char *font)
-{
-	xosd *osd = xosd_create(1);
-
-	if (!osd) {
-		SPEWE("could not create second osd display");
-		exit(1);
-	}
-	xosd_set_font(osd,font);
-	xosd_set_outline_offset(osd,1);
-	xosd_set_shadow_offset(osd,4);
-	xosd_set_outline_colour(osd,"black");
-	xosd_set_align(osd,XOSD_right);
-	xosd_set_pos(osd,XOSD_bottom);
-
-	return osd;
-}
-
 void
 hud_up(struct osdhud_state *state)
 {
 	char *font = state->font ? state->font : DEFAULT_FONT;
-	int i;
 
 	if (state->verbose > 1)
 		syslog(LOG_WARNING,"HUD coming up");
 
-	if (!state->osds[0]) {
-		for (i = 0; i < ARRAY_SIZE(state->osds); i++) {
-			state->osds[i] = create_big_osd(state,font);
-			assert(state->osds[i]);
-			xosd_hide(state->osds[i]);
-		}
-		state->osd_bot = create_small_osd(state,font);
-		xosd_hide(state->osd_bot);
-	}
-	for (i = 0; i < state->nlines; i++)
-		if (xosd_show(state->osds[i])) {
-			syslog(LOG_ERR,"xosd_show failed #%d: %s",i,xosd_error);
+	if (!state->hud_priv) {
+		if (state->hud->open(state,font)) {
+			syslog(LOG_ERR,"could not open the %s display",
+			       state->hud->name);
 			exit(1);
 		}
-	if (xosd_show(state->osd_bot)) {
-		syslog(LOG_ERR,"xosd_show failed (#2): %s",xosd_error);
-		exit(1);
+		state->nlines = NLINES;
+		hud_invalidate(state);
 	}
+	if (state->hud->show(state))
+		exit(1);
 
 	state->hud_is_up = 1;
 	state->t0_msecs = time_in_milliseconds();
@@ -1539,40 +3522,20 @@ hud_up(struct osdhud_state *state)
 void
 hud_down(struct osdhud_state *state)
 {
-	int i;
-
 	if (state->verbose)
-		syslog(LOG_WARNING,"HUD coming down");
+		syslog(LOG_WARNING,"HUD coming down; %llu frames so far, "
+		       "%llu lines drawn, %llu unchanged, %llu requests",
+		       (unsigned long long)state->hud_stats.frames,
+		       (unsigned long long)state->hud_stats.lines,
+		       (unsigned long long)state->hud_stats.skipped,
+		       (unsigned long long)state->hud_stats.requests);
 
-	for (i = 0; i < state->nlines; i++)
-		xosd_hide(state->osds[i]);
-	xosd_hide(state->osd_bot);
+	if (state->hud_priv)
+		state->hud->hide(state);
 
 	state->hud_is_up = 0;
 }
 
-void
-handle_signal(int signo, siginfo_t *info, void *ptr)
-{
-	switch (info->si_signo) {
-	case SIGINT:
-	case SIGTERM:
-		interrupted = 1;
-		break;
-	case SIGHUP:
-		restart_req = 1;
-		break;
-#ifdef SIGINFO
-	case SIGINFO:
-		bang_bang = 1;
-		break;
-#endif
-	default:
-		syslog(LOG_ERR,"received unexpected signal #%d",info->si_signo);
-		break;
-	}
-}
-
 void
 init_signals(struct osdhud_state *state)
 {
@@ -1587,16 +3550,25 @@ init_signals(struct osdhud_state *state)
 		die(state,err_str(state,errno));
 	if (sigaction(SIGTERM,&sact,NULL))
 		die(state,err_str(state,errno));
-#ifdef SIGINFO
-	if (sigaction(SIGINFO,&sact,NULL))
+#ifdef INFO_SIGNAL
+	if (sigaction(INFO_SIGNAL,&sact,NULL))
 		die(state,err_str(state,errno));
 #endif
+	/* subscribers that hang up show up as EPIPE instead */
+	signal(SIGPIPE,SIG_IGN);
 }
 
+/*
+ * Set up everything probe() and display() need, short of the socket
+ * and the event loop; -B frame uses this on its own
+ */
 void
-setup_daemon(struct osdhud_state *state)
+setup_probes(struct osdhud_state *state)
 {
-	int syslog_flags = LOG_PID, i;
+	static const unsigned long peak_spans[NPEAKS] = {
+		10 * 1000, SECSPERMIN * 1000, 15 * SECSPERMIN * 1000
+	};
+	int i, w;
 
 	if (gethostname(state->hostname,sizeof(state->hostname))) {
 		perror("gethostname");
@@ -1607,6 +3579,41 @@ setup_daemon(struct osdhud_state *state)
 			state->hostname[i] = 0;
 			break;
 		}
+	state->last_t = state->first_t = time_in_milliseconds();
+	state->mono_t = monotonic_msecs();
+	if (!state->ifs)
+		state->ifs = iftable_new(state->net_movavg_wsize);
+	state->disk_ma = movavg_set_new(4,state->net_movavg_wsize);
+	for (i = 0; i < NMETRICS; i++)
+		for (w = 0; w < NPEAKS; w++)
+			state->peaks[i][w] = minmax_new(peak_spans[w]);
+	for (i = 0; i < NMETRICS; i++)
+		state->series[i] = tsz_new(SERIES_SECS * 1000UL,
+					   SERIES_MAX_BYTES);
+	if (state->hist_path)
+		open_history(state);
+	if (state->fr_dir)
+		state->fr = flightrec_new(state->fr_dir);
+	if (state->page_path) {
+		char errbuf[1024];
+
+		state->page = shmpage_create(state->page_path,errbuf,
+					     sizeof(errbuf));
+		if (!state->page)
+			syslog(LOG_WARNING,"no page published: %s",errbuf);
+	}
+	for (i = 0; i < NMETRICS && !state->hist; i++)
+		state->rollups[i] = rollup_new();
+
+	if (!state->follow_path)
+		probe_init(state);          /* per-OS probe init */
+}
+
+void
+setup_daemon(struct osdhud_state *state)
+{
+	int syslog_flags = LOG_PID;
+
 	if (state->foreground)
 		syslog_flags |= LOG_PERROR;
 	openlog(state->argv0,syslog_flags,LOG_LOCAL0);
@@ -1628,19 +3635,72 @@ setup_daemon(struct osdhud_state *state)
 		perror("listen");
 		exit(1);
 	}
+	if (fcntl(state->sock_fd,F_SETFL,
+		  fcntl(state->sock_fd,F_GETFL) | O_NONBLOCK) < 0) {
+		perror("fcntl");
+		exit(1);
+	}
 	if (chmod(state->addr.sun_path,0700)) {
 		perror("chmod");
 		exit(1);
 	}
 	init_signals(state);
+#ifdef HAVE_EPOLL
+	init_events(state);
+#endif
 
-	state->last_t = state->first_t = time_in_milliseconds();
-	state->ikbps_ma = movavg_new(state->net_movavg_wsize);
-	state->okbps_ma = movavg_new(state->net_movavg_wsize);
-	state->ipxps_ma = movavg_new(state->net_movavg_wsize);
-	state->opxps_ma = movavg_new(state->net_movavg_wsize);
+	setup_probes(state);
+}
+
+/*
+ * The daemon's work for one frame with the HUD up, probe() and then
+ * display(), always drawing with the null backend so that only our
+ * own cost is measured; -b null:path records the frames too.  We do
+ * not wait between frames, so probe() is told that -p msecs have
+ * passed each time; otherwise it would mostly see no time pass and
+ * skip working out the rates.
+ */
+void
+bench_frame(struct osdhud_state *state, int iters)
+{
+	unsigned long long t0, t1, probe_ns = 0, disp_ns = 0;
+	long long a0, a1, probe_allocs_n = 0, disp_allocs_n = 0;
+	int counted = (probe_allocs() >= 0);
+	unsigned long now;
+	int i;
 
-	probe_init(state);                  /* per-OS probe init */
+	state->hud = &hud_null;
+	setup_probes(state);
+	hud_up(state);
+	now = state->mono_t + state->short_pause_msecs;
+	probe(state,now);		/* so that rates have a baseline */
+	for (i = 0; i < iters; i++) {
+		now += state->short_pause_msecs;
+		a0 = probe_allocs();
+		t0 = bench_nsecs();
+		probe(state,now);
+		t1 = bench_nsecs();
+		a1 = probe_allocs();
+		probe_ns += t1 - t0;
+		probe_allocs_n += a1 - a0;
+		display(state);
+		disp_ns += bench_nsecs() - t1;
+		disp_allocs_n += probe_allocs() - a1;
+	}
+	bench_report("frame_probe",iters,1,probe_ns);
+	bench_report("frame_display",iters,1,disp_ns);
+	bench_report("frame",iters,1,probe_ns + disp_ns);
+	if (!counted)
+		printf("%-16s not counted in this build\n","allocs/frame");
+	else
+		printf("%-16s %8.2f probe %8.2f display\n","allocs/frame",
+		       (double)probe_allocs_n / iters,
+		       (double)disp_allocs_n / iters);
+	printf("%-16s %8.2f drawn %8.2f unchanged\n","lines/frame",
+	       (double)state->hud_stats.lines / state->hud_stats.frames,
+	       (double)state->hud_stats.skipped / state->hud_stats.frames);
+	hud_down(state);
+	cleanup_state(state);
 }
 
 /*
@@ -1673,6 +3733,8 @@ main(int argc, char **argv)
 	init_state(&state,argv[0]);
 	if (parse(&state,argc,argv))
 		exit(1);  /* already complained to stderr */
+	if (state.bench_spec)
+		benchmark(&state,state.bench_spec);	/* does not return */
 #ifdef HAVE_SETPROCTITLE
 	setproctitle("v.%s",VERSION);
 #endif
@@ -1700,6 +3762,9 @@ main(int argc, char **argv)
 		/* Already running: sent existing process a message */
 		if (state.verbose)
 			printf("%s: kicked existing osdhud\n",state.argv0);
+	} else if (state.query_secs || state.snapshot_fmt) {
+		fprintf(stderr,"%s: no daemon to ask\n",state.argv0);
+		exit(1);
 	} else if (forked(&state)) {
 		/* Everything in here spews to syslog */
 		setup_daemon(&state);
@@ -1708,7 +3773,8 @@ main(int argc, char **argv)
 		do {
 			int toggle = 0;
 
-			probe(&state);
+			probe(&state,monotonic_msecs());
+			publish(&state);
 			if (state.hud_is_up)
 				display(&state);
 			toggle = check(&state);
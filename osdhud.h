@@ -21,6 +21,9 @@
 #if defined(__OpenBSD__) || defined(__FreeBSD__)
 # define HAVE_SETPROCTITLE 1
 #endif
+#ifdef __linux__
+# define HAVE_EPOLL 1
+#endif
 
 #define SECSPERMIN      60
 #define SECSPERHOUR     (SECSPERMIN*60)
@@ -32,37 +35,71 @@
 #define ARRAY_SIZE(aa) (sizeof(aa)/sizeof(aa[0]))
 #define NULLS(_x_) ((_x_) ? (_x_) : "NULL")
 #define MAX_ALERTS_SIZE 1024
+#define MAX_NET_TOP 4			/* most interfaces -I can show */
+#define MAX_SUBSCRIBERS 16		/* clients streaming with -e */
+#define MAX_CLIENTS 32			/* connections still sending */
+#define CLIENT_TIMEOUT_MSECS 2000	/* ... and how long they have */
+#define MAX_HISTORY_SECS (60*SECSPERHOUR) /* what the coarsest rollup holds */
+#define SERIES_SECS SECSPERDAY		/* full-resolution history kept */
+#define SERIES_MAX_BYTES (2*1024*1024)	/* per metric */
 
 #define NLINES 16
 
+/*
+ * Metrics we keep history for, and the windows we track their
+ * extremes over
+ */
+#define METRIC_LOAD	0
+#define METRIC_MEM	1
+#define METRIC_SWAP	2
+#define METRIC_NET_KBPS	3
+#define METRIC_NET_PXPS	4
+#define METRIC_TEMP	5
+#define NMETRICS	6
+
+#define ALERT_BATTERY	0x1		/* bits of alert_conditions() */
+#define ALERT_LOAD	0x2
+#define ALERT_MEM	0x4
+
+#define PEAK_10S	0
+#define PEAK_1M		1
+#define PEAK_15M	2
+#define NPEAKS		3
+
 /*
  * Application state
  */
 struct osdhud_state {
-	int		 kill_server:1;
-	int		 down_hud:1;
-	int		 up_hud:1;
-	int		 stick_hud:1;
-	int		 unstick_hud:1;
-	int		 foreground:1;
-	int		 hud_is_up:1;
-	int		 server_quit:1;
-	int		 stuck:1;
-	int		 debug:1;
-	int		 countdown:1;
-	int		 quiet_at_start:1;
-	int		 toggle_mode:1;
-	int		 alerts_mode:1;
-	int		 cancel_alerts:1;
+	unsigned int	 kill_server:1;
+	unsigned int	 down_hud:1;
+	unsigned int	 up_hud:1;
+	unsigned int	 stick_hud:1;
+	unsigned int	 unstick_hud:1;
+	unsigned int	 foreground:1;
+	unsigned int	 hud_is_up:1;
+	unsigned int	 server_quit:1;
+	unsigned int	 stuck:1;
+	unsigned int	 debug:1;
+	unsigned int	 countdown:1;
+	unsigned int	 quiet_at_start:1;
+	unsigned int	 toggle_mode:1;
+	unsigned int	 alerts_mode:1;
+	unsigned int	 cancel_alerts:1;
 	char		*argv0;
 	char		 hostname[128];
 	int		 pid;
 	char		*sock_path;
 	struct		 sockaddr_un addr;
 	int		 sock_fd;
+	int		 ev_fd;		/* epoll, if we HAVE_EPOLL */
+	int		 sample_fd;	/* timerfd: next sample is due */
+	int		 expire_fd;	/* timerfd: HUD's time is up */
+	int		 sig_fd;	/* signalfd */
+	unsigned long	 next_sample;	/* monotonic msecs */
 	char		*font;
 	char		*net_iface;
 	int		 net_speed_mbits;
+	unsigned int	 net_speed_fixed:1;	/* -X given, don't probe */
 	char		*time_fmt;
 	char		*temp_sensor_name;
 	double		 temperature;
@@ -92,45 +129,83 @@ struct osdhud_state {
 	int		 verbose;
 	float		 load_avg;
 	void		*per_os_data;
-	struct		 movavg *ikbps_ma;
+	struct		 iftable *ifs;	/* rates for every interface */
+	int		 net_top_n;	/* -I: busiest interfaces shown */
 	float		 net_ikbps;
-	struct		 movavg *okbps_ma;
 	float		 net_okbps;
-	struct		 movavg *ipxps_ma;
 	float		 net_ipxps;
-	struct		 movavg *opxps_ma;
 	float		 net_opxps;
-	float		 net_peak_kbps;
-	float		 net_peak_pxps;
-	struct		 movavg *rxdisk_ma;
+	struct		 minmax *peaks[NMETRICS][NPEAKS];
+	struct		 rollup *rollups[NMETRICS]; /* 1s..1h history */
+	struct		 tsz *series[NMETRICS];	/* every sample, compressed */
+	char		*hist_path;	/* -R: keep history here */
+	struct		 histfile *hist; /* ... mapped; owns the rollups */
+	char		*fr_dir;	/* -W: flight recordings go here */
+	struct		 flightrec *fr;
+	char		*page_path;	/* -O: publish probe results here */
+	struct		 shmpage *page;
+	char		*follow_path;	/* -c: render a collector's page */
+	struct		 shmpage *follow; /* ... attached, or NULL if gone */
+	u_int64_t	 follow_seen;	/* its nprobes when last read */
+	int		 follow_lost;	/* complained that it is gone */
+	int		 follow_still;	/* probes since nprobes last moved */
+	dev_t		 follow_dev;	/* what follow_path was at attach */
+	ino_t		 follow_ino;
+	u_int32_t	 alerts;	/* ALERT_xxx bits as of last probe */
+	int		 history_secs;	/* -H: span of the history line */
+	int		 query_secs;	/* -Q: ask the daemon for history */
+	char		*snapshot_fmt;	/* -q: ask it for a snapshot */
+	int		 stream_every;	/* -e: ... every n probes, forever */
+	struct		 subscriber *subs[MAX_SUBSCRIBERS];
+	int		 nsubs;
+	struct		 client *clients[MAX_CLIENTS];
+	int		 nclients;
+	struct		 movavg_set *disk_ma; /* rbytes wbytes reads writes */
 	float		 disk_rkbps;
-	struct		 movavg *wxdisk_ma;
 	float		 disk_wkbps;
-	struct		 movavg *rbdisk_ma;
 	float		 disk_rxps;
-	struct		 movavg *wbdisk_ma;
 	float		 disk_wxps;
 	float		 mem_used_percent;
 	float		 swap_used_percent;
-	int		 battery_missing:1;
+	unsigned int	 battery_missing:1;
 	int		 battery_life;
 	char		 battery_state[32];
 	int		 battery_time;
 	time_t		 uptime_secs;
-        time_t		 last_t;
+        time_t		 last_t;	/* wall msecs of the latest probe */
+	unsigned long	 mono_t;	/* ... monotonic msecs, for rates */
 	time_t		 first_t;
 	time_t		 sys_uptime;
-	int		 message_seen:1;
+	unsigned int	 message_seen:1;
 	char		 message[MAX_ALERTS_SIZE];
-	xosd		*osds[NLINES];
+	struct hud_backend *hud;	/* -b */
+	char		*hud_arg;	/* -b name:arg */
+	char		*bench_spec;	/* -B name[:iterations] */
+	void		*hud_priv;	/* whatever hud keeps */
+	struct hud_line	*hud_lines;	/* NLINES of them plus the meta line */
+	struct hud_stats hud_stats;
 	int		 disp_line;
-	xosd	        *osd_bot;
+	int		 disp_last;	/* disp_line after the last frame */
+	char		*layout;	/* -L, NULL for DEFAULT_LAYOUT */
+	struct hud_op	*layout_ops;	/* layout, compiled */
+	int		 layout_nops;
 	char		 errbuf[1024];
 };
 
 #define KILO 1024
 #define MEGA (KILO*KILO)
 #define OSDHUD_MAX_MSG_SIZE 2048
+
+/*
+ * A connection on the control socket whose message has not all
+ * arrived yet
+ */
+struct client {
+	int		 fd;		/* non-blocking */
+	int		 len;		/* bytes in buf */
+	unsigned long	 deadline;	/* msecs: the rest must be here by then */
+	char		 buf[OSDHUD_MAX_MSG_SIZE+1];
+};
 /* XXX this introduces a dep on fonts/terminus; default should be in base */
 #define DEFAULT_FONT "-xos4-terminus-medium-r-normal--32-320-72-72-c-160-iso8859-1"
 /*#define DEFAULT_FONT "-adobe-helvetica-bold-r-normal-*-*-320-*-*-p-*-*-*"*/
@@ -143,12 +218,16 @@ struct osdhud_state {
 /*#define DEFAULT_LONG_PAUSE 1800*/
 #define DEFAULT_LONG_PAUSE DEFAULT_SHORT_PAUSE
 #define DEFAULT_TIME_FMT "%Y-%m-%d %H:%M:%S"
+#define DEFAULT_LAYOUT "uptime,load,mem,swap,net,top,history,disk,battery,temp,message"
 #define DEFAULT_NET_MOVAVG_WSIZE 6
 #define DEFAULT_NSWAP 1
 #define DEFAULT_MIN_BATTERY_LIFE 10
 #define DEFAULT_MAX_LOAD_AVG 0.0
 #define DEFAULT_MAX_MEM_USED 0.9
 #define DEFAULT_MAX_TEMPERATURE 120
+#define DEFAULT_BENCH_ITERS 10000
+#define FOLLOW_STALE_PROBES 10	/* still, before we check the collector */
+#define BENCH_NSERIES 600		/* -B movavg: 100 ifaces x 6 rates */
 
 #define DBG1(fmt,arg1)                                                  \
     if (state->debug) {                                                 \
@@ -234,12 +313,15 @@ struct osdhud_state {
 
 /*
  * Per-OS modules call in to these functions to report their
- * statistics for network and disk
+ * statistics for network and disk.  Counters for every interface
+ * should be reported, with watched set for those selected by -i.
  */
 
-void update_net_statistics(struct osdhud_state *state, u_int64_t delta_ibytes,
-			   u_int64_t delta_obytes, u_int64_t delta_ipackets,
-			   u_int64_t delta_opackets);
+void update_net_statistics(struct osdhud_state *state, int ifindex,
+			   char *name, struct ifcounters *counters,
+			   int watched);
+void forget_net_interface(struct osdhud_state *state, int ifindex);
+int net_watched(struct osdhud_state *state, int ifindex, const char *name);
 
 void update_disk_statistics(struct osdhud_state *state, u_int64_t delta_rbytes,
 			    u_int64_t delta_wbytes, u_int64_t delta_reads,
@@ -261,7 +343,14 @@ void probe_battery(struct osdhud_state *);
 void probe_temperature(struct osdhud_state *);
 void probe_uptime(struct osdhud_state *);
 
+unsigned long long bench_nsecs(void);
+void bench_report(char *, int, int, unsigned long long);
+void bench_msg(struct osdhud_state *, int); /* with the control code */
+void bench_frame(struct osdhud_state *, int); /* with the daemon setup */
+
 void print_temperature_sensors(void); /* exported from per-os as well */
+int probe_benchmark(struct osdhud_state *, char *, int); /* ditto, for -B */
+long long probe_allocs(void); /* ditto: malloc() calls so far, -1 if unknown */
 
 /*
  * Local variables:
@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2015 by attila <attila@stalphonsos.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Keep count/sum/min/max of a metric at several resolutions at once.
+ *
+ * Every sample is added to the current cell of every level, which is
+ * a constant amount of work; there is no folding of fine cells into
+ * coarse ones.  A level moves on to its next cell when a sample
+ * arrives in a later interval, clearing any cells skipped over.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rollup.h"
+
+const unsigned long rollup_res[ROLLUP_LEVELS] = {
+	1000, 10 * 1000, 60 * 1000, 10 * 60 * 1000, 60 * 60 * 1000
+};
+
+/*
+ * Allocate an empty rollup
+ */
+struct rollup *
+rollup_new(void)
+{
+	struct rollup *ru = malloc(sizeof(*ru));
+
+	assert(ru);
+	rollup_clear(ru);
+	return ru;
+}
+
+/*
+ * Tear down a rollup
+ */
+void
+rollup_free(struct rollup *ru)
+{
+	free(ru);
+}
+
+/*
+ * Forget all history
+ */
+void
+rollup_clear(struct rollup *ru)
+{
+	if (ru)
+		memset(ru,0,sizeof(*ru));
+}
+
+/*
+ * Move level l on to the cell for the interval starting at start
+ */
+static struct rollup_cell *
+advance(struct rollup *ru, int l, unsigned long start)
+{
+	struct rollup_cell *cell = &ru->cells[l][ru->cur[l]];
+	unsigned long res = rollup_res[l];
+	unsigned long n;
+
+	if (!cell->count || (start < cell->start))
+		n = 1;			/* empty, or the clock went back */
+	else
+		n = (start - cell->start) / res;
+	if (n > ROLLUP_CELLS)
+		n = ROLLUP_CELLS;
+	while (n--) {
+		ru->cur[l] = (ru->cur[l] + 1) % ROLLUP_CELLS;
+		cell = &ru->cells[l][ru->cur[l]];
+		memset(cell,0,sizeof(*cell));
+		cell->start = start - n * res;
+	}
+	return cell;
+}
+
+/*
+ * Add a sample seen at time now (milliseconds)
+ */
+void
+rollup_add(struct rollup *ru, unsigned long now, float val)
+{
+	int l;
+
+	if (!ru)
+		return;
+	for (l = 0; l < ROLLUP_LEVELS; l++) {
+		unsigned long start = now - (now % rollup_res[l]);
+		struct rollup_cell *cell = &ru->cells[l][ru->cur[l]];
+
+		if (!cell->count || (cell->start != start))
+			cell = advance(ru,l,start);
+		if (!cell->count || (val < cell->min))
+			cell->min = val;
+		if (!cell->count || (val > cell->max))
+			cell->max = val;
+		cell->sum += val;
+		cell->count++;
+	}
+}
+
+/*
+ * Summarize the span milliseconds before now using the finest level
+ * that covers all of it.  Returns the number of samples found, which
+ * is zero if we know nothing about that span.
+ */
+int
+rollup_query(struct rollup *ru, unsigned long now, unsigned long span,
+	     struct rollup_stats *st)
+{
+	unsigned long oldest;
+	double sum = 0;
+	int l, i, ncells;
+
+	memset(st,0,sizeof(*st));
+	if (!ru)
+		return 0;
+	for (l = 0; l < ROLLUP_LEVELS - 1; l++)
+		if (rollup_res[l] * ROLLUP_CELLS >= span)
+			break;
+	ncells = (span + rollup_res[l] - 1) / rollup_res[l];
+	if (ncells > ROLLUP_CELLS)
+		ncells = ROLLUP_CELLS;
+	if (ncells < 1)
+		ncells = 1;
+	oldest = now - (now % rollup_res[l]) - (ncells - 1) * rollup_res[l];
+	st->level = l;
+	for (i = 0; i < ncells; i++) {
+		int off = (ru->cur[l] - i + ROLLUP_CELLS) % ROLLUP_CELLS;
+		struct rollup_cell *cell = &ru->cells[l][off];
+
+		if (!cell->count || (cell->start < oldest) ||
+		    (cell->start > now))
+			continue;
+		if (!st->count || (cell->min < st->min))
+			st->min = cell->min;
+		if (!st->count || (cell->max > st->max))
+			st->max = cell->max;
+		st->count += cell->count;
+		sum += cell->sum;
+	}
+	if (st->count)
+		st->avg = sum / st->count;
+	return st->count;
+}
+
+/*
+ * Local variables:
+ * mode: c
+ * c-file-style: "bsd"
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ */
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2015 by attila <attila@stalphonsos.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define ROLLUP_LEVELS	5		/* 1s 10s 1m 10m 1h */
+#define ROLLUP_CELLS	60		/* cells kept per level */
+
+/*
+ * What we know about one interval at one resolution
+ */
+struct rollup_cell {
+	unsigned long	 start;		/* msecs, multiple of the resolution */
+	unsigned int	 count;		/* #of samples; 0 => empty */
+	float		 min;
+	float		 max;
+	double		 sum;
+};
+
+/*
+ * History of one metric at every resolution.  Each level is a ring of
+ * ROLLUP_CELLS cells, so the whole thing is a fixed size and covers 60
+ * seconds at 1s resolution up to 60 hours at 1h resolution.
+ */
+struct rollup {
+	struct rollup_cell cells[ROLLUP_LEVELS][ROLLUP_CELLS];
+	int		 cur[ROLLUP_LEVELS];	/* cell being filled */
+};
+
+/*
+ * The answer to a query
+ */
+struct rollup_stats {
+	unsigned int	 count;
+	float		 min;
+	float		 max;
+	float		 avg;
+	int		 level;		/* which resolution answered */
+};
+
+extern const unsigned long rollup_res[ROLLUP_LEVELS]; /* msecs per cell */
+
+/*
+ * API
+ */
+struct rollup *rollup_new(void);
+void rollup_free(struct rollup *);
+void rollup_clear(struct rollup *);
+void rollup_add(struct rollup *, unsigned long, float);
+int rollup_query(struct rollup *, unsigned long, unsigned long,
+		 struct rollup_stats *);
+
+/*
+ * Local variables:
+ * mode: c
+ * c-file-style: "bsd"
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ */
@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2015 by attila <attila@stalphonsos.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A page of the latest probe results, shared through a file that
+ * readers mmap(2) once.  After that, reading it costs no system calls
+ * at all, which is the point: a dashboard can poll it as often as it
+ * likes.
+ *
+ * There is one writer, the daemon, and it never waits for readers.
+ * Consistency comes from a sequence lock: the daemon makes seq odd,
+ * changes the data and makes seq even again; a reader that saw the
+ * same even seq before and after copying the data knows its copy is
+ * whole.
+ *
+ * When the daemon starts it unlinks any old page and makes a new one,
+ * so readers still holding the old one see its pid go to zero (or
+ * stop seeing t advance, if it died) and should attach again.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "shmpage.h"
+
+#define SHMPAGE_TRIES	10000		/* before a reader gives up */
+
+#define barrier() __sync_synchronize()
+
+/*
+ * Make a fresh page at path, readable by everyone.  Returns NULL with
+ * a message in errbuf if that cannot be done.
+ */
+struct shmpage *
+shmpage_create(const char *path, char *errbuf, size_t errlen)
+{
+	struct shmpage *page;
+	int fd;
+
+	if (unlink(path) && (errno != ENOENT)) {
+		snprintf(errbuf,errlen,"%s: %s",path,strerror(errno));
+		return NULL;
+	}
+	fd = open(path,O_RDWR|O_CREAT|O_EXCL,0644);
+	if (fd < 0) {
+		snprintf(errbuf,errlen,"%s: %s",path,strerror(errno));
+		return NULL;
+	}
+	if (ftruncate(fd,sizeof(*page))) {
+		snprintf(errbuf,errlen,"%s: %s",path,strerror(errno));
+		close(fd);
+		(void) unlink(path);
+		return NULL;
+	}
+	page = mmap(NULL,sizeof(*page),PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+	close(fd);
+	if (page == MAP_FAILED) {
+		snprintf(errbuf,errlen,"mmap %s: %s",path,strerror(errno));
+		(void) unlink(path);
+		return NULL;
+	}
+	page->version = SHMPAGE_VERSION;
+	page->size = sizeof(*page);
+	page->pid = getpid();
+	page->seq = 0;
+	barrier();
+	page->magic = SHMPAGE_MAGIC;
+	return page;
+}
+
+/*
+ * Replace the data in the page
+ */
+void
+shmpage_publish(struct shmpage *page, struct shmpage_data *data)
+{
+	if (!page)
+		return;
+	page->seq++;
+	barrier();
+	page->data = *data;
+	barrier();
+	page->seq++;
+}
+
+/*
+ * Tell readers we are gone, unmap the page and remove it
+ */
+void
+shmpage_destroy(struct shmpage *page, const char *path)
+{
+	if (!page)
+		return;
+	page->pid = 0;
+	(void) munmap(page,sizeof(*page));
+	if (path)
+		(void) unlink(path);
+}
+
+/*
+ * Map the page at path read-only.  Returns NULL with a message in
+ * errbuf if there is none or it is not one we understand.
+ */
+struct shmpage *
+shmpage_attach(const char *path, char *errbuf, size_t errlen)
+{
+	struct shmpage *page;
+	struct stat st;
+	int fd;
+
+	fd = open(path,O_RDONLY);
+	if (fd < 0) {
+		snprintf(errbuf,errlen,"%s: %s",path,strerror(errno));
+		return NULL;
+	}
+	if (fstat(fd,&st) || (st.st_size < (off_t)sizeof(*page))) {
+		snprintf(errbuf,errlen,"%s: not an osdhud page",path);
+		close(fd);
+		return NULL;
+	}
+	page = mmap(NULL,sizeof(*page),PROT_READ,MAP_SHARED,fd,0);
+	close(fd);
+	if (page == MAP_FAILED) {
+		snprintf(errbuf,errlen,"mmap %s: %s",path,strerror(errno));
+		return NULL;
+	}
+	if ((page->magic != SHMPAGE_MAGIC) ||
+	    (page->version != SHMPAGE_VERSION) ||
+	    (page->size != sizeof(*page))) {
+		snprintf(errbuf,errlen,"%s: wrong magic or version",path);
+		(void) munmap(page,sizeof(*page));
+		return NULL;
+	}
+	return page;
+}
+
+/*
+ * Copy a consistent snapshot of the data into out.  Returns 0 if the
+ * daemon is still there, 1 if it has gone and out holds the last
+ * thing it published, or -1 if no consistent copy could be had, which
+ * means the daemon died while writing.
+ */
+int
+shmpage_read(struct shmpage *page, struct shmpage_data *out)
+{
+	u_int32_t seq;
+	int tries;
+
+	for (tries = 0; tries < SHMPAGE_TRIES; tries++) {
+		seq = page->seq;
+		if (seq & 1)
+			continue;
+		barrier();
+		*out = page->data;
+		barrier();
+		if (page->seq == seq)
+			return page->pid ? 0 : 1;
+	}
+	return -1;
+}
+
+void
+shmpage_detach(struct shmpage *page)
+{
+	if (page)
+		(void) munmap(page,sizeof(*page));
+}
+
+/*
+ * Local variables:
+ * mode: c
+ * c-file-style: "bsd"
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ */
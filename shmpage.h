@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2015 by attila <attila@stalphonsos.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The page of latest probe results that the daemon publishes for -O
+ * and that daemons started with -c render instead of probing.
+ * Everything in it has a fixed size so that programs built without
+ * the rest of osdhud can map it; they only need this header and
+ * shmpage.c.
+ */
+
+#define SHMPAGE_MAGIC	0x4f53444d	/* "OSDM" */
+#define SHMPAGE_VERSION	2
+#define SHMPAGE_NAMSIZ	16
+#define SHMPAGE_STRSIZ	32
+
+struct shmpage_data {
+	u_int64_t	 t;		/* msecs since the epoch */
+	u_int64_t	 nprobes;	/* #of probes published */
+	u_int64_t	 net_ibytes;	/* totals on the watched interface */
+	u_int64_t	 net_obytes;
+	float		 load_avg;
+	float		 max_load_avg;	/* what the load bar is scaled to */
+	float		 mem_used;	/* fraction */
+	float		 swap_used;	/* fraction */
+	float		 net_ikbps;
+	float		 net_okbps;
+	float		 net_ipxps;
+	float		 net_opxps;
+	float		 temperature;	/* degC */
+	int32_t		 battery_life;	/* percent, -1 if no battery */
+	int32_t		 battery_time;	/* minutes, -1 if unknown */
+	u_int32_t	 uptime;	/* seconds */
+	u_int32_t	 alerts;	/* ALERT_xxx bits */
+	int32_t		 nswap;		/* #of swap devices */
+	int32_t		 net_speed_mbits; /* link speed, 0 if unknown */
+	char		 iface[SHMPAGE_NAMSIZ];
+	char		 battery_state[SHMPAGE_STRSIZ];
+	char		 temp_sensor[SHMPAGE_STRSIZ];
+};
+
+/*
+ * data is guarded by a sequence lock: seq is odd while the daemon is
+ * changing it, so a reader copies data out between two reads of seq
+ * and tries again if they differ or are odd.  Readers never write to
+ * the page and the daemon never waits for them.
+ */
+struct shmpage {
+	u_int32_t	 magic;
+	u_int32_t	 version;
+	u_int32_t	 size;		/* sizeof(struct shmpage) */
+	u_int32_t	 pid;		/* daemon's, 0 once it has gone */
+	volatile u_int32_t seq;
+	u_int32_t	 pad;
+	struct shmpage_data data;
+};
+
+/*
+ * API: the daemon's side
+ */
+struct shmpage *shmpage_create(const char *, char *, size_t);
+void shmpage_publish(struct shmpage *, struct shmpage_data *);
+void shmpage_destroy(struct shmpage *, const char *);
+
+/*
+ * API: readers
+ */
+struct shmpage *shmpage_attach(const char *, char *, size_t);
+int shmpage_read(struct shmpage *, struct shmpage_data *);
+void shmpage_detach(struct shmpage *);
+
+/*
+ * Local variables:
+ * mode: c
+ * c-file-style: "bsd"
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ */
@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2015 by attila <attila@stalphonsos.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Bounded, non-blocking output queues for streaming subscribers.
+ *
+ * Frames are formatted straight into the slot they will be sent from
+ * (sub_frame() then sub_push()), and the queue itself is a ring of slot
+ * numbers, so neither queueing nor dropping copies any frames.
+ * Nothing here ever blocks: a subscriber that stops reading just
+ * loses frames until it catches up.
+ */
+
+#include <sys/types.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "subscriber.h"
+
+/*
+ * Take over fd, which we make non-blocking, to send a frame every
+ * every'th tick
+ */
+struct subscriber *
+sub_new(int fd, int json, int every)
+{
+	struct subscriber *sub;
+	int flags = fcntl(fd,F_GETFL);
+	int i;
+
+	if ((flags < 0) || (fcntl(fd,F_SETFL,flags|O_NONBLOCK) < 0))
+		return NULL;
+	sub = calloc(1,sizeof(*sub));
+	assert(sub);
+	sub->fd = fd;
+	sub->json = json;
+	sub->every = (every > 0) ? every : 1;
+	sub->countdown = 1;
+	for (i = 0; i < SUB_QLEN; i++)
+		sub->order[i] = i;
+	return sub;
+}
+
+/*
+ * Hang up on a subscriber
+ */
+void
+sub_free(struct subscriber *sub)
+{
+	if (!sub)
+		return;
+	close(sub->fd);
+	free(sub);
+}
+
+/*
+ * Called once a tick; true if this tick's frame should be sent
+ */
+int
+sub_due(struct subscriber *sub)
+{
+	if (--sub->countdown > 0)
+		return 0;
+	sub->countdown = sub->every;
+	return 1;
+}
+
+/*
+ * Return the slot the next frame should be formatted into, making room
+ * by dropping the oldest frame not yet started if the queue is full
+ */
+char *
+sub_frame(struct subscriber *sub)
+{
+	if (sub->n == SUB_QLEN) {
+		int i = sub->off ? 1 : 0;
+		int victim = sub->order[(sub->head + i) % SUB_QLEN];
+
+		/* close up the gap; the victim's slot becomes the free one */
+		for (; i < sub->n - 1; i++)
+			sub->order[(sub->head + i) % SUB_QLEN] =
+				sub->order[(sub->head + i + 1) % SUB_QLEN];
+		sub->order[(sub->head + i) % SUB_QLEN] = victim;
+		sub->n--;
+		sub->ndropped++;
+	}
+	return sub->frames[sub->order[(sub->head + sub->n) % SUB_QLEN]];
+}
+
+/*
+ * Queue the len bytes formatted into the slot sub_frame() returned
+ */
+void
+sub_push(struct subscriber *sub, int len)
+{
+	assert((len > 0) && (len <= SUB_FRAME_MAX) && (sub->n < SUB_QLEN));
+	sub->lens[sub->order[(sub->head + sub->n) % SUB_QLEN]] = len;
+	sub->n++;
+}
+
+/*
+ * Write as much as the socket will take.  Returns the number of
+ * frames still queued, or -1 if the subscriber has gone away.
+ */
+int
+sub_flush(struct subscriber *sub)
+{
+	while (sub->n) {
+		int slot = sub->order[sub->head];
+		char *frame = sub->frames[slot];
+		int left = sub->lens[slot] - sub->off;
+		ssize_t nw = write(sub->fd,frame + sub->off,left);
+
+		if (nw < 0) {
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				break;
+			return -1;
+		}
+		sub->off += nw;
+		if (sub->off == sub->lens[slot]) {
+			sub->head = (sub->head + 1) % SUB_QLEN;
+			sub->n--;
+			sub->off = 0;
+			sub->nsent++;
+		}
+	}
+	return sub->n;
+}
+
+/*
+ * Local variables:
+ * mode: c
+ * c-file-style: "bsd"
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ */
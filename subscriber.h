@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2015 by attila <attila@stalphonsos.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define SUB_QLEN	8		/* frames queued per subscriber */
+#define SUB_FRAME_MAX	2048		/* largest frame */
+
+/*
+ * One client streaming snapshots off the control socket.  Frames that
+ * it cannot keep up with are dropped oldest first; a frame that has
+ * been partly written is never dropped, so the stream stays
+ * well-formed.
+ */
+struct subscriber {
+	int		 fd;		/* non-blocking */
+	int		 json;		/* format wanted */
+	int		 every;		/* send every n'th tick */
+	int		 countdown;	/* ticks until the next frame */
+	char		 frames[SUB_QLEN][SUB_FRAME_MAX];
+	int		 lens[SUB_QLEN];
+	int		 order[SUB_QLEN]; /* ring of frame slots, queue order */
+	int		 head;		/* position of the oldest queued frame */
+	int		 n;		/* #of queued frames */
+	int		 off;		/* bytes of head already written */
+	unsigned long	 nsent;
+	unsigned long	 ndropped;
+};
+
+/*
+ * API
+ */
+struct subscriber *sub_new(int, int, int);
+void sub_free(struct subscriber *);
+int sub_due(struct subscriber *);
+char *sub_frame(struct subscriber *);
+void sub_push(struct subscriber *, int);
+int sub_flush(struct subscriber *);
+
+/*
+ * Local variables:
+ * mode: c
+ * c-file-style: "bsd"
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ */
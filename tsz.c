@@ -0,0 +1,385 @@
+/*
+ * Copyright (C) 2015 by attila <attila@stalphonsos.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Compressed time series, after Facebook's Gorilla paper.
+ *
+ * Timestamps are stored as the difference between successive deltas,
+ * which is almost always zero or a few milliseconds of jitter since we
+ * sample at a fixed pause:
+ *
+ *	0			delta of delta is 0
+ *	10  + 7 bits		-63..64
+ *	110 + 9 bits		-255..256
+ *	1110 + 12 bits		-2047..2048
+ *	1111 + 32 bits		anything else
+ *
+ * Values are XORed with the previous one; most of our metrics change
+ * slowly or not at all, so the result is zero or has a short run of
+ * meaningful bits in the middle:
+ *
+ *	0			same value
+ *	10 + bits		meaningful bits fit the previous window
+ *	11 + 5 + 5 + bits	leading zeros, length-1, meaningful bits
+ *
+ * Blocks are recycled oldest first once they fall out of the
+ * retention window or we hit the block limit, so a series reaches a
+ * steady state without allocating.
+ */
+
+#include <sys/types.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tsz.h"
+
+static void
+put_bits(struct tsz_block *b, u_int64_t v, int n)
+{
+	while (n > 0) {
+		int room = 8 - (b->nbits & 7);
+		int take = (n < room) ? n : room;
+		unsigned int chunk = (v >> (n - take)) & ((1U << take) - 1);
+
+		b->bits[b->nbits >> 3] |= chunk << (room - take);
+		b->nbits += take;
+		n -= take;
+	}
+}
+
+static u_int64_t
+get_bits(const struct tsz_block *b, unsigned int *pos, int n)
+{
+	u_int64_t v = 0;
+
+	while (n > 0) {
+		int room = 8 - (*pos & 7);
+		int take = (n < room) ? n : room;
+		unsigned int byte = b->bits[*pos >> 3];
+
+		v = (v << take) | ((byte >> (room - take)) & ((1U << take) - 1));
+		*pos += take;
+		n -= take;
+	}
+	return v;
+}
+
+static u_int32_t
+float_bits(float f)
+{
+	u_int32_t u;
+
+	memcpy(&u,&f,sizeof(u));
+	return u;
+}
+
+static float
+bits_float(u_int32_t u)
+{
+	float f;
+
+	memcpy(&f,&u,sizeof(f));
+	return f;
+}
+
+/*
+ * Allocate an empty series keeping retain msecs of history in at most
+ * max_bytes of blocks
+ */
+struct tsz *
+tsz_new(unsigned long retain, size_t max_bytes)
+{
+	struct tsz *ts = calloc(1,sizeof(*ts));
+
+	assert(ts);
+	ts->retain = retain;
+	ts->max_blocks = max_bytes / sizeof(struct tsz_block);
+	if (ts->max_blocks < 2)
+		ts->max_blocks = 2;
+	ts->leading = -1;
+	return ts;
+}
+
+/*
+ * Forget all history
+ */
+void
+tsz_clear(struct tsz *ts)
+{
+	struct tsz_block *b, *next;
+
+	if (!ts)
+		return;
+	for (b = ts->head; b; b = next) {
+		next = b->next;
+		free(b);
+	}
+	ts->head = ts->tail = NULL;
+	ts->nblocks = 0;
+	ts->count = ts->nbits = 0;
+	ts->dropped_t = 0;
+	ts->leading = -1;
+}
+
+/*
+ * Tear down a series
+ */
+void
+tsz_free(struct tsz *ts)
+{
+	tsz_clear(ts);
+	free(ts);
+}
+
+/*
+ * Start a new tail block holding one sample, recycling the oldest
+ * block if it has expired or we are at our limit
+ */
+static void
+new_block(struct tsz *ts, unsigned long t, u_int32_t val)
+{
+	struct tsz_block *b = NULL;
+
+	while (ts->head && (ts->head != ts->tail) &&
+	       ((ts->nblocks >= ts->max_blocks) ||
+		((t > ts->head->t_last) &&
+		 (t - ts->head->t_last > ts->retain)))) {
+		struct tsz_block *old = ts->head;
+
+		ts->head = old->next;
+		ts->dropped_t = old->t_last;
+		ts->nblocks--;
+		ts->count -= old->count;
+		ts->nbits -= old->nbits;
+		free(b);
+		b = old;
+	}
+	if (!b) {
+		b = malloc(sizeof(*b));
+		assert(b);
+	}
+	memset(b,0,sizeof(*b));
+	b->t0 = b->t_last = t;
+	b->count = 1;
+	put_bits(b,val,32);
+	if (ts->tail)
+		ts->tail->next = b;
+	else
+		ts->head = b;
+	ts->tail = b;
+	ts->nblocks++;
+	ts->count++;
+	ts->nbits += b->nbits;
+	ts->prev_t = t;
+	ts->prev_delta = 0;
+	ts->prev_val = val;
+	ts->leading = -1;
+}
+
+static void
+put_dod(struct tsz_block *b, long dod)
+{
+	if (!dod)
+		put_bits(b,0,1);
+	else if ((dod >= -63) && (dod <= 64)) {
+		put_bits(b,2,2);
+		put_bits(b,dod + 63,7);
+	} else if ((dod >= -255) && (dod <= 256)) {
+		put_bits(b,6,3);
+		put_bits(b,dod + 255,9);
+	} else if ((dod >= -2047) && (dod <= 2048)) {
+		put_bits(b,14,4);
+		put_bits(b,dod + 2047,12);
+	} else {
+		put_bits(b,15,4);
+		put_bits(b,(u_int32_t)dod,32);
+	}
+}
+
+static long
+get_dod(const struct tsz_block *b, unsigned int *pos)
+{
+	int n;
+
+	for (n = 0; n < 4; n++)
+		if (!get_bits(b,pos,1))
+			break;
+	switch (n) {
+	case 0:
+		return 0;
+	case 1:
+		return (long)get_bits(b,pos,7) - 63;
+	case 2:
+		return (long)get_bits(b,pos,9) - 255;
+	case 3:
+		return (long)get_bits(b,pos,12) - 2047;
+	}
+	return (int32_t)get_bits(b,pos,32);
+}
+
+/*
+ * Append a sample taken at time t (milliseconds)
+ */
+void
+tsz_add(struct tsz *ts, unsigned long t, float v)
+{
+	u_int32_t val = float_bits(v);
+	struct tsz_block *b = ts->tail;
+	unsigned int before;
+	long delta, dod;
+	u_int32_t x;
+
+	if (!b || (t < ts->prev_t) || (t - ts->prev_t > 0x7fffffffUL) ||
+	    (b->nbits + TSZ_MAX_SAMPLE_BITS > TSZ_BLOCK_BYTES * 8)) {
+		new_block(ts,t,val);
+		return;
+	}
+	before = b->nbits;
+	delta = t - ts->prev_t;
+	dod = delta - ts->prev_delta;	/* both deltas fit in 31 bits */
+	put_dod(b,dod);
+	x = val ^ ts->prev_val;
+	if (!x)
+		put_bits(b,0,1);
+	else {
+		int lead = __builtin_clz(x);
+		int trail = __builtin_ctz(x);
+
+		if ((ts->leading >= 0) && (lead >= ts->leading) &&
+		    (trail >= ts->trailing)) {
+			put_bits(b,2,2);
+			put_bits(b,x >> ts->trailing,
+				 32 - ts->leading - ts->trailing);
+		} else {
+			put_bits(b,3,2);
+			put_bits(b,lead,5);
+			put_bits(b,32 - lead - trail - 1,5);
+			put_bits(b,x >> trail,32 - lead - trail);
+			ts->leading = lead;
+			ts->trailing = trail;
+		}
+	}
+	b->t_last = t;
+	b->count++;
+	ts->count++;
+	ts->nbits += b->nbits - before;
+	ts->prev_t = t;
+	ts->prev_delta = delta;
+	ts->prev_val = val;
+}
+
+/*
+ * How much memory the series uses
+ */
+size_t
+tsz_bytes(struct tsz *ts)
+{
+	return sizeof(*ts) + ts->nblocks * sizeof(struct tsz_block);
+}
+
+/*
+ * The average encoded size of a sample
+ */
+float
+tsz_bits_per_sample(struct tsz *ts)
+{
+	return ts->count ? (float)ts->nbits / ts->count : 0;
+}
+
+static void
+iter_block(struct tsz_iter *it, struct tsz_block *b)
+{
+	it->blk = b;
+	it->pos = 0;
+	it->left = b ? b->count : 0;
+	it->leading = -1;
+}
+
+/*
+ * Set up to decode the samples taken between from and to, inclusive
+ */
+void
+tsz_iter_init(struct tsz_iter *it, struct tsz *ts, unsigned long from,
+	      unsigned long to)
+{
+	struct tsz_block *b;
+
+	memset(it,0,sizeof(*it));
+	it->from = from;
+	it->to = to;
+	for (b = ts->head; b && (b->t_last < from); b = b->next)
+		;
+	iter_block(it,b);
+}
+
+/*
+ * Decode the next sample into *tp and *vp; returns 0 at the end
+ */
+int
+tsz_iter_next(struct tsz_iter *it, unsigned long *tp, float *vp)
+{
+	for (;;) {
+		struct tsz_block *b = it->blk;
+
+		if (!it->left) {
+			if (!b || !b->next || (b->next->t0 > it->to))
+				return 0;
+			iter_block(it,b->next);
+			continue;
+		}
+		if (!it->pos) {
+			it->t = b->t0;
+			it->delta = 0;
+			it->val = get_bits(b,&it->pos,32);
+		} else {
+			it->delta += get_dod(b,&it->pos);
+			it->t += it->delta;
+			if (get_bits(b,&it->pos,1)) {
+				if (get_bits(b,&it->pos,1)) {
+					it->leading = get_bits(b,&it->pos,5);
+					it->trailing = 32 - it->leading -
+						(get_bits(b,&it->pos,5) + 1);
+				}
+				it->val ^= get_bits(b,&it->pos,
+						    32 - it->leading -
+						    it->trailing) <<
+					it->trailing;
+			}
+		}
+		it->left--;
+		if (it->t > it->to) {
+			it->left = 0;
+			it->blk = NULL;
+			return 0;
+		}
+		if (it->t < it->from)
+			continue;
+		*tp = it->t;
+		*vp = bits_float(it->val);
+		return 1;
+	}
+}
+
+/*
+ * Local variables:
+ * mode: c
+ * c-file-style: "bsd"
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ */
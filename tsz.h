@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2015 by attila <attila@stalphonsos.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define TSZ_BLOCK_BYTES	4096
+#define TSZ_MAX_SAMPLE_BITS 80		/* worst case for one sample */
+
+/*
+ * A run of compressed samples.  Each block decodes on its own: the
+ * first timestamp is in the header and the first value is stored in
+ * full.
+ */
+struct tsz_block {
+	struct tsz_block *next;		/* next newer block */
+	unsigned long	 t0;		/* first timestamp, msecs */
+	unsigned long	 t_last;	/* last timestamp, msecs */
+	unsigned int	 count;		/* #of samples */
+	unsigned int	 nbits;		/* #of bits used */
+	unsigned char	 bits[TSZ_BLOCK_BYTES];
+};
+
+/*
+ * A compressed time series: a list of blocks, oldest first, holding
+ * at most retain milliseconds and max_blocks blocks of history
+ */
+struct tsz {
+	struct tsz_block *head;		/* oldest */
+	struct tsz_block *tail;		/* newest, being written */
+	unsigned long	 retain;
+	unsigned int	 max_blocks;
+	unsigned int	 nblocks;
+	u_int64_t	 count;		/* samples held */
+	u_int64_t	 nbits;		/* bits used by them */
+	unsigned long	 dropped_t;	/* newest sample thrown away, or 0 */
+	/* encoder state for the tail block */
+	unsigned long	 prev_t;
+	long		 prev_delta;
+	u_int32_t	 prev_val;
+	int		 leading;	/* -1 => no window yet */
+	int		 trailing;
+};
+
+/*
+ * Streaming decoder over [from,to]
+ */
+struct tsz_iter {
+	struct tsz_block *blk;
+	unsigned long	 from;
+	unsigned long	 to;
+	unsigned int	 pos;		/* bit offset into blk */
+	unsigned int	 left;		/* samples left in blk */
+	unsigned long	 t;
+	long		 delta;
+	u_int32_t	 val;
+	int		 leading;
+	int		 trailing;
+};
+
+/*
+ * API
+ */
+struct tsz *tsz_new(unsigned long, size_t);
+void tsz_free(struct tsz *);
+void tsz_clear(struct tsz *);
+void tsz_add(struct tsz *, unsigned long, float);
+size_t tsz_bytes(struct tsz *);
+float tsz_bits_per_sample(struct tsz *);
+void tsz_iter_init(struct tsz_iter *, struct tsz *, unsigned long,
+		   unsigned long);
+int tsz_iter_next(struct tsz_iter *, unsigned long *, float *);
+
+/*
+ * Local variables:
+ * mode: c
+ * c-file-style: "bsd"
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ */